@@ -1,9 +1,18 @@
 #include "chip8.h"
 #include "defines.h"
-#include <ctime>
+#include "jit.h"
+#include "profile.h"
+#include "quirks.h"
+#include "static_code.h"
+#include "trace.h"
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
+#define IDLE_LOOP_LENGTH 8		// Longest loop checked for being idle, in instructions
+#define IDLE_MISS_LIMIT 4		// Loops in a row that weren't idle before a head is given up on
+
 namespace chip8
 {
 	unsigned char chip8_fontset[80] = {
@@ -25,32 +34,143 @@ namespace chip8
 		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 	};
 
+	unsigned char schip_fontset[160] = {
+		0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+		0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+		0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+		0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+		0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+		0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+		0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+		0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+	};
+
+	namespace
+	{
+		// Instructions that only read and write registers, and read the delay timer and keys.
+		// Anything touching memory, the stack, the screen or the random numbers is out.
+		bool IsIdleSafe(unsigned char op)
+		{
+			switch (op)
+			{
+			case OP_INVALID:
+			case OP_1NNN:
+			case OP_3XKK: case OP_4XKK: case OP_5XY0: case OP_9XY0:
+			case OP_6XKK: case OP_7XKK:
+			case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_8XY4:
+			case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE:
+			case OP_ANNN: case OP_BNNN:
+			case OP_EX9E: case OP_EXA1:
+			case OP_FX07: case OP_FX0A: case OP_FX1E: case OP_FX29:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		Instruction DecodeForMachine(unsigned short opcode, Machine machine)
+		{
+			return machine == MACHINE_XOCHIP ? DecodeOpcode(opcode) : DecodeClassicOpcode(opcode);
+		}
+	}
+
 	Chip8::Chip8()
 	{
+		jit_ = nullptr;
+		static_code_ = nullptr;
+		profile_ = nullptr;
+		trace_ = nullptr;
+		machine_ = MACHINE_CHIP8;
+		quirks_ = QUIRKS_DEFAULT;
+		UseQuirks<DefaultQuirks>();
+		idle_skip_ = true;
+		memset(rpl_, 0, sizeof(rpl_));
+		cycles_per_frame_ = DEFAULT_CYCLES_PER_FRAME;
+		seed_ = DEFAULT_RANDOM_SEED;
 		Init();
 	}
 
 	Chip8::~Chip8()
 	{
-		delete[] gfx_;
-		gfx_ = nullptr;
+		delete jit_;
+		jit_ = nullptr;
+		delete profile_;
+		profile_ = nullptr;
+		delete trace_;
+		trace_ = nullptr;
 	}
 
 	void Chip8::Init()
 	{
-		opcode_ = 0;
+		SelectMemory();
+		memset(memory_, 0, address_mask_ + 1);
+		memcpy(memory_, chip8_fontset, sizeof(chip8_fontset));
+		memcpy(memory_ + BIG_FONT_ADDRESS, schip_fontset, sizeof(schip_fontset));
+
+		ResetRegisters();
+		FlushCodeCaches();
+		ResetForkBase();
+		SaveBootImage();
+	}
 
-		for (int i = 0; i < 4096; i++)
+	void Chip8::Reset()
+	{
+		if (machine_ != boot_machine_)
 		{
-			if (i < 80)
+			// LoadState() or LoadFork() switched machines since, all of memory goes back
+			machine_ = boot_machine_;
+			SelectMemory();
+			if (machine_ == MACHINE_XOCHIP)
 			{
-				memory_[i] = chip8_fontset[i];
+				SetEngine(ENGINE_INTERPRETER);
 			}
-			else
+			memcpy(memory_, &boot_image_[0], boot_image_.size());
+			const StaticCode *static_code = static_code_;
+			FlushCodeCaches();
+			SetStaticCode(static_code);
+			ResetForkBase();
+		}
+		else
+		{
+			// A changed byte at a time through StoreByte(), which keeps the code caches right
+			unsigned int pages = (unsigned int)boot_image_.size() / FORK_PAGE_SIZE;
+			for (unsigned int p = 0; p < pages; p++)
 			{
-				memory_[i] = 0;
+				const unsigned char *image = &boot_image_[p * FORK_PAGE_SIZE];
+				unsigned int address = p * FORK_PAGE_SIZE;
+				if (!(boot_dirty_[p / 8] & (1 << (p % 8))) || memcmp(memory_ + address, image, FORK_PAGE_SIZE) == 0)
+				{
+					continue;
+				}
+				for (unsigned int b = 0; b < FORK_PAGE_SIZE; b++)
+				{
+					if (memory_[address + b] != image[b])
+					{
+						StoreByte((unsigned short)(address + b), image[b]);
+					}
+				}
 			}
 		}
+		memset(boot_dirty_, 0, sizeof(boot_dirty_));
+		if (quirks_ != boot_quirks_)
+		{
+			SetQuirks(boot_quirks_);
+		}
+
+		ResetRegisters();
+	}
+
+	void Chip8::ResetRegisters()
+	{
+		opcode_ = 0;
 
 		for (int i = 0; i < 16; i++)
 		{
@@ -58,621 +178,2092 @@ namespace chip8
 		}
 
 		i_ = 0;
-		pc_ = 0x200;
+		pc_ = ROM_ADDRESS;
 
-		gfx_ = new unsigned char[PIXEL_COUNT];
-		for (unsigned int i = 0; i < PIXEL_COUNT; i++)
-		{
-			gfx_[i] = 0;
-		}
+		hires_ = false;
+		planes_ = 1;
+		memset(gfx_, 0, sizeof(gfx_));
 		need_redraw_ = true;
+		dirty_rows_ = ALL_ROWS_DIRTY;
+
+		memset(audio_pattern_, 0, sizeof(audio_pattern_));
+		pitch_ = 64;
 
 		delay_timer_ = 0;
 		sound_timer_ = 0;
+		frame_cycle_ = 0;
+		halted_ = false;
 
 		sp_ = 0;
+		memset(stack_, 0, sizeof(stack_));
 
 		for (unsigned int i = 0; i < 16; i++)
 		{
 			keys_[i] = false;
 		}
 
-		srand((unsigned int)time(NULL));
+		SetSeed(seed_);
+		idle_cycles_ = 0;
 	}
 
-	void Chip8::LoadGame(const std::string &game_name)
+	void Chip8::SaveBootImage()
 	{
-		char *rom = nullptr; // We will store the rom in temporary area
-		unsigned long size = 0;
-		static unsigned int start_pos = 0x200;	// Programs start in 0x200 in chip8 normally
-		std::ifstream input;
-		//prepare f to throw if failbit gets set
-		std::ios_base::iostate exceptionMask = input.exceptions() | std::ios::failbit;
-		input.exceptions(exceptionMask);
+		// assign() keeps the vector's storage when the size is the same as before
+		boot_image_.assign(memory_, memory_ + address_mask_ + 1);
+		boot_machine_ = machine_;
+		boot_quirks_ = quirks_;
+		memset(boot_dirty_, 0, sizeof(boot_dirty_));
+	}
 
-		try {
-			input.open(game_name, std::ios::binary);
+	RomError Chip8::LoadGame(const std::string &game_name)
+	{
+		std::vector<unsigned char> rom;
+		RomError error = ReadRom(game_name, rom);
+		if (error == ROM_OK)
+		{
+			error = LoadGame(rom.empty() ? nullptr : &rom[0], (unsigned int)rom.size());
 		}
-		catch (std::ios_base::failure& e) {
-			std::cerr << e.what() << '\n';
+
+		if (error != ROM_OK)
+		{
+			std::cout << "Error: could not load " << game_name << ", " << GetRomErrorText(error) << std::endl;
+			return error;
 		}
+		std::cout << "Loaded " << game_name << std::endl;
+		return ROM_OK;
+	}
 
-		if (input && input.is_open())
+	RomError Chip8::LoadGame(const unsigned char *rom, unsigned int size)
+	{
+		if (size > (unsigned int)address_mask_ + 1 - ROM_ADDRESS)
 		{
-			input.seekg(0, std::ios::end);	// Go to the end of the file
-			size = (unsigned long)input.tellg(); // Record pos so that we can get the size of the file
-			if (size + start_pos >= 4096)
-			{
-				std::cout << "Error: " << game_name << " is to large to load into memory." << std::endl;
-			}
-			else
+			return ROM_TOO_LARGE;
+		}
+
+		if (size > 0)
+		{
+			memcpy(memory_ + ROM_ADDRESS, rom, size);
+		}
+		FlushCodeCaches();
+		ResetForkBase();
+		SaveBootImage();
+		return ROM_OK;
+	}
+
+	RomError Chip8::ReadRom(const std::string &file_name, std::vector<unsigned char> &rom)
+	{
+		std::ifstream input(file_name, std::ios::binary | std::ios::ate);
+		if (!input)
+		{
+			return ROM_NOT_FOUND;
+		}
+
+		std::streamoff size = input.tellg();
+		if (size < 0)
+		{
+			return ROM_READ_ERROR;
+		}
+		if (size > MEMORY_SIZE - ROM_ADDRESS)
+		{
+			return ROM_TOO_LARGE;
+		}
+
+		rom.resize((size_t)size);
+		input.seekg(0, std::ios::beg);
+		if (size > 0 && !input.read((char *)&rom[0], size))
+		{
+			return ROM_READ_ERROR;
+		}
+		return ROM_OK;
+	}
+
+	const char *Chip8::GetRomErrorText(RomError error)
+	{
+		switch (error)
+		{
+		case ROM_OK: return "no error";
+		case ROM_NOT_FOUND: return "the file could not be opened";
+		case ROM_READ_ERROR: return "the file could not be read";
+		case ROM_TOO_LARGE: return "it is too large to load into memory";
+		}
+		return "unknown error";
+	}
+
+	void Chip8::SetMachine(Machine machine)
+	{
+		machine_ = machine;
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			// The JIT and tools/recompile only know the 4K machine's instructions and skips
+			SetEngine(ENGINE_INTERPRETER);
+		}
+		SetQuirks(machine_ == MACHINE_XOCHIP ? QUIRKS_XOCHIP : QUIRKS_DEFAULT);
+		Init();
+	}
+
+	Machine Chip8::GetMachine()
+	{
+		return machine_;
+	}
+
+	template <class Quirks>
+	void Chip8::UseQuirks()
+	{
+		execute_ = &Chip8::Execute<Quirks>;
+		run_ = &Chip8::RunFrames<Quirks>;
+	}
+
+	void Chip8::SetQuirks(QuirkProfile quirks)
+	{
+		// The only place the profile is looked at, from here on it's compiled into whatever runs
+		switch (quirks)
+		{
+		case QUIRKS_COSMAC: UseQuirks<CosmacQuirks>(); break;
+		case QUIRKS_SCHIP: UseQuirks<SchipQuirks>(); break;
+		case QUIRKS_XOCHIP: UseQuirks<XochipQuirks>(); break;
+		default: quirks = QUIRKS_DEFAULT; UseQuirks<DefaultQuirks>(); break;
+		}
+		quirks_ = quirks;
+
+		if (quirks_ != QUIRKS_DEFAULT)
+		{
+			// The JIT and tools/recompile have the default behaviour built in
+			SetEngine(ENGINE_INTERPRETER);
+			static_code_ = nullptr;
+		}
+	}
+
+	QuirkProfile Chip8::GetQuirks()
+	{
+		return quirks_;
+	}
+
+	bool Chip8::ParseQuirks(const std::string &name, QuirkProfile &quirks)
+	{
+		static const char *const names[] = { "default", "cosmac", "schip", "xochip" };
+		for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		{
+			if (name == names[i])
 			{
-				input.seekg(0, std::ios::beg); // Rewind back to the start
-				rom = new char[size + 1]; // Allocate some memory to load the rom into
-				input.read(rom, size);
+				quirks = (QuirkProfile)i;
+				return true;
 			}
-			input.close();
+		}
+		return false;
+	}
+
+	void Chip8::SelectMemory()
+	{
+		// Only XO-CHIP needs more than the 4K inside the object, keeping the others small
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			xo_memory_.resize(MEMORY_SIZE);
+			memory_ = &xo_memory_[0];
+			address_mask_ = MEMORY_SIZE - 1;
 		}
 		else
 		{
-			std::cout << "Error: problem loading " << game_name << std::endl;
+			memory_ = chip8_memory_;
+			address_mask_ = CHIP8_MEMORY_SIZE - 1;
+		}
+	}
+
+	void Chip8::FlushCodeCaches()
+	{
+		for (unsigned int i = 0; i < 4096; i++)
+		{
+			decode_cache_[i].op = OP_UNDECODED;
 		}
 
-		if (rom != nullptr)
+		if (jit_)
 		{
-			for (unsigned int i = start_pos; i < 4096 && i - start_pos < size; i++)
-			{
-				// Fill up the memory with the rom
-				memory_[i] = (unsigned char)rom[i - start_pos];
-			}
-			std::cout << "Loaded " << game_name << std::endl;
-			delete[] rom;
-			rom = nullptr;
+			jit_->Flush();
 		}
+
+		static_code_ = nullptr;
+
+		memset(idle_rejected_, 0, sizeof(idle_rejected_));
+		idle_misses_ = 0;
 	}
 
-	void Chip8::Cycle()
+	void Chip8::ResetForkBase()
 	{
-		// Fetch two successive bytes and merge them to get the actual code
-		opcode_ = memory_[pc_] << 8 | memory_[pc_ + 1];
+		fork_base_.reset();
+		memset(fork_dirty_, 0, sizeof(fork_dirty_));
+	}
 
-		// Decode and Execute
-		switch (opcode_ & 0xF000)
-		{
-		case 0x0000:
-			// 0x0NNN SYS addr
-			// Jump to a machine code routine at NNN
-			// This instruction is only used on the old computers on which Chip-8 was originally implemented. It is ignored by modern interpreters
-			switch (opcode_ & 0x00F0)
-			{
-			case 0x00C0:
-				// 0x00CN SCD nibble
-				// Scroll down N lines
-				// When in chip8 mode scrolls down N/2 lines, when in SuperChip mode scroll down N lines
-				// TODO
-				pc_ += 2;
-				break;
-			}
+	void Chip8::StoreByte(unsigned short address, unsigned char value)
+	{
+		address &= address_mask_;
+		memory_[address] = value;
+		unsigned int page = address / FORK_PAGE_SIZE;
+		fork_dirty_[page / 8] |= 1 << (page % 8);
+		boot_dirty_[page / 8] |= 1 << (page % 8);
+
+		// Code above 4K is never cached, except for the instruction at 0xFFF whose low half is at 0x1000
+		if (address > 0x1000)
+		{
+			return;
+		}
+		address &= 0xFFF;
+
+		if (decode_cache_[address].op != OP_UNDECODED || decode_cache_[(address - 1) & 0xFFF].op != OP_UNDECODED)
+		{
+			// Rewriting code that has run, a loop given up on may be idle now
+			memset(idle_rejected_, 0, sizeof(idle_rejected_));
+		}
+
+		// The byte is the low half of the instruction before it and the high half of its own
+		decode_cache_[(address - 1) & 0xFFF].op = OP_UNDECODED;
+		decode_cache_[address].op = OP_UNDECODED;
+
+		if (jit_)
+		{
+			jit_->Invalidate(address);
+		}
 
-			switch (opcode_ & 0x00FF)
+		if (static_code_ && (static_code_->code_map[address >> 3] & (1 << (address & 7))))
+		{
+			// The ROM is rewriting its own code, the generated blocks don't match it anymore
+			static_code_ = nullptr;
+		}
+	}
+
+	inline unsigned long long Chip8::SpriteRow(unsigned short address, bool wide, unsigned int line)
+	{
+		// Left aligned in the word, 16 pixels from two bytes for wide sprites, 8 from one otherwise
+		if (wide)
+		{
+			return (unsigned long long)(memory_[(address + line * 2) & address_mask_] << 8 |
+				memory_[(address + line * 2 + 1) & address_mask_]) << 48;
+		}
+		return (unsigned long long)memory_[(address + line) & address_mask_] << 56;
+	}
+
+	inline unsigned short Chip8::SkipLength()
+	{
+		// XO-CHIP's F000 NNNN is two words long and gets skipped as a whole
+		if (machine_ == MACHINE_XOCHIP && memory_[(pc_ + 2) & address_mask_] == 0xF0 && memory_[(pc_ + 3) & address_mask_] == 0x00)
+		{
+			return 6;
+		}
+		return 4;
+	}
+
+	inline unsigned long long Chip8::DrawSprite(unsigned long long *gfx, unsigned short address, unsigned int x, unsigned int y,
+		unsigned int height, bool wide, unsigned long long &dirty)
+	{
+		// Each screen row is one or two words with the leftmost pixel in the top bit, so a sprite
+		// row goes on screen with a rotate or two shifts, an AND to check for collisions and an XOR
+		unsigned long long collisions = 0;
+		if (!hires_)
+		{
+			for (unsigned int yline = 0; yline < height; yline++)
 			{
-			case 0x00E0:
-				// 0x00E0 CLS
-				// Clear screen
-				for (unsigned int i = 0; i < PIXEL_COUNT; i++)
-					gfx_[i] = 0;
-				need_redraw_ = true;
-				pc_ += 2;
-				break;
-			case 0x00EE:
-				// 0x00EE RET
-				// Return from a subroutine
-				sp_--; // Decrement stack pointer
-				pc_ = stack_[sp_];	// Set the program counter to the old position
-				pc_ += 2;
-				break;
-			case 0x00FB:
-				// 0x00FB SCR
-				// Scroll 4 pixels right in SuperChip mode, or 2 pixels in Chip8 mode
-				// TODO
-				pc_ += 2;
-				break;
-			case 0x00FC:
-				// 0x00FC SCL
-				// Scroll 4 pixels left in SuperChip mode, or 2 pixels in Chip8 mode
-				// TODO
-				pc_ += 2;
-				break;
-			case 0x00FD:
-				// 0x00FD EXIT
-				// Exit the emulator
-				// TODO
-				std::cout << "Exit!" << std::endl;
-				break;
-			case 0x00FE:
-				// 0x00FE LOW
-				// Set emulator to normal Chip8 resolution, 64 x 32
-				// TODO
-				pc_ += 2;
-				break;
-			case 0x00FF:
-				// 0x00FF HIGH
-				// Set emulator to SuperChip resolution 128 x 64
-				// TODO
-				pc_ += 2;
-				break;
-			default:
-				break;
-			}
-			break;
-		case 0x1000:
-			// 0x1NNN JP addr
-			// Jump to location NNN
-			// Set the pc to location NNN
-			// THe interpreter sets the program counter to NNN
-			pc_ = opcode_ & 0x0FFF;
-			break;
-		case 0x2000:
-			// 0x2NNN CALL addr
-			// Call the subroutine at NNN
-			// The interpreter increments the stack pointers, then puts the 
-			// current PC on the top of the stack. The PC is then set to NNN
-			stack_[sp_] = pc_; // Store the current position on the stack
-			sp_++;	// Increment the stack pointer
-			pc_ = opcode_ & 0x0FFF;
-			break;
-		case 0x3000:
-			// 0x3XKK SE Vx, byte
-			// Skip next intstruction if Vx = KK
-			// The interpreter compares register Vx to KK, and if they are equal
-			// increments the program counter by 2 (2 step means 4 bytes)
-			if (v_[(opcode_ & 0x0F00) >> 8] == (opcode_ & 0x00FF))
-			{
-				// >> 8 shifts the result 8 bits right, making it a 1 byte value
-				// KK doesn't need shifting since it is already on the right
-				pc_ += 4;
+				unsigned long long sprite = SpriteRow(address, wide, yline);
+				unsigned int row_index = (y + yline) % CHIP8_PIXEL_HEIGHT;
+				unsigned long long &row = gfx[row_index];
+
+				// Rotating rather than shifting wraps the sprite around to the other side of the screen
+				sprite = x == 0 ? sprite : (sprite >> x) | (sprite << (64 - x));
+
+				collisions |= row & sprite;
+				row ^= sprite;
+				dirty |= (unsigned long long)(sprite != 0) << row_index;
 			}
-			else
+		}
+		else
+		{
+			// Whatever shifts out of the word x lands in goes into the other one, which is the
+			// next word or, past the right edge, the first word of the row
+			unsigned int shift = x & 63;
+			for (unsigned int yline = 0; yline < height; yline++)
 			{
-				pc_ += 2;
+				unsigned long long sprite = SpriteRow(address, wide, yline);
+				unsigned int row_index = (y + yline) % SCHIP_PIXEL_HEIGHT;
+				unsigned long long *row = gfx + row_index * 2;
+				unsigned long long &first = row[x >> 6];
+				unsigned long long &second = row[(x >> 6) ^ 1];
+				unsigned long long spill = shift == 0 ? 0 : sprite << (64 - shift);
+				sprite >>= shift;
+
+				collisions |= (first & sprite) | (second & spill);
+				first ^= sprite;
+				second ^= spill;
+				dirty |= (unsigned long long)((sprite | spill) != 0) << row_index;
 			}
-			break;
-		case 0x4000:
-			// 0x4XKK SNE Vx, byte
-			// Skip next instruction if Vx != KK
-			// The interpreter compares register Vx to KK, and if they are not equal,
-			// increments the program counter by 2 (2 steps means 4 bytes)
-			if (v_[(opcode_ & 0x0F00) >> 8] != (opcode_ & 0x00FF))
+		}
+		return collisions;
+	}
+
+	void Chip8::ClearScreen()
+	{
+		unsigned int words = hires_ ? 2 : 1;
+		unsigned int height = hires_ ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+		for (unsigned int plane = 0; plane < 2; plane++)
+		{
+			if (!(planes_ & (1 << plane)))
 			{
-				pc_ += 4;
+				continue;
 			}
-			else
+			for (unsigned int y = 0; y < height; y++)
 			{
-				pc_ += 2;
+				unsigned long long *row = gfx_[plane] + y * words;
+				if (row[0] != 0 || row[words - 1] != 0)
+				{
+					row[0] = 0;
+					row[words - 1] = 0;
+					dirty_rows_ |= 1ull << y;
+				}
 			}
-			break;
-		case 0x5000:
-			// 0x5XY0 SE Vx, Vy
-			// Skip next instruction if Vx = Vy
-			// The interpreter compares register Vx to register Vy, and if they are equal,
-			// increments the program counter by 2 (2 means 4 bytes)
-			if (v_[(opcode_ & 0x0F00) >> 8] == v_[(opcode_ & 0x00F0) >> 4])
+		}
+		need_redraw_ = true;
+	}
+
+	void Chip8::SetResolution(bool hires)
+	{
+		// The rows are laid out differently in each resolution, so like the SuperChip
+		// a switch starts over from a blank screen, every plane of it
+		hires_ = hires;
+		memset(gfx_, 0, sizeof(gfx_));
+		dirty_rows_ = ALL_ROWS_DIRTY;
+		need_redraw_ = true;
+	}
+
+	void Chip8::ScrollVertical(int lines)
+	{
+		if (lines == 0)
+		{
+			return;
+		}
+
+		// Whole rows move a word at a time, starting from the side they move towards so every
+		// row is read before it's overwritten. Only rows that come out different are marked dirty.
+		unsigned int words = hires_ ? 2 : 1;
+		int height = hires_ ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+		int first = lines > 0 ? height - 1 : 0;
+		int step = lines > 0 ? -1 : 1;
+		unsigned long long dirty = 0;
+		for (unsigned int plane = 0; plane < 2; plane++)
+		{
+			if (!(planes_ & (1 << plane)))
 			{
-				pc_ += 4;
+				continue;
 			}
-			else
+			unsigned long long *gfx = gfx_[plane];
+			for (int y = first; y >= 0 && y < height; y += step)
 			{
-				pc_ += 2;
-			}
-			break;
-		case 0x6000:
-			// 0x6XKK LD Vx, byte
-			// Set Vx = KK
-			// The interpreter puts the value KK into register Vx
-			v_[(opcode_ & 0x0F00) >> 8] = opcode_ & 0x00FF;
-			pc_ += 2;
-			break;
-		case 0x7000:
-			// 0x7XKK ADD Vx, byte
-			// Set Vx = Vx + KK
-			// Adds the value KK to the value of register Vx, then stores the result in Vx
-			v_[(opcode_ & 0x0F00) >> 8] += opcode_ & 0x00FF;
-			pc_ += 2;
-			break;
-		case 0x8000:
-			// 0x8??? opcodes
-			switch (opcode_ & 0x000F)
-			{
-			case 0x0000:
-				// 0x8XY0 LD Vx, Vy
-				// Set Vx = Vy
-				// Stores the value of register Vy in register Vx
-				v_[(opcode_ & 0x0F00) >> 8] = v_[(opcode_ & 0x00F0) >> 4];
-				pc_ += 2;
-				break;
-			case 0x0001:
-				// 0x8XY1 OR Vx, Vy
-				// Set Vx = Vx OR Vy
-				// Performs a bitwise OR on the values of Vx and Vy, then stores
-				// the result in Vx. A bitwise OR compares the corresponding bits
-				// from two values, and if either bit is 1, then the same bit in 
-				// result is also 1. Otherwise, it is 0
-				v_[(opcode_ & 0x0F00) >> 8] |= v_[(opcode_ & 0x00F0) >> 4];
-				pc_ += 2;
-				break;
-			case 0x0002:
-				// 0x8XY2 AND Vx, Vy
-				// Set Vx = Vx AND Vy
-				// Performs a bitwise AND on the values of Vx and Vy, then stores
-				// the result in Vx. A bitwise AND compares the corresponding bits
-				// from two values, and if both bits are 1, then the same bit in the
-				// result is also 1. Otherwise, it is 0
-				v_[(opcode_ & 0x0F00) >> 8] &= v_[(opcode_ & 0x00F0) >> 4];
-				pc_ += 2;
-				break;
-			case 0x0003:
-				// 0x8XY3 XOR Vx, Vy
-				// Set Vx = Vx XOR Vy
-				// Bitwise XOR is ^=
-				v_[(opcode_ & 0x0F00) >> 8] ^= v_[(opcode_ & 0x00F0) >> 4];
-				pc_ += 2;
-				break;
-			case 0x0004:
-				// 0x8XY4 ADD Vx, Vy
-				// Set Vx = Vx + Vy, set VF = carry
-				// The values of Vx and Vy are added together. If the result is greater than
-				// 8 bits (i.e. > 255) VF is set to 1, otherwise 0. Only the lowest 8 bits of the
-				// result are kept, and stored in Vx.
-				if (v_[(opcode_ & 0x00F0) >> 4] > (0xFF - v_[(opcode_ & 0x0F00) >> 8]))
-				{
-					v_[0xF] = 1;	// There is a carry
-				}
-				else
-				{
-					v_[0xF] = 0;	// There is no carry
-				}
-				v_[(opcode_ & 0x0F00) >> 8] += v_[(opcode_ & 0x00F0) >> 4]; // Set the value
-				pc_ += 2;
-				break;
-			case 0x0005:
-				// 0x8XY5 SUB Vx, Vy
-				// Set Vx = Vx - Vy, set VF = NOT borrow
-				// If Vx > Vy, the VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, 
-				// and then the results stored in Vx.
-				if (v_[(opcode_ & 0x00F0) >> 4] > v_[(opcode_ & 0x0F00) >> 8])
-				{
-					v_[0xF] = 0; // There is a borrow
-				}
-				else
-				{
-					v_[0xF] = 1;
-				}
-				v_[(opcode_ & 0x0F00) >> 8] -= v_[(opcode_ & 0x00F0) >> 4]; // Set the value
-				pc_ += 2;
-				break;
-			case 0x0006:
-				// 0x8XY6 SHR Vx {, Vy}
-				// Set Vx = Vx SHR 1.
-				// If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
-				// The Vx is divided by 2
-				// Shift Vx to the right. Setting VF to 1 if the least significant bit is a 1
-				// else setting it to 0
-				v_[0xF] = v_[(opcode_ & 0x0F00) >> 8] & 0x1;
-
-				// Shorthand for shiftingand setting
-				v_[(opcode_ & 0x0F00) >> 8] >>= 1; // Set the value
-				pc_ += 2;
-				break;
-			case 0x0007:
-				// 0x8XY7 SUBN Vx, Vy
-				// Set Vx = Vy - Vx, Set VF = NOT borrow
-				// If Vy > Vx, the VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
-				// and the results stored in Vx.
-				if (v_[(opcode_ & 0x00F0) >> 4] > v_[(opcode_ & 0x0F00) >> 8])
-				{
-					v_[0xF] = 1;
-				}
-				else
+				int from = y - lines;
+				for (unsigned int w = 0; w < words; w++)
 				{
-					v_[0xF] = 0; // There is a borrow
+					unsigned long long word = from >= 0 && from < height ? gfx[from * words + w] : 0;
+					if (gfx[y * words + w] != word)
+					{
+						gfx[y * words + w] = word;
+						dirty |= 1ull << y;
+					}
 				}
+			}
+		}
+		dirty_rows_ |= dirty;
+		need_redraw_ = true;
+	}
 
-				v_[(opcode_ & 0x0F00) >> 8] = v_[(opcode_ & 0x00F0) >> 4] - v_[(opcode_ & 0x0F00) >> 8];
-				pc_ += 2;
-				break;
-			case 0x000E:
-				// 0x8XYE SHL Vx {, Vy}
-				// Set Vx = Vx SHL 1
-				// If the most significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
-				// Then Vx is multiplied by 2.
-				v_[0xF] = v_[(opcode_ & 0x0F00) >> 8] >> 7;
-
-				// Shorthand for shifting and setting
-				v_[(opcode_ & 0x0F00) >> 8] <<= 1; 
-				pc_ += 2;
-				break;
-			default:
-				break;
+	void Chip8::ScrollSideways(int pixels)
+	{
+		// Every row shifts as a whole, in high resolution the bits crossing the middle move
+		// from one word of the row to the other
+		unsigned long long dirty = 0;
+		for (unsigned int plane = 0; plane < 2; plane++)
+		{
+			if (!(planes_ & (1 << plane)))
+			{
+				continue;
 			}
-			break;
-		case 0x9000:
-			// 0x9XY0 SNE Vx, Vy
-			// Skip next instruction if Vx != Vy
-			// The values of Vx and Vy are compared, and if they are not equal,
-			// the program counter is increased by 2 (4 bytes)
-			if (v_[(opcode_ & 0x0F00) >> 8] != v_[(opcode_ & 0x00F0) >> 4])
+			unsigned long long *gfx = gfx_[plane];
+			if (!hires_)
 			{
-				pc_ += 4;
+				for (unsigned int y = 0; y < CHIP8_PIXEL_HEIGHT; y++)
+				{
+					unsigned long long row = gfx[y];
+					unsigned long long shifted = pixels > 0 ? row >> pixels : row << -pixels;
+					gfx[y] = shifted;
+					dirty |= (unsigned long long)(shifted != row) << y;
+				}
 			}
 			else
 			{
-				pc_ += 2;
-			}
-			break;
-		case 0xA000:
-			// 0xANNN LD I, addr
-			// Set I = NNN
-			// The value of register I is set to NNN
-			i_ = opcode_ & 0x0FFF;
-			pc_ += 2;
-			break;
-		case 0xB000:
-			// 0xBNNN JP V0, addr
-			// Jump to location NNN + V0
-			// The program counter is set to NNN plus the value of V0.
-			pc_ = (opcode_ & 0x0FFF) + v_[0x0];
-			break;
-		case 0xC000:
-			// 0xCXKK - RND Vx, byte
-			// Set Vx = random byte AND KK
-			// The interpreter generates a random number from 0 to 255, which is then 
-			// ANDed with the value KK. The results are stored in Vx. See instruction
-			// 0x8XY2 for more information about AND
-			v_[(opcode_ & 0x0F00) >> 8] = (rand() % 0xFF) & (opcode_ & 0x00FF);
-			pc_ += 2;
-			break;
-		case 0xD000:
-			{
-				// 0xDXYN DRW Vx, Vy, nibble
-				// Display N-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-				// The interpreter reads N bytes from memory, startingat the address stored in I.
-				// These bytes are then displayed as sprites on screen at coordinates (Vx, Vy).
-				// Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
-				// VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of
-				// of it is outside the coordinates of the display, it wraps around to the opposite side
-				// of the screen. See instruction 0x8XY3 for more information on XOR, 
-
-				// TODO: Add support for 8*16 and 16*16 sprites when using height of 0 (for Chip8 and SuperChip)
-				unsigned short x = v_[(opcode_ & 0x0F00) >> 8];
-				unsigned short y = v_[(opcode_ & 0x00F0) >> 4];
-				unsigned short height = opcode_ & 0x000F;
-				v_[0xF] = 0;	// set Vf to 0, will be set to 1 if any collisions occur
-
-				unsigned short pixel;
-				// For each row of the sprite
-				for (unsigned int yline = 0; yline < height; yline++)
+				unsigned int shift = pixels > 0 ? pixels : -pixels;
+				for (unsigned int y = 0; y < SCHIP_PIXEL_HEIGHT; y++)
 				{
-					pixel = memory_[i_ + yline];
-
-					// For each pixel in the row
-					for (unsigned int xline = 0; xline < 8; xline++)
+					unsigned long long left = gfx[y * 2];
+					unsigned long long right = gfx[y * 2 + 1];
+					if (pixels > 0)
+					{
+						gfx[y * 2] = left >> shift;
+						gfx[y * 2 + 1] = (right >> shift) | (left << (64 - shift));
+					}
+					else
 					{
-						// Check if there is a pixel that needs drawing present at that x and y in the sprite
-						if ((pixel & (0x80 >> xline)) != 0)
-						{
-							// Check if there is a sprite already there in our graphics
-							if (gfx_[(x + xline + ((y + yline) * CHIP8_PIXEL_WIDTH))] == 1)
-							{
-								v_[0xF] = 1; // If there is set the flag
-							}
-
-							gfx_[(x + xline + ((y + yline) * CHIP8_PIXEL_WIDTH))] ^= 1; // XOR onto the screen
-						}
+						gfx[y * 2] = (left << shift) | (right >> (64 - shift));
+						gfx[y * 2 + 1] = right << shift;
 					}
+					dirty |= (unsigned long long)(gfx[y * 2] != left || gfx[y * 2 + 1] != right) << y;
 				}
-				need_redraw_ = true;
-				pc_ += 2;
 			}
-			break;
-		case 0xE000:
-			// 0xENNN
-			switch (opcode_ & 0x00FF)
-			{
-			case 0x009E:
-				// 0xEX9E SKP Vx
-				// Skip next instruction if key with the value of Vx is spressed
-				// Checks the keyboard, and if the key corresponding to the value
-				// of Vx is currently in the down position, PC is increased by 2.
-				if (keys_[v_[(opcode_ & 0x0F00) >> 8]])
-				{
-					pc_ += 4;
-				}
-				else
-				{
-					pc_ += 2;
-				}
-				break;
-			case 0x00A1:
-				// 0xEXA1 SKNP Vx
-				// Skip next instruction if key with the value of Vx is not pressed
-				if (!keys_[v_[(opcode_ & 0x0F00) >> 8]])
-				{
-					pc_ += 4;
-				}
-				else
-				{
-					pc_ += 2;
-				}
-				break;
-			default:
-				break;
+		}
+		dirty_rows_ |= dirty;
+		need_redraw_ = true;
+	}
+
+	void Chip8::EndCycles(unsigned int cycles)
+	{
+		unsigned long long frame_cycle = (unsigned long long)frame_cycle_ + cycles;
+		if (frame_cycle >= cycles_per_frame_)
+		{
+			// Frame boundary, the timers count down at 60Hz no matter how fast we run.
+			// Skipped idle loops can carry us over several at once.
+			unsigned long long frames = frame_cycle / cycles_per_frame_;
+			frame_cycle_ = (unsigned int)(frame_cycle % cycles_per_frame_);
+#ifdef CHIP8_PROFILE
+			if (profile_)
+			{
+				// Frames passed over by an idle skip ran nothing of their own
+				unsigned long long ran = profile_->frame_instructions;
+				unsigned long long low = frames > 1 ? 0 : ran;
+				profile_->frame_min = low < profile_->frame_min ? low : profile_->frame_min;
+				profile_->frame_max = ran > profile_->frame_max ? ran : profile_->frame_max;
+				profile_->frames += frames;
+				profile_->frame_instructions = 0;
 			}
-			break;
-		case 0xF000:
-			// 0xFNNN
-			switch (opcode_ & 0x00FF)
+#endif
+			delay_timer_ = delay_timer_ > frames ? (unsigned char)(delay_timer_ - frames) : 0;
+			sound_timer_ = sound_timer_ > frames ? (unsigned char)(sound_timer_ - frames) : 0;
+		}
+		else
+		{
+			frame_cycle_ = (unsigned int)frame_cycle;
+		}
+	}
+
+	void Chip8::Cycle()
+	{
+		if (!halted_)
+		{
+			unsigned short pc = pc_;
+			(this->*execute_)();
+			if (trace_)
 			{
-			case 0x0007:
-				// 0xFX07 LD Vx, DT
-				// Set Vx = delay timer value
-				// The value of DT is placed into Vx
-				v_[(opcode_ & 0x0F00) >> 8] = delay_timer_;
-				pc_ += 2;
-				break;
-			case 0x000A:
-				{
-					// 0xFX0A LD Vx, K
-					// Wait for keypress, store the value of the key in Vx
-					// All execution stops until a key is pressed, then the value
-					// of that key is stored in Vx.
-					bool key_pressed = false;
-					for (unsigned int i = 0; i < 16; i++)
-					{
-						if (keys_[i])
-						{
-							key_pressed = true;
-							v_[(opcode_ & 0x0F00) >> 8] = i;
-							break;
-						}
-					}
-					if (!key_pressed)
-					{
-						return; // Finish this instruction, essentially causing it to wait since pc_ hasn't been incremented
-					}
-					pc_ += 2;
-				}
-				break;
-			case 0x0015:
-				// 0xFX15 LD DT, Vx
-				// Set delay timer = Vx
-				// DT is set equal to the value of Vx
-				delay_timer_ = v_[(opcode_ & 0x0F00) >> 8];
-				pc_ += 2;
-				break;
-			case 0x0018:
-				// 0xFX18 LD ST, Vx
-				// Set sound timer = Vx
-				// ST is set equal to the value of Vx
-				sound_timer_ = v_[(opcode_ & 0x0F00) >> 8];
-				pc_ += 2;
-				break;
-			case 0x001E:
-				// 0xFX1E ADD I, Vx
-				// Set I = I + Vx
-				// The values of I and Vx are added, and the results are stored in I
-				if (i_ + v_[(opcode_ & 0x0F00) >> 8] > 0xFFF)
+				trace_->Record(pc, opcode_, 1, i_, v_);
+			}
+		}
+		EndCycles(1);
+	}
+
+	inline const Instruction &Chip8::Fetch(unsigned short pc)
+	{
+		pc &= address_mask_;
+		if (pc > 0xFFF)
+		{
+			// Only XO-CHIP gets up here, and mostly for data
+			far_instruction_ = DecodeForMachine(memory_[pc] << 8 | memory_[(pc + 1) & address_mask_], machine_);
+			return far_instruction_;
+		}
+
+		Instruction &ins = decode_cache_[pc];
+		if (ins.op == OP_UNDECODED)
+		{
+			// Fetch two successive bytes and merge them to get the actual code
+			ins = DecodeForMachine(memory_[pc] << 8 | memory_[(pc + 1) & address_mask_], machine_);
+		}
+		return ins;
+	}
+
+	template <class Quirks>
+	void Chip8::Execute()
+	{
+		const Instruction &ins = Fetch(pc_);
+		opcode_ = ins.opcode;
+
+#ifdef CHIP8_PROFILE
+		if (profile_)
+		{
+			profile_->instructions++;
+			profile_->frame_instructions++;
+			profile_->op_counts[ins.op]++;
+			profile_->pc_counts[pc_ & 0xFFF]++;
+		}
+#endif
+
+		// Decode and Execute
+		// The OpId comes out of a table built once at startup. The ids are dense so this
+		// switch compiles to a single jump table lookup instead of the nested switches
+		// we used to go through.
+		switch (ins.op)
+		{
+		case OP_INVALID: OpInvalid(ins); break;
+		case OP_00CN: Op00CN(ins); break;
+		case OP_00E0: Op00E0(ins); break;
+		case OP_00EE: Op00EE(ins); break;
+		case OP_00FB: Op00FB(ins); break;
+		case OP_00FC: Op00FC(ins); break;
+		case OP_00FD: Op00FD(ins); break;
+		case OP_00FE: Op00FE(ins); break;
+		case OP_00FF: Op00FF(ins); break;
+		case OP_1NNN: Op1NNN(ins); break;
+		case OP_2NNN: Op2NNN(ins); break;
+		case OP_3XKK: Op3XKK(ins); break;
+		case OP_4XKK: Op4XKK(ins); break;
+		case OP_5XY0: Op5XY0(ins); break;
+		case OP_6XKK: Op6XKK(ins); break;
+		case OP_7XKK: Op7XKK(ins); break;
+		case OP_8XY0: Op8XY0(ins); break;
+		case OP_8XY1: Op8XY1(ins); break;
+		case OP_8XY2: Op8XY2(ins); break;
+		case OP_8XY3: Op8XY3(ins); break;
+		case OP_8XY4: Op8XY4(ins); break;
+		case OP_8XY5: Op8XY5(ins); break;
+		case OP_8XY6: Op8XY6<Quirks>(ins); break;
+		case OP_8XY7: Op8XY7(ins); break;
+		case OP_8XYE: Op8XYE<Quirks>(ins); break;
+		case OP_9XY0: Op9XY0(ins); break;
+		case OP_ANNN: OpANNN(ins); break;
+		case OP_BNNN: OpBNNN<Quirks>(ins); break;
+		case OP_CXKK: OpCXKK(ins); break;
+		case OP_DXYN: OpDXYN(ins); break;
+		case OP_EX9E: OpEX9E(ins); break;
+		case OP_EXA1: OpEXA1(ins); break;
+		case OP_FX07: OpFX07(ins); break;
+		case OP_FX0A: OpFX0A(ins); break;
+		case OP_FX15: OpFX15(ins); break;
+		case OP_FX18: OpFX18(ins); break;
+		case OP_FX1E: OpFX1E<Quirks>(ins); break;
+		case OP_FX29: OpFX29(ins); break;
+		case OP_FX30: OpFX30(ins); break;
+		case OP_FX33: OpFX33(ins); break;
+		case OP_FX55: OpFX55<Quirks>(ins); break;
+		case OP_FX65: OpFX65<Quirks>(ins); break;
+		case OP_FX75: OpFX75(ins); break;
+		case OP_FX85: OpFX85(ins); break;
+		case OP_00DN: Op00DN(ins); break;
+		case OP_5XY2: Op5XY2(ins); break;
+		case OP_5XY3: Op5XY3(ins); break;
+		case OP_F000: OpF000(ins); break;
+		case OP_FN01: OpFN01(ins); break;
+		case OP_F002: OpF002(ins); break;
+		case OP_FX3A: OpFX3A(ins); break;
+		default: break;
+		}
+	}
+
+	template <class Quirks>
+	unsigned int Chip8::RunSlice(unsigned int cycles, unsigned int budget)
+	{
+		unsigned int executed = 0;
+		while (executed < cycles)
+		{
+			if (halted_)
+			{
+				// Exited with 00FD or a stack fault, the rest of the slice passes with nothing to run
+				return cycles;
+			}
+
+			unsigned short pc = pc_;
+			unsigned int start = executed;
+#ifdef CHIP8_PROFILE
+			if (profile_)
+			{
+				// Blocks would hide the instructions in them from the counters
+				Execute<Quirks>();
+				executed++;
+				goto Ran;
+			}
+#endif
+			if (static_code_)
+			{
+				const StaticBlock *block = static_code_->find(pc_ & 0xFFF);
+				if (block && block->length <= cycles - executed)
 				{
-					v_[0xF] = 1;
+					pc_ = block->fn(v_, &i_);
+					executed += block->length;
+					goto Ran;
 				}
-				else
+			}
+
+			if (jit_)
+			{
+				const JitBlock &block = jit_->GetBlock(memory_, pc_);
+				if (block.fn && block.length <= cycles - executed)
 				{
-					v_[0xF] = 0;
+					pc_ = block.fn(v_, &i_);
+					executed += block.length;
+					goto Ran;
 				}
+			}
 
-				i_ += v_[(opcode_ & 0x0F00) >> 8];
-				pc_ += 2;
+			Execute<Quirks>();
+			executed++;
 
-				// Not sure if this should set the carry or not, 
-				// I don't think it should since it's manipulating the I register
-				break;
-			case 0x0029:
-				// 0xFX29 LD F, Vx
-				// Set I = location of sprite for digit Vx
-				// The value of I is set to the location for the hexadecimal sprite
-				// corresponding to the value of Vx.
-				i_ = v_[(opcode_ & 0x0F00) >> 8] * 0x5;	// Sprites are 8*5
-				pc_ += 2;
-				break;
-			case 0x0030:
-				// 0xFX30 LD HF, Vx
-				// Set I = location of SuperChip sprite for value of Vx
-				// TODO
-				//I = V[(opcode & 0x0F00) >> 8] * 0xA; // sprites are 8*10
-				pc_ += 2;
-				break;
-			case 0x0033:
-				// 0xFX33 LD B, Vx
-				// Store BCD representation of Vx in memory locations I, I+1, and I+2
-				// The interpreter takes the decimal value of Vx, and places the hundreds 
-				// digit in memory at location in I, the tens digit at location I+1, and
-				// the ones digit at location I+2
-				memory_[i_] = v_[(opcode_ & 0x0F00) >> 8] / 100;
-				memory_[i_ + 1] = (v_[(opcode_ & 0x0F00) >> 8] / 10) % 10;
-				memory_[i_ + 2] = (v_[(opcode_ & 0x0F00) >> 8] % 100) % 10;
-				pc_ += 2;
-				break;
-			case 0x0055:
-				// 0xFX55 LD [I], Vx
-				// Store registers V0 through Vx in memory starting at location I
-				// The interpreter copies the values of registers V0 through Vx into memory,
-				// starting at the address in I.
-				for (unsigned int i = 0; i <= ((opcode_ & 0x0F00) >> 8); i++)
+		Ran:
+			// Jumping back or staying put is how every loop starts over
+			if (pc_ <= pc && idle_skip_ && !halted_ && executed < cycles)
+			{
+				unsigned short head = pc_ & 0xFFF;
+				if (!(idle_rejected_[head >> 3] & (1 << (head & 7))))
 				{
-					memory_[i_ + 1] = v_[i];
+					executed += SkipIdleLoop(cycles - executed, budget - executed);
 				}
+			}
 
-				// Not sure on this line as it was found in an example emulator but the doc I have doesn't mention incrementing I
-				i_ += ((opcode_ & 0x0F00) >> 8) + 1; // Increment I so it's pointing after all the newly inserted values
-				
-				pc_ += 2;
-				break;
-			case 0x0065:
-				// 0xFX65 LD Vx, [I]
-				// Read registers V0 through Vx from memory starting at location I.
-				// The interpreter reads values from memory starting at location I into registers V0 through Vx
-				for (unsigned int i = 0; i <= ((opcode_ & 0x0F00) >> 8); i++)
-				{
-					v_[i] = memory_[i_ + 1];
-				}
+			if (trace_)
+			{
+				trace_->Record(pc, Fetch(pc).opcode, executed - start, i_, v_);
+			}
+		}
+		return executed;
+	}
 
-				// Not sure on this line as it was found in an example emulator but the doc I have doesn't mention incrementing I
-				i_ += ((opcode_ & 0x0F00) >> 8) + 1; // Increment I so it's pointing after all the newly inserted values
+	unsigned int Chip8::SkipIdleLoop(unsigned int cycles, unsigned int budget)
+	{
+		// Go round the loop once with the interpreter. If only registers were touched and
+		// they come back to exactly what they were, every further time round takes the same
+		// path and changes nothing either, at least until the delay timer ticks or a key
+		// changes, and neither can happen inside Run().
+		unsigned short head = pc_ & address_mask_;
+		unsigned char v[16];
+		memcpy(v, v_, sizeof(v));
+		unsigned short i = i_;
+		bool reads_timer = false;
 
-				pc_ += 2;
+		unsigned int length = 0;
+		while (length < IDLE_LOOP_LENGTH && length < cycles)
+		{
+			unsigned char op = Fetch(pc_).op;
+			if (!IsIdleSafe(op))
+			{
+				// Something with side effects, don't look at this loop again
+				idle_rejected_[(head & 0xFFF) >> 3] |= 1 << (head & 7);
+				return length;
+			}
+			reads_timer |= op == OP_FX07;
 
+			(this->*execute_)();
+			length++;
+			if ((pc_ & address_mask_) == head)
+			{
 				break;
-			case 0x0075:
-				// 0xFX75 LD R, Vx
-				// HP48 Save Flag
-				// TODO
-				pc_ += 2;
-				break;
+			}
+		}
 
-			case 0x0085:
-				// 0xFX75 LD Vx, R
-				// HP48 Load Flag
-				// TODO
-				pc_ += 2;
-				break;
-			default:
-				break;
+		if ((pc_ & address_mask_) != head || i_ != i || memcmp(v_, v, sizeof(v)) != 0)
+		{
+			// Still making progress, often just the first time round after the timer ticked
+			if (++idle_misses_ >= IDLE_MISS_LIMIT)
+			{
+				idle_rejected_[(head & 0xFFF) >> 3] |= 1 << (head & 7);
+				idle_misses_ = 0;
 			}
-			break;
-		default:
-			break;
+			return length;
 		}
+		idle_misses_ = 0;
 
-		if (delay_timer_ > 0) delay_timer_--;
-		if (sound_timer_ > 0) sound_timer_--;
+		// Waiting on the delay timer can only be skipped to the end of the frame,
+		// anything else is stuck for the rest of the run
+		unsigned int limit = reads_timer ? cycles : budget;
+		unsigned int skip = (limit - length) / length * length;
+		idle_cycles_ += skip;
+#ifdef CHIP8_PROFILE
+		if (profile_)
+		{
+			profile_->idle_cycles += skip;
+		}
+#endif
+		return length + skip;
 	}
 
-	void Chip8::SetKeyState(unsigned int key, bool state)
+	unsigned int Chip8::Run(unsigned int cycles)
 	{
-		keys_[key] = state;
+		return (this->*run_)(cycles);
 	}
 
-	bool Chip8::GetNeedRedraw()
+	template <class Quirks>
+	unsigned int Chip8::RunFrames(unsigned int cycles)
 	{
-		return need_redraw_;
+		unsigned int executed = 0;
+		while (executed < cycles)
+		{
+			// Never run past the end of a frame, the timers have to tick before the next instruction
+			unsigned int slice = cycles_per_frame_ - frame_cycle_;
+			if (slice > cycles - executed)
+			{
+				slice = cycles - executed;
+			}
+
+			unsigned int ran = RunSlice<Quirks>(slice, cycles - executed);
+			executed += ran;
+			EndCycles(ran);
+		}
+		return executed;
 	}
 
-	void Chip8::SetNeedRedraw(bool redraw)
+	unsigned int Chip8::RunFrame()
 	{
-		need_redraw_ = redraw;
+		return Run(cycles_per_frame_ - frame_cycle_);
+	}
+
+	void Chip8::SetCyclesPerFrame(unsigned int cycles)
+	{
+		cycles_per_frame_ = cycles > 0 ? cycles : 1;
+		if (frame_cycle_ >= cycles_per_frame_)
+		{
+			frame_cycle_ = 0;
+		}
+	}
+
+	unsigned int Chip8::GetCyclesPerFrame()
+	{
+		return cycles_per_frame_;
+	}
+
+	void Chip8::SetSeed(unsigned long long seed)
+	{
+		seed_ = seed;
+
+		// splitmix64 spreads similar seeds apart and never leaves xorshift with an all zero state
+		unsigned long long z = seed + 0x9E3779B97F4A7C15ull;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		z ^= z >> 31;
+		random_state_ = z != 0 ? z : 0x9E3779B97F4A7C15ull;
+	}
+
+	unsigned long long Chip8::GetSeed()
+	{
+		return seed_;
+	}
+
+	unsigned char Chip8::NextRandom()
+	{
+		// xorshift64*, the top byte of the product is the best mixed
+		random_state_ ^= random_state_ >> 12;
+		random_state_ ^= random_state_ << 25;
+		random_state_ ^= random_state_ >> 27;
+		return (unsigned char)((random_state_ * 0x2545F4914F6CDD1Dull) >> 56);
 	}
 
-	const unsigned char *Chip8::GetGraphics()
+	void Chip8::SetIdleSkip(bool enabled)
 	{
-		return gfx_;
+		idle_skip_ = enabled;
+	}
+
+	bool Chip8::GetIdleSkip()
+	{
+		return idle_skip_;
+	}
+
+	unsigned long long Chip8::GetIdleCycles()
+	{
+		return idle_cycles_;
+	}
+
+	bool Chip8::SetProfiling(bool enabled)
+	{
+		delete profile_;
+		profile_ = nullptr;
+#ifdef CHIP8_PROFILE
+		if (enabled)
+		{
+			profile_ = new Profile();
+			ClearProfile(*profile_);
+		}
+		return true;
+#else
+		return !enabled;
+#endif
+	}
+
+	const Profile *Chip8::GetProfile()
+	{
+		return profile_;
+	}
+
+	bool Chip8::StartTrace(const std::string &file_name)
+	{
+		StopTrace();
+
+		trace_ = new TraceWriter(TRACE_BUFFER_BYTES);
+		if (!trace_->Open(file_name, pc_, i_, v_))
+		{
+			delete trace_;
+			trace_ = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	bool Chip8::StopTrace()
+	{
+		if (!trace_)
+		{
+			return true;
+		}
+
+		bool written = trace_->Close();
+		delete trace_;
+		trace_ = nullptr;
+		return written;
+	}
+
+	bool Chip8::SetEngine(Engine engine)
+	{
+		if (engine == ENGINE_JIT)
+		{
+			if (machine_ == MACHINE_XOCHIP || quirks_ != QUIRKS_DEFAULT)
+			{
+				return false;
+			}
+			if (jit_)
+			{
+				return true;
+			}
+
+			jit_ = new Jit();
+			if (!CHIP8_JIT_SUPPORTED || !jit_->IsAvailable())
+			{
+				delete jit_;
+				jit_ = nullptr;
+				return false;
+			}
+			return true;
+		}
+
+		delete jit_;
+		jit_ = nullptr;
+		return true;
+	}
+
+	Engine Chip8::GetEngine()
+	{
+		// A JIT that lost its code buffer leaves everything to the interpreter
+		return jit_ && jit_->IsAvailable() ? ENGINE_JIT : ENGINE_INTERPRETER;
+	}
+
+	// Snapshot layout, all values little endian:
+	//   0  "C8ST"
+	//   4  u16 version, u32 size of the whole snapshot
+	//  10  u8 machine, u8 quirk profile
+	//  12  the first 4K of memory
+	//      V0-VF, I, pc, opcode, 16 u16 stack entries, sp, delay timer, sound timer
+	//      u16 keys, one bit per key
+	//      u32 cycles per frame, u32 cycles into the current frame
+	//      u64 seed, u64 generator state
+	//      u8 high resolution, 16 RPL flags
+	//      u8 selected planes, 16 byte audio pattern, u8 pitch, u8 halted
+	//      u64 framebuffer words of plane 0, as many as GetGraphics() has for the resolution
+	// XO-CHIP only:
+	//      memory from 4K up to 64K
+	//      plane 1 like plane 0
+	namespace
+	{
+		const unsigned char state_magic[4] = { 'C', '8', 'S', 'T' };
+		const unsigned int state_header_size = 12;
+
+		unsigned int StateSize(unsigned int machine, bool hires)
+		{
+			unsigned int plane = (hires ? SCHIP_PIXEL_WIDTH * SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_WIDTH * CHIP8_PIXEL_HEIGHT) / 8;
+			unsigned int size = state_header_size + CHIP8_MEMORY_SIZE + CHIP8_REGISTERS_SIZE + plane;
+			if (machine == MACHINE_XOCHIP)
+			{
+				size += MEMORY_SIZE - CHIP8_MEMORY_SIZE + plane;
+			}
+			return size;
+		}
+
+		void PutWord(unsigned char *&out, unsigned long long value, unsigned int bytes)
+		{
+			for (unsigned int b = 0; b < bytes; b++)
+			{
+				*out++ = (unsigned char)(value >> (b * 8));
+			}
+		}
+
+		unsigned long long GetWord(const unsigned char *&in, unsigned int bytes)
+		{
+			unsigned long long value = 0;
+			for (unsigned int b = 0; b < bytes; b++)
+			{
+				value |= (unsigned long long)*in++ << (b * 8);
+			}
+			return value;
+		}
+
+		// A word at a time, the fork pages and the registers are all that's hashed and they
+		// never leave the process, so the byte order doesn't matter
+		unsigned long long HashBytes(const unsigned char *bytes, unsigned int size)
+		{
+			unsigned long long hash = size;
+			unsigned long long word;
+			unsigned int b = 0;
+			for (; b + 8 <= size; b += 8)
+			{
+				memcpy(&word, bytes + b, 8);
+				hash = (hash ^ word) * 0xBF58476D1CE4E5B9ull;
+				hash ^= hash >> 31;
+			}
+			word = 0;
+			memcpy(&word, bytes + b, size - b);
+			hash = (hash ^ word) * 0x94D049BB133111EBull;
+			return hash ^ hash >> 29;
+		}
+
+		// Order matters, the same page in a different place makes a different state
+		unsigned long long MixHash(unsigned long long hash, unsigned long long value)
+		{
+			return hash ^ (value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+		}
+	}
+
+	void Chip8::SaveRegisters(unsigned char *out)
+	{
+		memcpy(out, v_, 16);
+		out += 16;
+		PutWord(out, i_, 2);
+		PutWord(out, pc_, 2);
+		PutWord(out, opcode_, 2);
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			PutWord(out, stack_[i], 2);
+		}
+		PutWord(out, sp_, 1);
+		PutWord(out, delay_timer_, 1);
+		PutWord(out, sound_timer_, 1);
+
+		unsigned int keys = 0;
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			keys |= (keys_[i] ? 1u : 0u) << i;
+		}
+		PutWord(out, keys, 2);
+
+		PutWord(out, cycles_per_frame_, 4);
+		PutWord(out, frame_cycle_, 4);
+		PutWord(out, seed_, 8);
+		PutWord(out, random_state_, 8);
+
+		PutWord(out, hires_ ? 1 : 0, 1);
+		memcpy(out, rpl_, 16);
+		out += 16;
+		PutWord(out, planes_, 1);
+		memcpy(out, audio_pattern_, 16);
+		out += 16;
+		PutWord(out, pitch_, 1);
+		PutWord(out, halted_ ? 1 : 0, 1);
+	}
+
+	void Chip8::LoadRegisters(const unsigned char *in)
+	{
+		memcpy(v_, in, 16);
+		in += 16;
+		i_ = (unsigned short)GetWord(in, 2);
+		pc_ = (unsigned short)GetWord(in, 2);
+		opcode_ = (unsigned short)GetWord(in, 2);
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			stack_[i] = (unsigned short)GetWord(in, 2);
+		}
+		sp_ = (unsigned short)GetWord(in, 1);
+		delay_timer_ = (unsigned char)GetWord(in, 1);
+		sound_timer_ = (unsigned char)GetWord(in, 1);
+
+		unsigned int keys = (unsigned int)GetWord(in, 2);
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			keys_[i] = (keys >> i & 1) != 0;
+		}
+
+		cycles_per_frame_ = (unsigned int)GetWord(in, 4);
+		frame_cycle_ = (unsigned int)GetWord(in, 4);
+		seed_ = GetWord(in, 8);
+		random_state_ = GetWord(in, 8);
+
+		hires_ = GetWord(in, 1) != 0;
+		memcpy(rpl_, in, 16);
+		in += 16;
+		planes_ = (unsigned char)GetWord(in, 1);
+		memcpy(audio_pattern_, in, 16);
+		in += 16;
+		pitch_ = (unsigned char)GetWord(in, 1);
+		halted_ = GetWord(in, 1) != 0;
+	}
+
+	unsigned int Chip8::SaveState(unsigned char *buffer, unsigned int size)
+	{
+		unsigned int state_size = GetStateSize();
+		if (buffer == nullptr || size < state_size)
+		{
+			return 0;
+		}
+
+		unsigned char *out = buffer;
+		memcpy(out, state_magic, 4);
+		out += 4;
+		PutWord(out, CHIP8_STATE_VERSION, 2);
+		PutWord(out, state_size, 4);
+
+		PutWord(out, machine_, 1);
+		PutWord(out, quirks_, 1);
+		memcpy(out, memory_, CHIP8_MEMORY_SIZE);
+		out += CHIP8_MEMORY_SIZE;
+
+		SaveRegisters(out);
+		out += CHIP8_REGISTERS_SIZE;
+		unsigned int words = GetScreenWidth() / 64 * GetScreenHeight();
+		for (unsigned int w = 0; w < words; w++)
+		{
+			PutWord(out, gfx_[0][w], 8);
+		}
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			memcpy(out, memory_ + CHIP8_MEMORY_SIZE, MEMORY_SIZE - CHIP8_MEMORY_SIZE);
+			out += MEMORY_SIZE - CHIP8_MEMORY_SIZE;
+			for (unsigned int w = 0; w < words; w++)
+			{
+				PutWord(out, gfx_[1][w], 8);
+			}
+		}
+
+		return (unsigned int)(out - buffer);
+	}
+
+	unsigned int Chip8::GetStateSize()
+	{
+		return StateSize(machine_, hires_);
+	}
+
+	unsigned int Chip8::GetStateSize(const unsigned char *buffer, unsigned int size)
+	{
+		if (buffer == nullptr || size < state_header_size || memcmp(buffer, state_magic, 4) != 0)
+		{
+			return 0;
+		}
+		const unsigned char *in = buffer + 4;
+		if (GetWord(in, 2) != CHIP8_STATE_VERSION)
+		{
+			return 0;
+		}
+		return (unsigned int)GetWord(in, 4);
+	}
+
+	bool Chip8::LoadState(const unsigned char *buffer, unsigned int size)
+	{
+		if (GetStateSize(buffer, size) == 0 || size < state_header_size + CHIP8_MEMORY_SIZE + CHIP8_REGISTERS_SIZE)
+		{
+			return false;
+		}
+
+		const unsigned char *in = buffer + 6;
+		unsigned long long state_size = GetWord(in, 4);
+
+		// Check the fields we index with before touching anything. sp 16 is a full stack,
+		// 2NNN won't push past it. Only XO-CHIP has a second plane to select.
+		unsigned int machine = in[0];
+		unsigned int quirks = in[1];
+		const unsigned char *registers = in + 2 + CHIP8_MEMORY_SIZE;
+		unsigned int sp = registers[16 + 6 + 32];
+		const unsigned char *timing = registers + 16 + 6 + 32 + 3 + 2;
+		unsigned long long cycles_per_frame = GetWord(timing, 4);
+		unsigned long long frame_cycle = GetWord(timing, 4);
+		unsigned int hires = timing[16];
+		unsigned int planes = timing[16 + 1 + 16];
+		unsigned int halted = timing[16 + 1 + 16 + 1 + 16 + 1];
+		if (machine > MACHINE_XOCHIP || quirks > QUIRKS_XOCHIP || sp > 16 || cycles_per_frame == 0 || frame_cycle >= cycles_per_frame ||
+			hires > 1 || planes > (machine == MACHINE_XOCHIP ? 3u : 1u) || halted > 1 ||
+			state_size != StateSize(machine, hires != 0) || size < state_size)
+		{
+			return false;
+		}
+
+		machine_ = (Machine)GetWord(in, 1);
+		SelectMemory();
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			SetEngine(ENGINE_INTERPRETER);
+		}
+		SetQuirks((QuirkProfile)GetWord(in, 1));
+		memcpy(memory_, in, CHIP8_MEMORY_SIZE);
+		in += CHIP8_MEMORY_SIZE;
+
+		LoadRegisters(in);
+		in += CHIP8_REGISTERS_SIZE;
+		// Words past the resolution's are always blank, SetResolution() clears them all
+		memset(gfx_, 0, sizeof(gfx_));
+		unsigned int words = GetScreenWidth() / 64 * GetScreenHeight();
+		for (unsigned int w = 0; w < words; w++)
+		{
+			gfx_[0][w] = GetWord(in, 8);
+		}
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			memcpy(memory_ + CHIP8_MEMORY_SIZE, in, MEMORY_SIZE - CHIP8_MEMORY_SIZE);
+			in += MEMORY_SIZE - CHIP8_MEMORY_SIZE;
+			for (unsigned int w = 0; w < words; w++)
+			{
+				gfx_[1][w] = GetWord(in, 8);
+			}
+		}
+		need_redraw_ = true;
+		dirty_rows_ = ALL_ROWS_DIRTY;
+
+		// Memory may hold different code now. Static code survives only if it still matches the ROM.
+		const StaticCode *static_code = static_code_;
+		FlushCodeCaches();
+		SetStaticCode(static_code);
+		ResetForkBase();
+		// Memory can differ from the boot image anywhere now
+		memset(boot_dirty_, 0xFF, sizeof(boot_dirty_));
+		return true;
+	}
+
+	bool Chip8::SaveStateFile(const std::string &file_name)
+	{
+		std::vector<unsigned char> buffer(GetStateSize());
+		unsigned int size = SaveState(&buffer[0], (unsigned int)buffer.size());
+
+		std::ofstream output(file_name, std::ios::binary);
+		if (!output || !output.write((const char *)&buffer[0], size))
+		{
+			std::cout << "Error: could not write " << file_name << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool Chip8::LoadStateFile(const std::string &file_name)
+	{
+		// The header says how big the rest is, anything past the largest snapshot isn't one
+		unsigned char header[state_header_size] = {};
+		std::ifstream input(file_name, std::ios::binary);
+		if (input)
+		{
+			input.read((char *)header, sizeof(header));
+		}
+		unsigned int read = (unsigned int)input.gcount();
+		unsigned int size = GetStateSize(header, read);
+
+		std::vector<unsigned char> buffer(header, header + read);
+		if (size > read && size <= CHIP8_STATE_SIZE)
+		{
+			buffer.resize(size);
+			input.read((char *)&buffer[read], size - read);
+			buffer.resize(read + (size_t)input.gcount());
+		}
+		if (buffer.empty() || !LoadState(&buffer[0], (unsigned int)buffer.size()))
+		{
+			std::cout << "Error: " << file_name << " is not a save state" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::shared_ptr<const ForkState> Chip8::Fork()
+	{
+		std::shared_ptr<ForkState> state = std::make_shared<ForkState>();
+		state->machine = (unsigned char)machine_;
+		state->quirks = (unsigned char)quirks_;
+		SaveRegisters(state->registers);
+
+		// A base from another machine has a different number of memory pages
+		const ForkState *base = fork_base_ && fork_base_->machine == machine_ ? fork_base_.get() : nullptr;
+		unsigned int memory_pages = ((unsigned int)address_mask_ + 1) / FORK_PAGE_SIZE;
+		state->pages.resize(memory_pages + FORK_GFX_PAGES);
+
+		unsigned long long hash = MixHash(HashBytes(&state->registers[0], CHIP8_REGISTERS_SIZE), state->machine << 8 | state->quirks);
+		for (unsigned int p = 0; p < memory_pages + FORK_GFX_PAGES; p++)
+		{
+			const unsigned char *bytes = p < memory_pages ? memory_ + p * FORK_PAGE_SIZE : (const unsigned char *)gfx_ + (p - memory_pages) * FORK_PAGE_SIZE;
+			// Nothing writes the framebuffer through StoreByte(), so its pages are always compared
+			bool clean = p < memory_pages && !(fork_dirty_[p / 8] & (1 << (p % 8)));
+			if (base && (clean || memcmp(base->pages[p]->bytes, bytes, FORK_PAGE_SIZE) == 0))
+			{
+				state->pages[p] = base->pages[p];
+			}
+			else
+			{
+				std::shared_ptr<ForkPage> page = std::make_shared<ForkPage>();
+				memcpy(page->bytes, bytes, FORK_PAGE_SIZE);
+				page->hash = HashBytes(page->bytes, FORK_PAGE_SIZE);
+				state->pages[p] = page;
+			}
+			hash = MixHash(hash, state->pages[p]->hash);
+		}
+		state->hash = hash;
+
+		fork_base_ = state;
+		memset(fork_dirty_, 0, sizeof(fork_dirty_));
+		return state;
+	}
+
+	void Chip8::LoadFork(const std::shared_ptr<const ForkState> &state)
+	{
+		if (!state)
+		{
+			return;
+		}
+
+		const ForkState *base = fork_base_ && fork_base_->machine == state->machine ? fork_base_.get() : nullptr;
+		machine_ = (Machine)state->machine;
+		SelectMemory();
+		if (machine_ == MACHINE_XOCHIP)
+		{
+			SetEngine(ENGINE_INTERPRETER);
+		}
+		SetQuirks((QuirkProfile)state->quirks);
+		LoadRegisters(state->registers);
+
+		unsigned int memory_pages = ((unsigned int)address_mask_ + 1) / FORK_PAGE_SIZE;
+		if (base)
+		{
+			// Memory matches the base but for the dirty pages, the pages both forks share are
+			// already in place. The rest go through StoreByte() a changed byte at a time, which
+			// keeps the decoded and compiled code that's still valid.
+			for (unsigned int p = 0; p < memory_pages; p++)
+			{
+				if (base->pages[p] == state->pages[p] && !(fork_dirty_[p / 8] & (1 << (p % 8))))
+				{
+					continue;
+				}
+				const unsigned char *bytes = state->pages[p]->bytes;
+				unsigned int address = p * FORK_PAGE_SIZE;
+				for (unsigned int b = 0; b < FORK_PAGE_SIZE; b++)
+				{
+					if (memory_[address + b] != bytes[b])
+					{
+						StoreByte((unsigned short)(address + b), bytes[b]);
+					}
+				}
+			}
+		}
+		else
+		{
+			for (unsigned int p = 0; p < memory_pages; p++)
+			{
+				memcpy(memory_ + p * FORK_PAGE_SIZE, state->pages[p]->bytes, FORK_PAGE_SIZE);
+			}
+			const StaticCode *static_code = static_code_;
+			FlushCodeCaches();
+			SetStaticCode(static_code);
+			memset(boot_dirty_, 0xFF, sizeof(boot_dirty_));
+		}
+
+		for (unsigned int p = 0; p < FORK_GFX_PAGES; p++)
+		{
+			memcpy((unsigned char *)gfx_ + p * FORK_PAGE_SIZE, state->pages[memory_pages + p]->bytes, FORK_PAGE_SIZE);
+		}
+		need_redraw_ = true;
+		dirty_rows_ = ALL_ROWS_DIRTY;
+
+		fork_base_ = state;
+		memset(fork_dirty_, 0, sizeof(fork_dirty_));
+	}
+
+	unsigned long long Chip8::GetStateHash()
+	{
+		unsigned char registers[CHIP8_REGISTERS_SIZE];
+		SaveRegisters(registers);
+
+		const ForkState *base = fork_base_ && fork_base_->machine == machine_ ? fork_base_.get() : nullptr;
+		unsigned int memory_pages = ((unsigned int)address_mask_ + 1) / FORK_PAGE_SIZE;
+		unsigned long long hash = MixHash(HashBytes(registers, CHIP8_REGISTERS_SIZE), machine_ << 8 | quirks_);
+		for (unsigned int p = 0; p < memory_pages + FORK_GFX_PAGES; p++)
+		{
+			// Pages untouched since the last fork have their hash already
+			if (base && p < memory_pages && !(fork_dirty_[p / 8] & (1 << (p % 8))))
+			{
+				hash = MixHash(hash, base->pages[p]->hash);
+				continue;
+			}
+			const unsigned char *bytes = p < memory_pages ? memory_ + p * FORK_PAGE_SIZE : (const unsigned char *)gfx_ + (p - memory_pages) * FORK_PAGE_SIZE;
+			hash = MixHash(hash, HashBytes(bytes, FORK_PAGE_SIZE));
+		}
+		return hash;
+	}
+
+	unsigned long long Chip8::GetScreenHash()
+	{
+		// The second plane only counts on XO-CHIP, so hashes of the other machines stay as they were
+		unsigned int planes = machine_ == MACHINE_XOCHIP ? 2 : 1;
+		unsigned int count = GetScreenWidth() / 64 * GetScreenHeight();
+		unsigned long long hash = 14695981039346656037ull;
+		for (unsigned int plane = 0; plane < planes; plane++)
+		{
+			for (unsigned int w = 0; w < count; w++)
+			{
+				for (unsigned int b = 0; b < 8; b++)
+				{
+					hash ^= (gfx_[plane][w] >> (56 - b * 8)) & 0xFF;
+					hash *= 1099511628211ull;
+				}
+			}
+		}
+		return hash;
+	}
+
+	bool Chip8::SetStaticCode(const StaticCode *code)
+	{
+		static_code_ = nullptr;
+		if (code == nullptr)
+		{
+			return true;
+		}
+
+		if (machine_ == MACHINE_XOCHIP || quirks_ != QUIRKS_DEFAULT || ROM_ADDRESS + code->rom_size > CHIP8_MEMORY_SIZE ||
+			HashRom(memory_ + ROM_ADDRESS, code->rom_size) != code->rom_hash)
+		{
+			return false;
+		}
+
+		static_code_ = code;
+		return true;
+	}
+
+	inline void Chip8::OpInvalid(const Instruction &ins)
+	{
+		// Unknown opcode, leave the pc where it is
+	}
+
+	inline void Chip8::Op00CN(const Instruction &ins)
+	{
+		// 0x00CN SCD nibble
+		// Scroll down N lines
+		// When in chip8 mode scrolls down N/2 lines, when in SuperChip mode scroll down N lines.
+		// XO-CHIP scrolls N lines of whichever resolution it's in.
+		ScrollVertical(hires_ || machine_ == MACHINE_XOCHIP ? ins.kk & 0xF : (ins.kk & 0xF) / 2);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00E0(const Instruction &ins)
+	{
+		// 0x00E0 CLS
+		// Clear screen
+		ClearScreen();
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00EE(const Instruction &ins)
+	{
+		// 0x00EE RET
+		// Return from a subroutine
+		if (sp_ == 0)
+		{
+			// Nothing to return to, the machine stops on the 00EE like on 00FD
+			halted_ = true;
+			return;
+		}
+		sp_--; // Decrement stack pointer
+		pc_ = stack_[sp_];	// Set the program counter to the old position
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00FB(const Instruction &ins)
+	{
+		// 0x00FB SCR
+		// Scroll 4 pixels right in SuperChip mode, or 2 pixels in Chip8 mode. Always 4 on XO-CHIP.
+		ScrollSideways(hires_ || machine_ == MACHINE_XOCHIP ? 4 : 2);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00FC(const Instruction &ins)
+	{
+		// 0x00FC SCL
+		// Scroll 4 pixels left in SuperChip mode, or 2 pixels in Chip8 mode. Always 4 on XO-CHIP.
+		ScrollSideways(hires_ || machine_ == MACHINE_XOCHIP ? -4 : -2);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00FD(const Instruction &ins)
+	{
+		// 0x00FD EXIT
+		// Exit the interpreter. The pc stays on the 00FD and the machine stops until it's reset.
+		halted_ = true;
+	}
+
+	inline void Chip8::Op00FE(const Instruction &ins)
+	{
+		// 0x00FE LOW
+		// Set emulator to normal Chip8 resolution, 64 x 32
+		SetResolution(false);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00FF(const Instruction &ins)
+	{
+		// 0x00FF HIGH
+		// Set emulator to SuperChip resolution 128 x 64
+		SetResolution(true);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op1NNN(const Instruction &ins)
+	{
+		// 0x1NNN JP addr
+		// Jump to location NNN
+		// Set the pc to location NNN
+		// THe interpreter sets the program counter to NNN
+		pc_ = ins.nnn;
+	}
+
+	inline void Chip8::Op2NNN(const Instruction &ins)
+	{
+		// 0x2NNN CALL addr
+		// Call the subroutine at NNN
+		// The interpreter increments the stack pointers, then puts the 
+		// current PC on the top of the stack. The PC is then set to NNN
+		if (sp_ >= 16)
+		{
+			// The stack is full, the machine stops on the call like on 00FD
+			halted_ = true;
+			return;
+		}
+		stack_[sp_] = pc_; // Store the current position on the stack
+		sp_++;	// Increment the stack pointer
+		pc_ = ins.nnn;
+	}
+
+	inline void Chip8::Op3XKK(const Instruction &ins)
+	{
+		// 0x3XKK SE Vx, byte
+		// Skip next intstruction if Vx = KK
+		// The interpreter compares register Vx to KK, and if they are equal
+		// increments the program counter by 2 (2 step means 4 bytes)
+		if (v_[ins.x] == ins.kk)
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::Op4XKK(const Instruction &ins)
+	{
+		// 0x4XKK SNE Vx, byte
+		// Skip next instruction if Vx != KK
+		// The interpreter compares register Vx to KK, and if they are not equal,
+		// increments the program counter by 2 (2 steps means 4 bytes)
+		if (v_[ins.x] != ins.kk)
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::Op5XY0(const Instruction &ins)
+	{
+		// 0x5XY0 SE Vx, Vy
+		// Skip next instruction if Vx = Vy
+		// The interpreter compares register Vx to register Vy, and if they are equal,
+		// increments the program counter by 2 (2 means 4 bytes)
+		if (v_[ins.x] == v_[ins.y])
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::Op6XKK(const Instruction &ins)
+	{
+		// 0x6XKK LD Vx, byte
+		// Set Vx = KK
+		// The interpreter puts the value KK into register Vx
+		v_[ins.x] = ins.kk;
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op7XKK(const Instruction &ins)
+	{
+		// 0x7XKK ADD Vx, byte
+		// Set Vx = Vx + KK
+		// Adds the value KK to the value of register Vx, then stores the result in Vx
+		v_[ins.x] += ins.kk;
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY0(const Instruction &ins)
+	{
+		// 0x8XY0 LD Vx, Vy
+		// Set Vx = Vy
+		// Stores the value of register Vy in register Vx
+		v_[ins.x] = v_[ins.y];
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY1(const Instruction &ins)
+	{
+		// 0x8XY1 OR Vx, Vy
+		// Set Vx = Vx OR Vy
+		// Performs a bitwise OR on the values of Vx and Vy, then stores
+		// the result in Vx. A bitwise OR compares the corresponding bits
+		// from two values, and if either bit is 1, then the same bit in 
+		// result is also 1. Otherwise, it is 0
+		v_[ins.x] |= v_[ins.y];
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY2(const Instruction &ins)
+	{
+		// 0x8XY2 AND Vx, Vy
+		// Set Vx = Vx AND Vy
+		// Performs a bitwise AND on the values of Vx and Vy, then stores
+		// the result in Vx. A bitwise AND compares the corresponding bits
+		// from two values, and if both bits are 1, then the same bit in the
+		// result is also 1. Otherwise, it is 0
+		v_[ins.x] &= v_[ins.y];
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY3(const Instruction &ins)
+	{
+		// 0x8XY3 XOR Vx, Vy
+		// Set Vx = Vx XOR Vy
+		// Bitwise XOR is ^=
+		v_[ins.x] ^= v_[ins.y];
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY4(const Instruction &ins)
+	{
+		// 0x8XY4 ADD Vx, Vy
+		// Set Vx = Vx + Vy, set VF = carry
+		// The values of Vx and Vy are added together. If the result is greater than
+		// 8 bits (i.e. > 255) VF is set to 1, otherwise 0. Only the lowest 8 bits of the
+		// result are kept, and stored in Vx.
+		if (v_[ins.y] > (0xFF - v_[ins.x]))
+		{
+			v_[0xF] = 1;	// There is a carry
+		}
+		else
+		{
+			v_[0xF] = 0;	// There is no carry
+		}
+		v_[ins.x] += v_[ins.y]; // Set the value
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY5(const Instruction &ins)
+	{
+		// 0x8XY5 SUB Vx, Vy
+		// Set Vx = Vx - Vy, set VF = NOT borrow
+		// If Vx > Vy, the VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, 
+		// and then the results stored in Vx.
+		if (v_[ins.y] > v_[ins.x])
+		{
+			v_[0xF] = 0; // There is a borrow
+		}
+		else
+		{
+			v_[0xF] = 1;
+		}
+		v_[ins.x] -= v_[ins.y]; // Set the value
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::Op8XY6(const Instruction &ins)
+	{
+		// 0x8XY6 SHR Vx {, Vy}
+		// Set Vx = Vx SHR 1.
+		// If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
+		// The Vx is divided by 2
+		// Shift Vx to the right. Setting VF to 1 if the least significant bit is a 1
+		// else setting it to 0. The COSMAC VIP shifted Vy into Vx instead.
+		// VF is written last, so for 8FY6 the flag is what's left in VF.
+		unsigned char source = Quirks::shift_reads_vy ? v_[ins.y] : v_[ins.x];
+		v_[ins.x] = source >> 1; // Set the value
+		v_[0xF] = source & 0x1;
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op8XY7(const Instruction &ins)
+	{
+		// 0x8XY7 SUBN Vx, Vy
+		// Set Vx = Vy - Vx, Set VF = NOT borrow
+		// If Vy > Vx, the VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
+		// and the results stored in Vx.
+		if (v_[ins.y] > v_[ins.x])
+		{
+			v_[0xF] = 1;
+		}
+		else
+		{
+			v_[0xF] = 0; // There is a borrow
+		}
+
+		v_[ins.x] = v_[ins.y] - v_[ins.x];
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::Op8XYE(const Instruction &ins)
+	{
+		// 0x8XYE SHL Vx {, Vy}
+		// Set Vx = Vx SHL 1
+		// If the most significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
+		// Then Vx is multiplied by 2. The COSMAC VIP shifted Vy into Vx instead.
+		// VF is written last, like 8XY6.
+		unsigned char source = Quirks::shift_reads_vy ? v_[ins.y] : v_[ins.x];
+		v_[ins.x] = source << 1;
+		v_[0xF] = source >> 7;
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op9XY0(const Instruction &ins)
+	{
+		// 0x9XY0 SNE Vx, Vy
+		// Skip next instruction if Vx != Vy
+		// The values of Vx and Vy are compared, and if they are not equal,
+		// the program counter is increased by 2 (4 bytes)
+		if (v_[ins.x] != v_[ins.y])
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::OpANNN(const Instruction &ins)
+	{
+		// 0xANNN LD I, addr
+		// Set I = NNN
+		// The value of register I is set to NNN
+		i_ = ins.nnn;
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::OpBNNN(const Instruction &ins)
+	{
+		// 0xBNNN JP V0, addr
+		// Jump to location NNN + V0
+		// The program counter is set to NNN plus the value of V0.
+		// SuperChip read it as BXNN, XNN plus the value of VX.
+		pc_ = ins.nnn + v_[Quirks::jump_adds_vx ? ins.x : 0x0];
+	}
+
+	inline void Chip8::OpCXKK(const Instruction &ins)
+	{
+		// 0xCXKK - RND Vx, byte
+		// Set Vx = random byte AND KK
+		// The interpreter generates a random number from 0 to 255, which is then 
+		// ANDed with the value KK. The results are stored in Vx. See instruction
+		// 0x8XY2 for more information about AND
+		v_[ins.x] = NextRandom() & ins.kk;
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpDXYN(const Instruction &ins)
+	{
+		// 0xDXYN DRW Vx, Vy, nibble
+		// Display N-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+		// The interpreter reads N bytes from memory, startingat the address stored in I.
+		// These bytes are then displayed as sprites on screen at coordinates (Vx, Vy).
+		// Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
+		// VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of
+		// of it is outside the coordinates of the display, it wraps around to the opposite side
+		// of the screen. See instruction 0x8XY3 for more information on XOR, 
+
+		// A height of 0 draws a 16*16 sprite from 32 bytes, two per row, as on the SuperChip
+		unsigned int width = hires_ ? SCHIP_PIXEL_WIDTH : CHIP8_PIXEL_WIDTH;
+		unsigned int screen_height = hires_ ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+		unsigned int x = v_[ins.x] % width;
+		unsigned int y = v_[ins.y] % screen_height;
+		unsigned int height = ins.kk & 0x000F;
+		bool wide = height == 0;
+		height = wide ? 16 : height;
+
+		// XO-CHIP draws on every selected plane in turn, each from the sprite data after the last
+		unsigned long long collisions = 0;
+		unsigned long long dirty = 0;
+		unsigned short address = i_;
+		if (planes_ & 1)
+		{
+			collisions |= DrawSprite(gfx_[0], address, x, y, height, wide, dirty);
+			address += wide ? 32 : height;
+		}
+		if (planes_ & 2)
+		{
+			collisions |= DrawSprite(gfx_[1], address, x, y, height, wide, dirty);
+		}
+		v_[0xF] = collisions != 0 ? 1 : 0;
+		dirty_rows_ |= dirty;
+#ifdef CHIP8_PROFILE
+		if (profile_)
+		{
+			profile_->draws++;
+			profile_->draw_collisions += v_[0xF];
+		}
+#endif
+		need_redraw_ = true;
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpEX9E(const Instruction &ins)
+	{
+		// 0xEX9E SKP Vx
+		// Skip next instruction if key with the value of Vx is spressed
+		// Checks the keyboard, and if the key corresponding to the value
+		// of Vx is currently in the down position, PC is increased by 2.
+		// Only the low nibble picks the key, there are 16 of them.
+		if (keys_[v_[ins.x] & 0xF])
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::OpEXA1(const Instruction &ins)
+	{
+		// 0xEXA1 SKNP Vx
+		// Skip next instruction if key with the value of Vx is not pressed
+		if (!keys_[v_[ins.x] & 0xF])
+		{
+			pc_ += SkipLength();
+		}
+		else
+		{
+			pc_ += 2;
+		}
+	}
+
+	inline void Chip8::OpFX07(const Instruction &ins)
+	{
+		// 0xFX07 LD Vx, DT
+		// Set Vx = delay timer value
+		// The value of DT is placed into Vx
+		v_[ins.x] = delay_timer_;
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX0A(const Instruction &ins)
+	{
+		// 0xFX0A LD Vx, K
+		// Wait for keypress, store the value of the key in Vx
+		// All execution stops until a key is pressed, then the value
+		// of that key is stored in Vx.
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			if (keys_[i])
+			{
+				v_[ins.x] = i;
+				pc_ += 2;
+				return;
+			}
+		}
+		// No key yet, the pc hasn't been incremented so this instruction runs again next cycle.
+		// The wait still counts as cycles, so the timers keep running like they did on the
+		// COSMAC VIP, where its 60Hz interrupt counted them down during the wait. Stopping
+		// them would hold a sound started before the wait on until a key came.
+	}
+
+	inline void Chip8::OpFX15(const Instruction &ins)
+	{
+		// 0xFX15 LD DT, Vx
+		// Set delay timer = Vx
+		// DT is set equal to the value of Vx
+		delay_timer_ = v_[ins.x];
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX18(const Instruction &ins)
+	{
+		// 0xFX18 LD ST, Vx
+		// Set sound timer = Vx
+		// ST is set equal to the value of Vx
+		sound_timer_ = v_[ins.x];
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::OpFX1E(const Instruction &ins)
+	{
+		// 0xFX1E ADD I, Vx
+		// Set I = I + Vx
+		// The values of I and Vx are added, and the results are stored in I.
+		// Only some interpreters set VF when I runs past the 4K.
+		if (Quirks::add_i_sets_vf)
+		{
+			v_[0xF] = i_ + v_[ins.x] > 0xFFF ? 1 : 0;
+		}
+
+		i_ += v_[ins.x];
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX29(const Instruction &ins)
+	{
+		// 0xFX29 LD F, Vx
+		// Set I = location of sprite for digit Vx
+		// The value of I is set to the location for the hexadecimal sprite
+		// corresponding to the value of Vx.
+		i_ = v_[ins.x] * 0x5;	// Sprites are 8*5
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX30(const Instruction &ins)
+	{
+		// 0xFX30 LD HF, Vx
+		// Set I = location of SuperChip sprite for value of Vx
+		i_ = BIG_FONT_ADDRESS + (v_[ins.x] & 0xF) * 0xA;	// Sprites are 8*10
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX33(const Instruction &ins)
+	{
+		// 0xFX33 LD B, Vx
+		// Store BCD representation of Vx in memory locations I, I+1, and I+2
+		// The interpreter takes the decimal value of Vx, and places the hundreds 
+		// digit in memory at location in I, the tens digit at location I+1, and
+		// the ones digit at location I+2
+		StoreByte(i_, v_[ins.x] / 100);
+		StoreByte(i_ + 1, (v_[ins.x] / 10) % 10);
+		StoreByte(i_ + 2, (v_[ins.x] % 100) % 10);
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::OpFX55(const Instruction &ins)
+	{
+		// 0xFX55 LD [I], Vx
+		// Store registers V0 through Vx in memory starting at location I
+		// The interpreter copies the values of registers V0 through Vx into memory,
+		// starting at the address in I.
+		for (unsigned int i = 0; i <= ins.x; i++)
+		{
+			StoreByte(i_ + i, v_[i]);
+		}
+
+		// The COSMAC VIP left I pointing after the last register, SuperChip left it alone
+		if (Quirks::increment_i)
+		{
+			i_ += ins.x + 1;
+		}
+
+		pc_ += 2;
+	}
+
+	template <class Quirks>
+	inline void Chip8::OpFX65(const Instruction &ins)
+	{
+		// 0xFX65 LD Vx, [I]
+		// Read registers V0 through Vx from memory starting at location I.
+		// The interpreter reads values from memory starting at location I into registers V0 through Vx
+		for (unsigned int i = 0; i <= ins.x; i++)
+		{
+			v_[i] = memory_[(i_ + i) & address_mask_];
+		}
+
+		// The COSMAC VIP left I pointing after the last register, SuperChip left it alone
+		if (Quirks::increment_i)
+		{
+			i_ += ins.x + 1;
+		}
+
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX75(const Instruction &ins)
+	{
+		// 0xFX75 LD R, Vx
+		// HP48 Save Flag
+		// Store V0 to Vx in the RPL user flags
+		memcpy(rpl_, v_, ins.x + 1);
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX85(const Instruction &ins)
+	{
+		// 0xFX85 LD Vx, R
+		// HP48 Load Flag
+		// Read V0 to Vx from the RPL user flags
+		memcpy(v_, rpl_, ins.x + 1);
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op00DN(const Instruction &ins)
+	{
+		// 0x00DN SCU nibble
+		// XO-CHIP, scroll up N lines
+		ScrollVertical(-(int)(ins.kk & 0xF));
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op5XY2(const Instruction &ins)
+	{
+		// 0x5XY2 SAVE Vx - Vy
+		// XO-CHIP, store Vx through Vy in memory starting at location I, backwards from Vx
+		// if X is past Y. I stays where it is.
+		int step = ins.x > ins.y ? -1 : 1;
+		unsigned int count = (ins.x > ins.y ? ins.x - ins.y : ins.y - ins.x) + 1;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			StoreByte(i_ + i, v_[ins.x + step * (int)i]);
+		}
+		pc_ += 2;
+	}
+
+	inline void Chip8::Op5XY3(const Instruction &ins)
+	{
+		// 0x5XY3 LOAD Vx - Vy
+		// XO-CHIP, read Vx through Vy from memory starting at location I, the same way round
+		// as 5XY2. I stays where it is.
+		int step = ins.x > ins.y ? -1 : 1;
+		unsigned int count = (ins.x > ins.y ? ins.x - ins.y : ins.y - ins.x) + 1;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			v_[ins.x + step * (int)i] = memory_[(i_ + i) & address_mask_];
+		}
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpF000(const Instruction &ins)
+	{
+		// 0xF000 NNNN LD I, long addr
+		// XO-CHIP, set I = NNNN, the 16 bit word after this one, and carry on after it
+		i_ = (unsigned short)(memory_[(pc_ + 2) & address_mask_] << 8 | memory_[(pc_ + 3) & address_mask_]);
+		pc_ += 4;
+	}
+
+	inline void Chip8::OpFN01(const Instruction &ins)
+	{
+		// 0xFN01 PLANE n
+		// XO-CHIP, draw, clear and scroll on the planes set in N from now on, none, either or both
+		planes_ = ins.x & 0x3;
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpF002(const Instruction &ins)
+	{
+		// 0xF002 AUDIO
+		// XO-CHIP, load the 16 byte audio pattern from memory starting at location I
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			audio_pattern_[i] = memory_[(i_ + i) & address_mask_];
+		}
+		pc_ += 2;
+	}
+
+	inline void Chip8::OpFX3A(const Instruction &ins)
+	{
+		// 0xFX3A PITCH Vx
+		// XO-CHIP, set the pitch the audio pattern plays at to Vx, see GetAudioRate()
+		pitch_ = v_[ins.x];
+		pc_ += 2;
+	}
+
+	void Chip8::SetKeyState(unsigned int key, bool state)
+	{
+		keys_[key] = state;
+	}
+
+	bool Chip8::GetKeyState(unsigned int key)
+	{
+		return keys_[key];
+	}
+
+	const unsigned char *Chip8::GetRplFlags()
+	{
+		return rpl_;
+	}
+
+	void Chip8::SetRplFlags(const unsigned char *flags)
+	{
+		memcpy(rpl_, flags, sizeof(rpl_));
+	}
+
+	bool Chip8::IsHalted()
+	{
+		return halted_;
+	}
+
+	bool Chip8::GetNeedRedraw()
+	{
+		return need_redraw_;
+	}
+
+	void Chip8::SetNeedRedraw(bool redraw)
+	{
+		need_redraw_ = redraw;
+	}
+
+	unsigned int Chip8::GetScreenWidth()
+	{
+		return hires_ ? SCHIP_PIXEL_WIDTH : CHIP8_PIXEL_WIDTH;
+	}
+
+	unsigned int Chip8::GetScreenHeight()
+	{
+		return hires_ ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+	}
+
+	const unsigned long long *Chip8::GetGraphics(unsigned int plane)
+	{
+		return gfx_[plane & 1];
+	}
+
+	unsigned long long Chip8::GetDirtyRows()
+	{
+		return dirty_rows_;
+	}
+
+	void Chip8::ClearDirtyRows()
+	{
+		dirty_rows_ = 0;
+	}
+
+	unsigned char Chip8::GetSoundTimer()
+	{
+		return sound_timer_;
+	}
+
+	const unsigned char *Chip8::GetMemory()
+	{
+		return memory_;
+	}
+
+	unsigned int Chip8::GetMemorySize()
+	{
+		return (unsigned int)address_mask_ + 1;
+	}
+
+	const unsigned char *Chip8::GetAudioPattern()
+	{
+		return audio_pattern_;
+	}
+
+	double Chip8::GetAudioRate()
+	{
+		return 4000.0 * pow(2.0, (pitch_ - 64) / 48.0);
+	}
+
+	void Chip8::UnpackGraphics(const unsigned long long *rows, unsigned int width, unsigned int height, unsigned char *pixels)
+	{
+		for (unsigned int y = 0; y < height; y++)
+		{
+			for (unsigned int x = 0; x < width; x++)
+			{
+				pixels[y * width + x] = (rows[(y * width + x) >> 6] >> (63 - (x & 63))) & 0x1;
+			}
+		}
 	}
 }
@@ -1,14 +1,104 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include "defines.h"
+#include "opcodes.h"
+#include <memory>
 #include <string>
+#include <vector>
+
+// The most bytes Chip8::SaveState() writes, for XO-CHIP in high resolution. A buffer this big
+// holds a snapshot of any machine, Chip8::GetStateSize() has the exact size. The layout is
+// described in chip8.cpp.
+#define CHIP8_STATE_SIZE 67715
+#define CHIP8_STATE_VERSION 6
+// The part of a snapshot between memory and the framebuffer, V0 through the halted flag
+#define CHIP8_REGISTERS_SIZE 119
+
+#define FORK_PAGE_SIZE 256	// Memory and framebuffer are shared between forks in pages this big
+#define FORK_MEMORY_PAGES (MEMORY_SIZE / FORK_PAGE_SIZE)
+#define FORK_GFX_PAGES (2 * GFX_WORDS * 8 / FORK_PAGE_SIZE)
 
 namespace chip8
 {
+	class Jit;
+	struct StaticCode;
+	struct Profile;
+	class TraceWriter;
+
+	// The hex digits Chip8::Init() puts in memory, 4x5 at 0 and SuperChip's 8x10 at BIG_FONT_ADDRESS
+	extern unsigned char chip8_fontset[80];
+	extern unsigned char schip_fontset[160];
+
+	// FORK_PAGE_SIZE bytes of memory or framebuffer. Never changed once made, so states forked
+	// one from another share the pages they have in common.
+	struct ForkPage
+	{
+		unsigned char bytes[FORK_PAGE_SIZE];
+		unsigned long long hash;
+	};
+
+	// A machine state from Chip8::Fork(). Only the registers are its own, memory and the
+	// framebuffer are pages shared with the states it was forked from.
+	struct ForkState
+	{
+		unsigned char machine;
+		unsigned char quirks;
+		unsigned char registers[CHIP8_REGISTERS_SIZE];
+		// The machine's memory, 16 pages or XO-CHIP's 256, then FORK_GFX_PAGES of framebuffer
+		std::vector<std::shared_ptr<const ForkPage> > pages;
+		// Chip8::GetStateHash() at the time of the fork
+		unsigned long long hash;
+	};
+
+	// Ways Chip8::Run() can execute instructions
+	enum Engine
+	{
+		ENGINE_INTERPRETER,
+		ENGINE_JIT		// Compiles basic blocks to x86-64, falls back to the interpreter for the rest
+	};
+
+	// Which instruction set Chip8 runs, see SetMachine()
+	enum Machine
+	{
+		MACHINE_CHIP8,	// CHIP-8 with the SuperChip additions, 4K of memory
+		MACHINE_XOCHIP	// XO-CHIP: 64K of memory, two bitplanes, long loads and an audio pattern
+	};
+
+	// How the instructions interpreters disagree on behave, see quirks.h and SetQuirks()
+	enum QuirkProfile
+	{
+		QUIRKS_DEFAULT,	// What this emulator has always done
+		QUIRKS_COSMAC,	// The original COSMAC VIP interpreter
+		QUIRKS_SCHIP,	// SuperChip 1.1
+		QUIRKS_XOCHIP	// XO-CHIP as Octo runs it
+	};
+
+	// Why a ROM didn't load, see Chip8::LoadGame()
+	enum RomError
+	{
+		ROM_OK,
+		ROM_NOT_FOUND,	// The file couldn't be opened
+		ROM_READ_ERROR,	// It opened but couldn't be read to the end
+		ROM_TOO_LARGE	// It doesn't fit between ROM_ADDRESS and the end of the machine's memory
+	};
+
 	class Chip8
 	{
 	private:
-		unsigned char memory_[4096];
+		// The machine's memory, chip8_memory_ or XO-CHIP's 64K in xo_memory_, see SelectMemory()
+		unsigned char *memory_;
+		unsigned char chip8_memory_[CHIP8_MEMORY_SIZE];
+		// Only allocated once the machine has been XO-CHIP
+		std::vector<unsigned char> xo_memory_;
+
+		Machine machine_;
+		// Addresses wrap at 4K, or 64K for XO-CHIP
+		unsigned short address_mask_;
+		QuirkProfile quirks_;
+		// The interpreter compiled for quirks_, see SetQuirks()
+		void (Chip8::*execute_)();
+		unsigned int (Chip8::*run_)(unsigned int cycles);
 
 		unsigned short opcode_;
 
@@ -21,6 +111,10 @@ namespace chip8
 		unsigned char delay_timer_;
 		unsigned char sound_timer_;
 
+		// The timers tick once every cycles_per_frame_ instructions, frame_cycle_ counts up to that
+		unsigned int cycles_per_frame_;
+		unsigned int frame_cycle_;
+
 		// Program Counter
 		unsigned short pc_;
 
@@ -30,21 +124,311 @@ namespace chip8
 
 		bool keys_[16];
 
-		unsigned char *gfx_;
+		// HP48 RPL user flags for FX75 and FX85. Init() leaves them alone, they outlast
+		// the program like they do on the calculator.
+		unsigned char rpl_[16];
+
+		// xorshift64* state for CXKK, restarted from seed_ by Init() so a reset replays the same numbers
+		unsigned long long seed_;
+		unsigned long long random_state_;
+
+		// One word per 64 pixels, the leftmost pixel is the top bit. A row is one word in
+		// low resolution and two in high resolution, see GetGraphics(). Only XO-CHIP draws
+		// on the second plane.
+		unsigned long long gfx_[2][GFX_WORDS];
+		bool hires_;
+		// Bit p set for every plane that drawing, clearing and scrolling go to, see FN01
+		unsigned char planes_;
 		bool need_redraw_;
+		// Bit y is set once row y has changed, until ClearDirtyRows()
+		unsigned long long dirty_rows_;
+
+		// XO-CHIP sound: 128 one bit samples played in a loop while the sound timer runs,
+		// at a rate set by the pitch register
+		unsigned char audio_pattern_[16];
+		unsigned char pitch_;
+
+		// Set by SuperChip's 00FD EXIT. Nothing runs any more until Init() or Reset(), the
+		// cycles and the timers still go by.
+		bool halted_;
+
+		// Decoded instruction for every address, filled in the first time the pc lands there.
+		// Anything that writes to memory_ has to go through StoreByte() so stale entries get dropped.
+		Instruction decode_cache_[4096];
+
+		// Only set while the JIT engine is selected
+		Jit *jit_;
+
+		// Blocks generated ahead of time by tools/recompile for the loaded ROM, if any
+		const StaticCode *static_code_;
+
+		// Idle loop detection, see SkipIdleLoop()
+		bool idle_skip_;
+		unsigned long long idle_cycles_;
+		unsigned int idle_misses_;
+		// One bit per address, set for loop heads that turned out not to be idle.
+		// Cleared whenever the ROM rewrites code it has run.
+		unsigned char idle_rejected_[512];
+
+		// Only ever set in builds with CHIP8_PROFILE defined
+		Profile *profile_;
+
+		// Only set while tracing, see StartTrace()
+		TraceWriter *trace_;
+
+		// Fetch() decodes code above 4K into this, the decode cache only covers the first 4K
+		Instruction far_instruction_;
+
+		// The state last forked or loaded with LoadFork(), and one bit per memory page written
+		// since. Fork() shares the pages that weren't. Reset whenever memory changes wholesale.
+		std::shared_ptr<const ForkState> fork_base_;
+		unsigned char fork_dirty_[FORK_MEMORY_PAGES / 8];
+
+		// Memory as the last Init() or LoadGame() left it, the machine's 4K or 64K, for Reset().
+		// One bit per page written since, in the same pages as Fork(), so only those go back.
+		std::vector<unsigned char> boot_image_;
+		Machine boot_machine_;
+		QuirkProfile boot_quirks_;
+		unsigned char boot_dirty_[FORK_MEMORY_PAGES / 8];
+
+		// Point memory_ and address_mask_ at machine_'s memory, what's in it is left to the caller
+		void SelectMemory();
+		void FlushCodeCaches();
+		void ResetForkBase();
+		void ResetRegisters();
+		void SaveBootImage();
+		// The registers section of a snapshot, CHIP8_REGISTERS_SIZE bytes
+		void SaveRegisters(unsigned char *out);
+		void LoadRegisters(const unsigned char *in);
+		unsigned long long SpriteRow(unsigned short address, bool wide, unsigned int line);
+		// XOR a sprite onto one plane, returns the pixels it turned off and adds the rows it drew on to dirty
+		unsigned long long DrawSprite(unsigned long long *gfx, unsigned short address, unsigned int x, unsigned int y,
+			unsigned int height, bool wide, unsigned long long &dirty);
+		void ClearScreen();
+		void SetResolution(bool hires);
+		// Down for positive lines, up for negative
+		void ScrollVertical(int lines);
+		// Right for positive pixels, left for negative
+		void ScrollSideways(int pixels);
+		void StoreByte(unsigned short address, unsigned char value);
+		// Bytes a skip instruction moves the pc on by when it skips
+		unsigned short SkipLength();
+		void EndCycles(unsigned int cycles);
+		unsigned char NextRandom();
+
+		const Instruction &Fetch(unsigned short pc);
+		// Point execute_ and run_ at the interpreter compiled for a policy from quirks.h
+		template <class Quirks> void UseQuirks();
+		// Run one instruction with the interpreter, without touching the timers
+		template <class Quirks> void Execute();
+		// Run cycles instructions with the selected engine, without touching the timers.
+		// An idle loop that doesn't read the timers may be skipped up to budget cycles.
+		// Returns the cycles run or skipped.
+		template <class Quirks> unsigned int RunSlice(unsigned int cycles, unsigned int budget);
+		// Run() for one quirk policy, slicing the cycles up at frame boundaries
+		template <class Quirks> unsigned int RunFrames(unsigned int cycles);
+		unsigned int SkipIdleLoop(unsigned int cycles, unsigned int budget);
+
+		// Opcode handlers, one per OpId. See Execute() for the dispatch. The ones
+		// interpreters disagree on take the quirk policy.
+		void OpInvalid(const Instruction &ins);
+		void Op00CN(const Instruction &ins);
+		void Op00E0(const Instruction &ins);
+		void Op00EE(const Instruction &ins);
+		void Op00FB(const Instruction &ins);
+		void Op00FC(const Instruction &ins);
+		void Op00FD(const Instruction &ins);
+		void Op00FE(const Instruction &ins);
+		void Op00FF(const Instruction &ins);
+		void Op1NNN(const Instruction &ins);
+		void Op2NNN(const Instruction &ins);
+		void Op3XKK(const Instruction &ins);
+		void Op4XKK(const Instruction &ins);
+		void Op5XY0(const Instruction &ins);
+		void Op6XKK(const Instruction &ins);
+		void Op7XKK(const Instruction &ins);
+		void Op8XY0(const Instruction &ins);
+		void Op8XY1(const Instruction &ins);
+		void Op8XY2(const Instruction &ins);
+		void Op8XY3(const Instruction &ins);
+		void Op8XY4(const Instruction &ins);
+		void Op8XY5(const Instruction &ins);
+		template <class Quirks> void Op8XY6(const Instruction &ins);
+		void Op8XY7(const Instruction &ins);
+		template <class Quirks> void Op8XYE(const Instruction &ins);
+		void Op9XY0(const Instruction &ins);
+		void OpANNN(const Instruction &ins);
+		template <class Quirks> void OpBNNN(const Instruction &ins);
+		void OpCXKK(const Instruction &ins);
+		void OpDXYN(const Instruction &ins);
+		void OpEX9E(const Instruction &ins);
+		void OpEXA1(const Instruction &ins);
+		void OpFX07(const Instruction &ins);
+		void OpFX0A(const Instruction &ins);
+		void OpFX15(const Instruction &ins);
+		void OpFX18(const Instruction &ins);
+		template <class Quirks> void OpFX1E(const Instruction &ins);
+		void OpFX29(const Instruction &ins);
+		void OpFX30(const Instruction &ins);
+		void OpFX33(const Instruction &ins);
+		template <class Quirks> void OpFX55(const Instruction &ins);
+		template <class Quirks> void OpFX65(const Instruction &ins);
+		void OpFX75(const Instruction &ins);
+		void OpFX85(const Instruction &ins);
+		void Op00DN(const Instruction &ins);
+		void Op5XY2(const Instruction &ins);
+		void Op5XY3(const Instruction &ins);
+		void OpF000(const Instruction &ins);
+		void OpFN01(const Instruction &ins);
+		void OpF002(const Instruction &ins);
+		void OpFX3A(const Instruction &ins);
 	public:
 		Chip8();
 		~Chip8();
 
 		void Init();
-		void LoadGame(const std::string &game_name);
+		// Start the loaded ROM over: memory, machine and quirks go back to how LoadGame() left
+		// them and the registers, screen and timers to how Init() does. Nothing is allocated,
+		// and only the memory pages the ROM wrote are restored, so the decoded and compiled code
+		// for the rest survives. For harnesses starting the same ROM over and over. Like Init()
+		// it keeps the engine, cycles per frame, seed and RPL flags.
+		void Reset();
+		// Load a ROM file at ROM_ADDRESS over what's in memory, reports how it went on cout too
+		RomError LoadGame(const std::string &game_name);
+		// Load a ROM that's already in memory, e.g. from a RomStore, with a single copy
+		RomError LoadGame(const unsigned char *rom, unsigned int size);
+		// Read a whole ROM file, anything bigger than the largest machine can hold is refused
+		static RomError ReadRom(const std::string &file_name, std::vector<unsigned char> &rom);
+		static const char *GetRomErrorText(RomError error);
+
+		// Switch instruction sets. The machine starts over with Init(), so call this before
+		// LoadGame(). XO-CHIP is interpreter only, selecting it goes back from the JIT and
+		// drops any static code. MACHINE_CHIP8 by default.
+		void SetMachine(Machine machine);
+		Machine GetMachine();
+		// Switch to the interpreter built for a quirk profile. SetMachine() selects the machine's
+		// own profile, QUIRKS_DEFAULT for MACHINE_CHIP8, so call this after it. Only QUIRKS_DEFAULT
+		// runs on the JIT and static code, any other profile goes back to the interpreter.
+		void SetQuirks(QuirkProfile quirks);
+		QuirkProfile GetQuirks();
+		// Look a profile up by its name on the command line: default, cosmac, schip or xochip
+		static bool ParseQuirks(const std::string &name, QuirkProfile &quirks);
+		// Run a single instruction with the interpreter
 		void Cycle();
+		// Run cycles instructions with the selected engine, returns how many ran
+		unsigned int Run(unsigned int cycles);
+		// Run up to the end of the current 60Hz frame, returns how many instructions ran
+		unsigned int RunFrame();
+
+		// Instructions per 60Hz frame, the delay and sound timers tick once per frame
+		void SetCyclesPerFrame(unsigned int cycles);
+		unsigned int GetCyclesPerFrame();
 		void SetKeyState(unsigned int key, bool state);
+		bool GetKeyState(unsigned int key);
+
+		// The 16 RPL flags, so a frontend can keep them between runs
+		const unsigned char *GetRplFlags();
+		void SetRplFlags(const unsigned char *flags);
+
+		// Seed for the CXKK random numbers, restarts the sequence right away.
+		// Every instance starts from DEFAULT_RANDOM_SEED, so runs are reproducible unless seeded otherwise.
+		void SetSeed(unsigned long long seed);
+		unsigned long long GetSeed();
+
+		// Skip over loops that provably do nothing until a timer ticks or a key changes,
+		// like waiting on the delay timer, FX0A with no key held or jumping to itself.
+		// The result is exactly the same as running them. On by default.
+		void SetIdleSkip(bool enabled);
+		bool GetIdleSkip();
+		// Instructions skipped that way since Init()
+		unsigned long long GetIdleCycles();
+
+		// Count opcodes, addresses, draws and instructions per frame into a fresh Profile.
+		// Returns false if this build has no profiling, see profile.h.
+		bool SetProfiling(bool enabled);
+		// nullptr unless profiling
+		const Profile *GetProfile();
+
+		// Stream every instruction from here on to file_name, see trace.h for the format.
+		// Works with every engine, compiled blocks and skipped idle loops show up as one
+		// step each. Any trace already running is finished first. Returns false if the
+		// file can't be created.
+		bool StartTrace(const std::string &file_name);
+		// Flush and close the trace. Returns false if not all of it could be written.
+		bool StopTrace();
+
+		// Returns false if the engine isn't available on this platform or for the machine and quirks, the current one is kept
+		bool SetEngine(Engine engine);
+		Engine GetEngine();
+
+		// Use code generated by tools/recompile for the loaded ROM, call after LoadGame().
+		// Returns false if the code was generated from a different ROM, the machine is XO-CHIP or
+		// the quirks aren't QUIRKS_DEFAULT.
+		// It is dropped again if the ROM writes over any of it.
+		bool SetStaticCode(const StaticCode *code);
+
+		// Copy the whole machine into buffer, which needs GetStateSize() bytes, CHIP8_STATE_SIZE
+		// always does. Returns the bytes written or 0 if the buffer is too small. Nothing is allocated.
+		unsigned int SaveState(unsigned char *buffer, unsigned int size);
+		// Bytes SaveState() would write now. Memory above 4K and the second plane only come in
+		// for XO-CHIP, and the framebuffer only as big as the resolution.
+		unsigned int GetStateSize();
+		// Size a snapshot of this version says it is, 0 if buffer doesn't start with one
+		static unsigned int GetStateSize(const unsigned char *buffer, unsigned int size);
+		// Restore a snapshot from SaveState(). Returns false and leaves the machine alone if it isn't
+		// a valid snapshot of this version. The engine and static code stay selected, unless the
+		// snapshot's machine or quirks can't use them.
+		bool LoadState(const unsigned char *buffer, unsigned int size);
+		bool SaveStateFile(const std::string &file_name);
+		bool LoadStateFile(const std::string &file_name);
+
+		// Branch the machine off, e.g. to try every input from here. Costs the registers and
+		// the memory and framebuffer pages that changed since the state this machine last
+		// forked or loaded with LoadFork(), the rest are shared with it.
+		std::shared_ptr<const ForkState> Fork();
+		// Continue from a forked state. Only the pages that differ from what's in memory are
+		// copied. The engine and static code stay selected like with LoadState().
+		void LoadFork(const std::shared_ptr<const ForkState> &state);
+		// 64 bit hash of the whole machine, everything SaveState() writes that it can reach, for
+		// telling apart states worth exploring. Equal to the hash of Fork() at the same point.
+		unsigned long long GetStateHash();
+		// FNV-1a hash of just the visible screen, GetGraphics() byte by byte with the top byte of each
+		// word first. The tools print it to tell runs apart by what ended up on screen.
+		unsigned long long GetScreenHash();
 
 		bool GetNeedRedraw();
 		void SetNeedRedraw(bool redraw);
 
-		const unsigned char *GetGraphics();
+		// Whether the program has exited with 00FD, or stopped on a return with an empty
+		// stack or a call with a full one
+		bool IsHalted();
+
+		// 64x32, or 128x64 after a SuperChip ROM switched to high resolution with 00FF
+		unsigned int GetScreenWidth();
+		unsigned int GetScreenHeight();
+		// GetScreenHeight() rows of GetScreenWidth() / 64 words each. Every word holds 64 pixels,
+		// the leftmost pixel in the top bit. Plane 1 stays blank unless the machine is XO-CHIP,
+		// where a pixel's color comes from its bits in both planes.
+		const unsigned long long *GetGraphics(unsigned int plane = 0);
+		// Rows of GetGraphics() written since the last ClearDirtyRows(), bit y for row y.
+		// Copy or redraw just those and clear them afterwards.
+		unsigned long long GetDirtyRows();
+		void ClearDirtyRows();
+
+		unsigned char GetSoundTimer();
+		// All GetMemorySize() bytes, for reading only. Writing here would skip StoreByte() and leave
+		// the code caches stale.
+		const unsigned char *GetMemory();
+		// CHIP8_MEMORY_SIZE, or MEMORY_SIZE for XO-CHIP
+		unsigned int GetMemorySize();
+		// XO-CHIP's 16 byte audio pattern, loaded with F002. Its 128 bits play from the top
+		// bit of the first byte on, over and over while the sound timer is running.
+		const unsigned char *GetAudioPattern();
+		// Samples of the pattern played a second, 4000 * 2^((pitch - 64) / 48) from the FX3A pitch
+		double GetAudioRate();
+
+		// Expand rows from GetGraphics() into width * height bytes, one per pixel set to 0 or 1
+		static void UnpackGraphics(const unsigned long long *rows, unsigned int width, unsigned int height, unsigned char *pixels);
 	};
 }
 
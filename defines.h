@@ -1,11 +1,24 @@
 #ifndef DEFINES_H
 #define DEFINES_H
 
-#define PIXEL_SCALE 10
+#define PIXEL_SCALE 10		// Window pixels per Chip8 pixel, SuperChip's high resolution gets half that
 #define CHIP8_PIXEL_WIDTH 64
 #define CHIP8_PIXEL_HEIGHT 32
+#define SCHIP_PIXEL_WIDTH 128
+#define SCHIP_PIXEL_HEIGHT 64
 #define SCREEN_WIDTH (CHIP8_PIXEL_WIDTH * PIXEL_SCALE)
 #define SCREEN_HEIGHT (CHIP8_PIXEL_HEIGHT * PIXEL_SCALE)
-#define PIXEL_COUNT (CHIP8_PIXEL_WIDTH * CHIP8_PIXEL_HEIGHT)
+#define PIXEL_COUNT (SCHIP_PIXEL_WIDTH * SCHIP_PIXEL_HEIGHT)	// Enough for either resolution
+#define GFX_WORDS (PIXEL_COUNT / 64)	// Words in the packed framebuffer, see Chip8::GetGraphics()
+#define ALL_ROWS_DIRTY (~0ull)	// One bit per row of either resolution, see Chip8::GetDirtyRows()
+
+#define MEMORY_SIZE 0x10000	// XO-CHIP's 64K, the most any machine has
+#define CHIP8_MEMORY_SIZE 0x1000	// CHIP-8 and SuperChip only have 4K
+#define BIG_FONT_ADDRESS 0x50	// SuperChip's 8x10 digits for FX30, right after the small ones
+#define ROM_ADDRESS 0x200	// Where ROMs are loaded and start running
+
+#define FRAMES_PER_SECOND 60
+#define DEFAULT_CYCLES_PER_FRAME 12	// 720 instructions a second
+#define DEFAULT_RANDOM_SEED 0x43484950382D3031ull	// Used until Chip8::SetSeed() is called
 
 #endif //DEFINES_H
\ No newline at end of file
@@ -0,0 +1,303 @@
+#include "env_batch.h"
+#include <cstring>
+
+#define ENV_JOBS_PER_THREAD 4	// Enough jobs for stealing to even out the threads
+
+namespace chip8
+{
+	namespace
+	{
+		// Squeeze 64 pixels into 32, a pixel is lit if either of the pair it stands for is
+		unsigned long long HalveRow(unsigned long long row)
+		{
+			row = ((row | (row << 1)) & 0xAAAAAAAAAAAAAAAAull) >> 1;
+			row = (row | (row >> 1)) & 0x3333333333333333ull;
+			row = (row | (row >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+			row = (row | (row >> 4)) & 0x00FF00FF00FF00FFull;
+			row = (row | (row >> 8)) & 0x0000FFFF0000FFFFull;
+			row = (row | (row >> 16)) & 0x00000000FFFFFFFFull;
+			return row;
+		}
+
+		// The 8 pixels of each byte value as 8 bytes of 0 or 1, leftmost first
+		struct PixelTable
+		{
+			unsigned char bytes[256][8];
+
+			PixelTable()
+			{
+				for (unsigned int value = 0; value < 256; value++)
+				{
+					for (unsigned int x = 0; x < 8; x++)
+					{
+						bytes[value][x] = (value >> (7 - x)) & 0x1;
+					}
+				}
+			}
+		};
+
+		const PixelTable pixel_table;
+	}
+
+	EnvBatch::EnvBatch(unsigned int count, ObservationFormat format, unsigned int threads) : pool_(threads)
+	{
+		format_ = format;
+		for (unsigned int e = 0; e < count; e++)
+		{
+			envs_.push_back(std::unique_ptr<Chip8>(new Chip8()));
+		}
+
+		unsigned int jobs = pool_.GetThreadCount() * ENV_JOBS_PER_THREAD;
+		chunk_ = count / jobs > 0 ? count / jobs : 1;
+
+		actions_ = nullptr;
+		frames_ = 0;
+		observations_ = nullptr;
+		step_rewards_ = nullptr;
+		dones_ = nullptr;
+		seed_ = 0;
+
+		step_job_ = [this](unsigned int job)
+		{
+			unsigned int end = job * chunk_ + chunk_ < envs_.size() ? job * chunk_ + chunk_ : (unsigned int)envs_.size();
+			for (unsigned int env = job * chunk_; env < end; env++)
+			{
+				StepEnv(env);
+			}
+		};
+		reset_job_ = [this](unsigned int job)
+		{
+			unsigned int end = job * chunk_ + chunk_ < envs_.size() ? job * chunk_ + chunk_ : (unsigned int)envs_.size();
+			for (unsigned int env = job * chunk_; env < end; env++)
+			{
+				ResetEnv(env, seed_ + env, observations_ + env * GetObservationSize());
+			}
+		};
+	}
+
+	RomError EnvBatch::LoadGame(const std::string &game_name, Machine machine)
+	{
+		// SetMachine() picks the machine's own quirks
+		std::unique_ptr<Chip8> boot(new Chip8());
+		boot->SetMachine(machine);
+		return LoadGame(game_name, machine, boot->GetQuirks());
+	}
+
+	RomError EnvBatch::LoadGame(const std::string &game_name, Machine machine, QuirkProfile quirks)
+	{
+		// Read once and tried on a spare machine, so the environments are only touched if it fits
+		std::vector<unsigned char> rom;
+		RomError error = Chip8::ReadRom(game_name, rom);
+		const unsigned char *data = rom.empty() ? nullptr : &rom[0];
+		std::unique_ptr<Chip8> boot(new Chip8());
+		boot->SetMachine(machine);
+		if (error == ROM_OK)
+		{
+			error = boot->LoadGame(data, (unsigned int)rom.size());
+		}
+		if (error != ROM_OK)
+		{
+			return error;
+		}
+
+		// Each environment keeps the ROM as its boot image, Reset() goes back to it
+		for (size_t e = 0; e < envs_.size(); e++)
+		{
+			envs_[e]->SetMachine(machine);
+			envs_[e]->SetQuirks(quirks);
+			envs_[e]->LoadGame(data, (unsigned int)rom.size());
+		}
+		return ROM_OK;
+	}
+
+	unsigned int EnvBatch::GetCount()
+	{
+		return (unsigned int)envs_.size();
+	}
+
+	unsigned int EnvBatch::GetObservationSize()
+	{
+		return format_ == OBSERVATION_BITS ? OBSERVATION_BITS_SIZE : OBSERVATION_BYTES_SIZE;
+	}
+
+	void EnvBatch::Reset(unsigned long long seed, unsigned char *observations)
+	{
+		seed_ = seed;
+		observations_ = observations;
+		pool_.Run((GetCount() + chunk_ - 1) / chunk_, reset_job_);
+	}
+
+	void EnvBatch::Reset(unsigned int env, unsigned long long seed, unsigned char *observation)
+	{
+		ResetEnv(env, seed, observation);
+	}
+
+	void EnvBatch::ResetEnv(unsigned int env, unsigned long long seed, unsigned char *observation)
+	{
+		Chip8 *engine = envs_[env].get();
+		engine->SetSeed(seed);
+		engine->Reset();
+
+		const unsigned char *memory = engine->GetMemory();
+		for (size_t r = 0; r < rewards_.size(); r++)
+		{
+			last_values_[env * rewards_.size() + r] = ReadReward(rewards_[r], memory, engine->GetMemorySize());
+		}
+		WriteObservation(env, observation);
+	}
+
+	void EnvBatch::Step(const unsigned short *actions, unsigned int frames, unsigned char *observations,
+		float *rewards, unsigned char *dones)
+	{
+		actions_ = actions;
+		frames_ = frames;
+		observations_ = observations;
+		step_rewards_ = rewards;
+		dones_ = dones;
+		pool_.Run((GetCount() + chunk_ - 1) / chunk_, step_job_);
+	}
+
+	void EnvBatch::StepEnv(unsigned int env)
+	{
+		Chip8 *engine = envs_[env].get();
+		unsigned short keys = actions_[env];
+		for (unsigned int key = 0; key < 16; key++)
+		{
+			engine->SetKeyState(key, (keys >> key & 1) != 0);
+		}
+		for (unsigned int frame = 0; frame < frames_; frame++)
+		{
+			engine->RunFrame();
+		}
+
+		float reward = CollectRewards(env);
+		if (step_rewards_)
+		{
+			step_rewards_[env] = reward;
+		}
+		if (dones_)
+		{
+			// A program that exited with 00FD or broke its stack is over whatever the hook says
+			dones_[env] = engine->IsHalted() || (done_hook_ && done_hook_(env, engine->GetMemory())) ? 1 : 0;
+		}
+		WriteObservation(env, observations_ + env * GetObservationSize());
+	}
+
+	int EnvBatch::ReadReward(const Reward &reward, const unsigned char *memory, unsigned int memory_size)
+	{
+		if (reward.digits == 0)
+		{
+			return memory[reward.address & (memory_size - 1)];
+		}
+		int value = 0;
+		for (unsigned int d = 0; d < reward.digits; d++)
+		{
+			value = value * 10 + memory[(reward.address + d) & (memory_size - 1)];
+		}
+		return value;
+	}
+
+	float EnvBatch::CollectRewards(unsigned int env)
+	{
+		const unsigned char *memory = envs_[env]->GetMemory();
+		unsigned int memory_size = envs_[env]->GetMemorySize();
+		float total = 0;
+		for (size_t r = 0; r < rewards_.size(); r++)
+		{
+			int &last = last_values_[env * rewards_.size() + r];
+			int value = ReadReward(rewards_[r], memory, memory_size);
+			// A byte that wrapped moved by the short way round
+			int change = rewards_[r].digits == 0 ? (int)(signed char)(unsigned char)(value - last) : value - last;
+			total += rewards_[r].scale * change;
+			last = value;
+		}
+		if (reward_hook_)
+		{
+			total += reward_hook_(env, memory);
+		}
+		return total;
+	}
+
+	void EnvBatch::WriteObservation(unsigned int env, unsigned char *observation)
+	{
+		// Straight from the framebuffer into the caller's buffer, a row at a time
+		Chip8 *engine = envs_[env].get();
+		const unsigned long long *plane0 = engine->GetGraphics(0);
+		const unsigned long long *plane1 = engine->GetGraphics(1);
+		bool hires = engine->GetScreenWidth() != CHIP8_PIXEL_WIDTH;
+		bool planes = engine->GetMachine() == MACHINE_XOCHIP;
+		if (format_ == OBSERVATION_BITS && !hires && !planes)
+		{
+			// The framebuffer already is the observation
+			memcpy(observation, plane0, OBSERVATION_BITS_SIZE);
+			return;
+		}
+
+		for (unsigned int y = 0; y < CHIP8_PIXEL_HEIGHT; y++)
+		{
+			unsigned long long row;
+			if (!hires)
+			{
+				row = plane0[y] | (planes ? plane1[y] : 0);
+			}
+			else
+			{
+				const unsigned long long *top = plane0 + y * 4;
+				unsigned long long left = top[0] | top[2];
+				unsigned long long right = top[1] | top[3];
+				if (planes)
+				{
+					top = plane1 + y * 4;
+					left |= top[0] | top[2];
+					right |= top[1] | top[3];
+				}
+				row = HalveRow(left) << 32 | HalveRow(right);
+			}
+
+			if (format_ == OBSERVATION_BITS)
+			{
+				memcpy(observation + y * 8, &row, 8);
+			}
+			else
+			{
+				unsigned char *pixels = observation + y * CHIP8_PIXEL_WIDTH;
+				for (unsigned int b = 0; b < 8; b++)
+				{
+					memcpy(pixels + b * 8, pixel_table.bytes[(row >> (56 - b * 8)) & 0xFF], 8);
+				}
+			}
+		}
+	}
+
+	void EnvBatch::AddReward(unsigned short address, float scale, unsigned int digits)
+	{
+		Reward reward;
+		reward.address = address;
+		reward.digits = digits;
+		reward.scale = scale;
+		rewards_.push_back(reward);
+		// The new reward starts counting at the next Reset()
+		last_values_.assign(envs_.size() * rewards_.size(), 0);
+	}
+
+	void EnvBatch::ClearRewards()
+	{
+		rewards_.clear();
+		last_values_.clear();
+	}
+
+	void EnvBatch::SetRewardHook(const std::function<float(unsigned int env, const unsigned char *memory)> &hook)
+	{
+		reward_hook_ = hook;
+	}
+
+	void EnvBatch::SetDoneHook(const std::function<bool(unsigned int env, const unsigned char *memory)> &hook)
+	{
+		done_hook_ = hook;
+	}
+
+	Chip8 *EnvBatch::GetEnv(unsigned int env)
+	{
+		return envs_[env].get();
+	}
+}
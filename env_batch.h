@@ -0,0 +1,115 @@
+#ifndef ENV_BATCH_H
+#define ENV_BATCH_H
+
+#include "chip8.h"
+#include "work_pool.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define OBSERVATION_BITS_SIZE (CHIP8_PIXEL_HEIGHT * 8)	// A 64 bit word per row
+#define OBSERVATION_BYTES_SIZE (CHIP8_PIXEL_WIDTH * CHIP8_PIXEL_HEIGHT)	// A byte per pixel
+
+namespace chip8
+{
+	// How EnvBatch writes an environment's screen
+	enum ObservationFormat
+	{
+		OBSERVATION_BITS,	// 32 rows of one 64 bit word each, native byte order, leftmost pixel in the top bit like GetGraphics()
+		OBSERVATION_BYTES	// 64x32 bytes row by row, 1 for a lit pixel and 0 for a dark one
+	};
+
+	// A batch of headless environments running one ROM, for training agents. Reset() and
+	// Step() take the whole batch at once, spread it over a WorkPool and write every
+	// environment's observation straight into one buffer the caller owns, environment e at
+	// e * GetObservationSize(). Nothing is allocated per step.
+	//
+	// Observations are always 64x32. SuperChip's high resolution is halved, a pixel is lit
+	// if any of the four it covers is, and XO-CHIP's two planes are combined.
+	class EnvBatch
+	{
+	private:
+		struct Reward
+		{
+			unsigned short address;
+			unsigned int digits;
+			float scale;
+		};
+
+		std::vector<std::unique_ptr<Chip8> > envs_;
+		ObservationFormat format_;
+		WorkPool pool_;
+		// Environments per WorkPool job, so the pool isn't locking a queue for every one
+		unsigned int chunk_;
+
+		std::vector<Reward> rewards_;
+		// The value each reward read last, rewards_.size() entries per environment
+		std::vector<int> last_values_;
+		std::function<float(unsigned int env, const unsigned char *memory)> reward_hook_;
+		std::function<bool(unsigned int env, const unsigned char *memory)> done_hook_;
+
+		// The arguments of the Step() in progress, for step_job_
+		const unsigned short *actions_;
+		unsigned int frames_;
+		unsigned char *observations_;
+		float *step_rewards_;
+		unsigned char *dones_;
+		unsigned long long seed_;
+		// Built once so a step doesn't allocate one
+		std::function<void(unsigned int)> step_job_;
+		std::function<void(unsigned int)> reset_job_;
+
+		EnvBatch(const EnvBatch &other);
+		EnvBatch &operator=(const EnvBatch &other);
+
+		// Addresses wrap at the end of memory, which is memory_size bytes
+		int ReadReward(const Reward &reward, const unsigned char *memory, unsigned int memory_size);
+		float CollectRewards(unsigned int env);
+		void ResetEnv(unsigned int env, unsigned long long seed, unsigned char *observation);
+		void StepEnv(unsigned int env);
+		void WriteObservation(unsigned int env, unsigned char *observation);
+	public:
+		// 0 threads uses one per hardware thread, like WorkPool
+		EnvBatch(unsigned int count, ObservationFormat format, unsigned int threads = 0);
+
+		// Load the ROM into every environment, run as machine with the given quirks, for
+		// Reset() to start them on. If it doesn't load the environments are left alone.
+		RomError LoadGame(const std::string &game_name, Machine machine = MACHINE_CHIP8);
+		RomError LoadGame(const std::string &game_name, Machine machine, QuirkProfile quirks);
+
+		unsigned int GetCount();
+		// Bytes of observation per environment
+		unsigned int GetObservationSize();
+
+		// Start every environment over, environment e with random seed seed + e, and write
+		// their first observations
+		void Reset(unsigned long long seed, unsigned char *observations);
+		// Start one environment over, e.g. once it's done
+		void Reset(unsigned int env, unsigned long long seed, unsigned char *observation);
+
+		// Hold the keys in actions[e], bit k for key k, in environment e for frames 60Hz
+		// frames, then write its observation, the reward it got in those frames and whether
+		// it's done, either by the done hook or by halting, see Chip8::IsHalted(). rewards and dones may be null.
+		void Step(const unsigned short *actions, unsigned int frames, unsigned char *observations,
+			float *rewards, unsigned char *dones);
+
+		// Reward scale times how much a value in memory went up since the last step. digits 0
+		// reads the byte at address, with wrapping counted as the smallest change. Otherwise
+		// it reads that many decimal digits from address on, most significant first, the way
+		// FX33 stores a score.
+		void AddReward(unsigned short address, float scale, unsigned int digits = 0);
+		void ClearRewards();
+		// Extra reward from the environment's memory, Chip8::GetMemorySize() bytes, after every step.
+		// Called from the worker threads, for different environments at the same time.
+		void SetRewardHook(const std::function<float(unsigned int env, const unsigned char *memory)> &hook);
+		// Whether the environment is done, e.g. a lives counter at 0. Called like the reward hook.
+		void SetDoneHook(const std::function<bool(unsigned int env, const unsigned char *memory)> &hook);
+
+		// The environment itself, e.g. to look at its state. Running it from outside the
+		// batch throws the rewards off until the next Reset().
+		Chip8 *GetEnv(unsigned int env);
+	};
+}
+
+#endif //ENV_BATCH_H
@@ -0,0 +1,454 @@
+#include "jit.h"
+#include "opcodes.h"
+#include <cstring>
+
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace chip8
+{
+	namespace
+	{
+		const unsigned int CODE_BUFFER_SIZE = 1024 * 1024;
+
+		// Longest run of instructions put in one block
+		const unsigned short MAX_BLOCK_LENGTH = 64;
+
+#if CHIP8_JIT_SUPPORTED
+		size_t PageSize()
+		{
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwPageSize;
+#else
+			return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+		}
+#endif
+
+		// Scratch registers, these are caller saved on both the System V and Windows ABIs.
+		// The block keeps the V register pointer in r10 and the I pointer in r11.
+		enum Reg
+		{
+			EAX = 0,
+			ECX = 1,
+			EDX = 2
+		};
+
+		void Emit(std::vector<unsigned char> &code, unsigned char b0)
+		{
+			code.push_back(b0);
+		}
+
+		void Emit(std::vector<unsigned char> &code, unsigned char b0, unsigned char b1)
+		{
+			code.push_back(b0);
+			code.push_back(b1);
+		}
+
+		void Emit(std::vector<unsigned char> &code, unsigned char b0, unsigned char b1, unsigned char b2)
+		{
+			code.push_back(b0);
+			code.push_back(b1);
+			code.push_back(b2);
+		}
+
+		void Emit(std::vector<unsigned char> &code, unsigned char b0, unsigned char b1, unsigned char b2, unsigned char b3)
+		{
+			code.push_back(b0);
+			code.push_back(b1);
+			code.push_back(b2);
+			code.push_back(b3);
+		}
+
+		void EmitImm32(std::vector<unsigned char> &code, unsigned int value)
+		{
+			code.push_back(value & 0xFF);
+			code.push_back((value >> 8) & 0xFF);
+			code.push_back((value >> 16) & 0xFF);
+			code.push_back((value >> 24) & 0xFF);
+		}
+
+		// movzx reg, byte [r10 + x]
+		void EmitLoadV(std::vector<unsigned char> &code, Reg reg, unsigned char x)
+		{
+			Emit(code, 0x41, 0x0F, 0xB6);
+			Emit(code, 0x42 | (reg << 3), x);
+		}
+
+		// mov byte [r10 + x], reg8
+		void EmitStoreV(std::vector<unsigned char> &code, Reg reg, unsigned char x)
+		{
+			Emit(code, 0x41, 0x88, 0x42 | (reg << 3), x);
+		}
+
+		// mov eax, pc
+		// ret
+		void EmitReturnPc(std::vector<unsigned char> &code, unsigned short pc)
+		{
+			Emit(code, 0xB8);
+			EmitImm32(code, pc);
+			Emit(code, 0xC3);
+		}
+
+		// Expects the flags of a compare, returns pc + 4 when cmov_op's condition holds and pc + 2 otherwise
+		void EmitReturnSkip(std::vector<unsigned char> &code, unsigned short pc, unsigned char cmov_op)
+		{
+			Emit(code, 0xB8);
+			EmitImm32(code, pc + 2);
+			Emit(code, 0xB9);
+			EmitImm32(code, pc + 4);
+			Emit(code, 0x0F, cmov_op, 0xC1);	// cmovcc eax, ecx
+			Emit(code, 0xC3);
+		}
+
+		// Compile an instruction that falls through to the next one.
+		// Returns false if it has to be left for the interpreter.
+		bool EmitStraight(std::vector<unsigned char> &code, const Instruction &ins)
+		{
+			// Forms with VF as an operand are left to the interpreter, which decides whether
+			// the result or the flag ends up in VF
+			bool touches_vf = ins.x == 0xF || ins.y == 0xF;
+
+			switch (ins.op)
+			{
+			case OP_6XKK:
+				Emit(code, 0x41, 0xC6, 0x42);	// mov byte [r10 + x], kk
+				Emit(code, ins.x, ins.kk);
+				return true;
+			case OP_7XKK:
+				Emit(code, 0x41, 0x80, 0x42);	// add byte [r10 + x], kk
+				Emit(code, ins.x, ins.kk);
+				return true;
+			case OP_8XY0:
+				EmitLoadV(code, EAX, ins.y);
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_8XY1:
+			case OP_8XY2:
+			case OP_8XY3:
+				EmitLoadV(code, EAX, ins.x);
+				EmitLoadV(code, ECX, ins.y);
+				if (ins.op == OP_8XY1) Emit(code, 0x08, 0xC8);	// or al, cl
+				if (ins.op == OP_8XY2) Emit(code, 0x20, 0xC8);	// and al, cl
+				if (ins.op == OP_8XY3) Emit(code, 0x30, 0xC8);	// xor al, cl
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_8XY4:
+				if (touches_vf) return false;
+				EmitLoadV(code, EAX, ins.x);
+				EmitLoadV(code, ECX, ins.y);
+				Emit(code, 0x00, 0xC8);			// add al, cl
+				Emit(code, 0x0F, 0x92, 0xC2);	// setc dl
+				EmitStoreV(code, EDX, 0xF);
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_8XY5:
+				if (touches_vf) return false;
+				EmitLoadV(code, EAX, ins.x);
+				EmitLoadV(code, ECX, ins.y);
+				Emit(code, 0x28, 0xC8);			// sub al, cl
+				Emit(code, 0x0F, 0x93, 0xC2);	// setae dl, VF = NOT borrow
+				EmitStoreV(code, EDX, 0xF);
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_8XY7:
+				if (touches_vf) return false;
+				EmitLoadV(code, EAX, ins.y);
+				EmitLoadV(code, ECX, ins.x);
+				Emit(code, 0x28, 0xC8);			// sub al, cl
+				Emit(code, 0x0F, 0x97, 0xC2);	// seta dl, VF = Vy > Vx
+				EmitStoreV(code, EDX, 0xF);
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_8XY6:
+			case OP_8XYE:
+				if (ins.x == 0xF) return false;
+				EmitLoadV(code, EAX, ins.x);
+				Emit(code, 0x89, 0xC2);			// mov edx, eax
+				if (ins.op == OP_8XY6)
+				{
+					Emit(code, 0x80, 0xE2, 0x01);	// and dl, 1
+					Emit(code, 0xD0, 0xE8);			// shr al, 1
+				}
+				else
+				{
+					Emit(code, 0xC0, 0xEA, 0x07);	// shr dl, 7
+					Emit(code, 0xD0, 0xE0);			// shl al, 1
+				}
+				EmitStoreV(code, EDX, 0xF);
+				EmitStoreV(code, EAX, ins.x);
+				return true;
+			case OP_ANNN:
+				Emit(code, 0x66, 0x41, 0xC7, 0x03);	// mov word [r11], nnn
+				Emit(code, ins.nnn & 0xFF, ins.nnn >> 8);
+				return true;
+			case OP_FX1E:
+				if (ins.x == 0xF) return false;
+				EmitLoadV(code, EAX, ins.x);
+				Emit(code, 0x41, 0x0F, 0xB7, 0x0B);	// movzx ecx, word [r11]
+				Emit(code, 0x01, 0xC1);				// add ecx, eax
+				Emit(code, 0x81, 0xF9);				// cmp ecx, 0xFFF
+				EmitImm32(code, 0xFFF);
+				Emit(code, 0x0F, 0x97, 0xC2);		// seta dl
+				EmitStoreV(code, EDX, 0xF);
+				Emit(code, 0x66, 0x41, 0x89, 0x0B);	// mov word [r11], cx
+				return true;
+			case OP_FX29:
+				EmitLoadV(code, EAX, ins.x);
+				Emit(code, 0x8D, 0x04, 0x80);		// lea eax, [rax + rax * 4]
+				Emit(code, 0x66, 0x41, 0x89, 0x03);	// mov word [r11], ax
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// Compile a jump or skip that ends the block, returning the next pc.
+		// Returns false if it has to be left for the interpreter.
+		bool EmitBranch(std::vector<unsigned char> &code, const Instruction &ins, unsigned short pc)
+		{
+			switch (ins.op)
+			{
+			case OP_1NNN:
+				EmitReturnPc(code, ins.nnn);
+				return true;
+			case OP_BNNN:
+				EmitLoadV(code, EAX, 0x0);
+				Emit(code, 0x05);	// add eax, nnn
+				EmitImm32(code, ins.nnn);
+				Emit(code, 0xC3);
+				return true;
+			case OP_3XKK:
+			case OP_4XKK:
+				Emit(code, 0x41, 0x80, 0x7A);	// cmp byte [r10 + x], kk
+				Emit(code, ins.x, ins.kk);
+				EmitReturnSkip(code, pc, ins.op == OP_3XKK ? 0x44 : 0x45);	// cmove / cmovne
+				return true;
+			case OP_5XY0:
+			case OP_9XY0:
+				EmitLoadV(code, EAX, ins.x);
+				Emit(code, 0x41, 0x3A, 0x42, ins.y);	// cmp al, byte [r10 + y]
+				EmitReturnSkip(code, pc, ins.op == OP_5XY0 ? 0x44 : 0x45);
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
+	Jit::Jit()
+	{
+		code_ = nullptr;
+		code_size_ = 0;
+		code_used_ = 0;
+
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+		void *memory = VirtualAlloc(NULL, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (memory != NULL)
+		{
+			code_ = (unsigned char *)memory;
+			code_size_ = CODE_BUFFER_SIZE;
+		}
+#else
+		void *memory = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory != MAP_FAILED)
+		{
+			code_ = (unsigned char *)memory;
+			code_size_ = CODE_BUFFER_SIZE;
+		}
+#endif
+#endif
+
+		Flush();
+	}
+
+	Jit::~Jit()
+	{
+		Disable();
+	}
+
+	void Jit::Disable()
+	{
+#if CHIP8_JIT_SUPPORTED
+		if (code_ != nullptr)
+		{
+#ifdef _WIN32
+			VirtualFree(code_, 0, MEM_RELEASE);
+#else
+			munmap(code_, code_size_);
+#endif
+		}
+#endif
+		code_ = nullptr;
+		code_size_ = 0;
+
+		// Every block pointed into the buffer, from here on everything goes to the interpreter
+		Flush();
+	}
+
+	bool Jit::IsAvailable()
+	{
+		return code_ != nullptr;
+	}
+
+	const JitBlock &Jit::GetBlock(const unsigned char *memory, unsigned short pc)
+	{
+		pc &= 0xFFF;
+		if (!blocks_[pc].compiled)
+		{
+			Compile(memory, pc);
+		}
+		return blocks_[pc];
+	}
+
+	void Jit::Invalidate(unsigned short address)
+	{
+		// Blocks don't know who overlaps them, so a write into any code starts over from scratch.
+		// ROMs mostly write into data, this only kicks in for self-modifying code.
+		if (code_map_[address & 0xFFF])
+		{
+			Flush();
+		}
+	}
+
+	void Jit::Flush()
+	{
+		for (unsigned int i = 0; i < 4096; i++)
+		{
+			blocks_[i].fn = nullptr;
+			blocks_[i].length = 0;
+			blocks_[i].compiled = false;
+			code_map_[i] = false;
+		}
+		code_used_ = 0;
+	}
+
+	void Jit::Compile(const unsigned char *memory, unsigned short pc)
+	{
+		JitBlock &block = blocks_[pc];
+		block.fn = nullptr;
+		block.length = 0;
+		block.compiled = true;
+
+		if (!IsAvailable())
+		{
+			return;
+		}
+
+		std::vector<unsigned char> code;
+#ifdef _WIN32
+		Emit(code, 0x49, 0x89, 0xCA);	// mov r10, rcx
+		Emit(code, 0x49, 0x89, 0xD3);	// mov r11, rdx
+#else
+		Emit(code, 0x49, 0x89, 0xFA);	// mov r10, rdi
+		Emit(code, 0x49, 0x89, 0xF3);	// mov r11, rsi
+#endif
+
+		unsigned short length = 0;
+		unsigned short address = pc;
+		bool branched = false;
+		while (length < MAX_BLOCK_LENGTH && address < 0xFFF)
+		{
+			Instruction ins = DecodeOpcode(memory[address] << 8 | memory[address + 1]);
+			if (EmitStraight(code, ins))
+			{
+				length++;
+				address += 2;
+			}
+			else
+			{
+				if (EmitBranch(code, ins, address))
+				{
+					length++;
+					address += 2;
+					branched = true;
+				}
+				break;
+			}
+		}
+
+		if (length == 0)
+		{
+			return;
+		}
+
+		if (!branched)
+		{
+			// Hand the instruction we stopped at over to the interpreter
+			EmitReturnPc(code, address);
+		}
+
+		if (!Commit(code, block))
+		{
+			return;
+		}
+		block.length = length;
+
+		for (unsigned short i = pc; i < address; i++)
+		{
+			code_map_[i] = true;
+		}
+	}
+
+	bool Jit::Commit(const std::vector<unsigned char> &code, JitBlock &block)
+	{
+#if CHIP8_JIT_SUPPORTED
+		if (code_used_ + code.size() > code_size_)
+		{
+			// Out of room, start again with an empty buffer
+			Flush();
+			block.compiled = true;
+		}
+
+		unsigned char *start = code_ + code_used_;
+
+		// Only open up the pages this block lands on, the rest keep running as they are
+		size_t page_size = PageSize();
+		size_t first = (size_t)code_used_ / page_size * page_size;
+		size_t last = ((size_t)code_used_ + code.size() + page_size - 1) / page_size * page_size;
+		unsigned char *pages = code_ + first;
+		size_t pages_size = last - first;
+
+#ifdef _WIN32
+		DWORD old_protect;
+		bool writable = VirtualProtect(pages, pages_size, PAGE_READWRITE, &old_protect) != 0;
+		if (writable)
+		{
+			memcpy(start, &code[0], code.size());
+		}
+		if (!writable || !VirtualProtect(pages, pages_size, PAGE_EXECUTE_READ, &old_protect))
+		{
+			Disable();
+			return false;
+		}
+		FlushInstructionCache(GetCurrentProcess(), start, code.size());
+#else
+		bool writable = mprotect(pages, pages_size, PROT_READ | PROT_WRITE) == 0;
+		if (writable)
+		{
+			memcpy(start, &code[0], code.size());
+		}
+		if (!writable || mprotect(pages, pages_size, PROT_READ | PROT_EXEC) != 0)
+		{
+			Disable();
+			return false;
+		}
+#endif
+
+		code_used_ += (unsigned int)code.size();
+		block.fn = (BlockFn)start;
+		return true;
+#else
+		return false;
+#endif
+	}
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef JIT_H
+#define JIT_H
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+#include <vector>
+
+namespace chip8
+{
+	// Native code for one basic block. Runs the block against the V registers and I,
+	// and returns the pc the interpreter should continue from.
+	typedef unsigned short (*BlockFn)(unsigned char *v, unsigned short *i);
+
+	struct JitBlock
+	{
+		BlockFn fn;				// nullptr if the first instruction can't be compiled
+		unsigned short length;	// Number of instructions the block executes
+		bool compiled;
+	};
+
+	// Translates straight-line runs of CHIP-8 instructions into x86-64 code.
+	// A block ends at a jump or skip, which is compiled into the block, or before
+	// any instruction that touches the stack, timers, keys, memory or the screen,
+	// which is left for the interpreter.
+	class Jit
+	{
+	private:
+		unsigned char *code_;
+		unsigned int code_size_;
+		unsigned int code_used_;
+
+		JitBlock blocks_[4096];
+
+		// Set for every byte that is part of a compiled block
+		bool code_map_[4096];
+
+		void Compile(const unsigned char *memory, unsigned short pc);
+		bool Commit(const std::vector<unsigned char> &code, JitBlock &block);
+		// Free the code buffer and drop every block, also used when the OS refuses to flip
+		// the buffer's protection. GetBlock hands everything to the interpreter after this.
+		void Disable();
+	public:
+		Jit();
+		~Jit();
+
+		bool IsAvailable();
+
+		const JitBlock &GetBlock(const unsigned char *memory, unsigned short pc);
+
+		// Throw away every block that covers this address
+		void Invalidate(unsigned short address);
+		void Flush();
+	};
+}
+
+#endif //JIT_H
\ No newline at end of file
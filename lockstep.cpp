@@ -0,0 +1,858 @@
+#include "lockstep.h"
+#include "chip8.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define LOCKSTEP_MIN_GROUP 4	// Smaller groups aren't worth a pass over every block of lanes
+
+namespace chip8
+{
+	namespace
+	{
+		unsigned long long SeedState(unsigned long long seed)
+		{
+			// Same splitmix64 as Chip8::SetSeed(), so a copy gets the numbers a Chip8 would
+			unsigned long long z = seed + 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			z ^= z >> 31;
+			return z != 0 ? z : 0x9E3779B97F4A7C15ull;
+		}
+
+		unsigned int BitCount(unsigned int bits)
+		{
+			unsigned int count = 0;
+			for (; bits != 0; bits &= bits - 1)
+			{
+				count++;
+			}
+			return count;
+		}
+
+#if defined(__AVX2__)
+		// Helpers over one block of LOCKSTEP_LANES copies. Byte registers fill a whole AVX2
+		// register, the 16 bit ones like pc and I take two, the low and high half of the block.
+		// Masks are 0xFF in the lanes they select and 0 in the others.
+		inline __m256i Load(const void *p) { return _mm256_loadu_si256((const __m256i *)p); }
+		inline void Store(void *p, __m256i value) { _mm256_storeu_si256((__m256i *)p, value); }
+		inline __m256i Splat(unsigned char value) { return _mm256_set1_epi8((char)value); }
+		inline __m256i Select(__m256i mask, __m256i a, __m256i b) { return _mm256_blendv_epi8(b, a, mask); }
+		inline __m256i Greater(__m256i a, __m256i b)
+		{
+			// Unsigned, a > b wherever the larger of the two isn't b
+			return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), Splat(0xFF));
+		}
+		inline __m256i Bit(__m256i mask) { return _mm256_and_si256(mask, Splat(1)); }
+		// Bytes of one half block as 16 bit lanes, zero extended for values and sign extended for masks
+		inline __m128i Half(__m256i bytes, int half) { return half ? _mm256_extracti128_si256(bytes, 1) : _mm256_castsi256_si128(bytes); }
+		inline __m256i Widen(__m256i bytes, int half) { return _mm256_cvtepu8_epi16(Half(bytes, half)); }
+		inline __m256i WidenMask(__m256i mask, int half) { return _mm256_cvtepi8_epi16(Half(mask, half)); }
+#endif
+	}
+
+	Lockstep::Lockstep(unsigned int count)
+	{
+		count_ = count > 0 ? count : 1;
+		lanes_ = (count_ + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES * LOCKSTEP_LANES;
+
+		v_.assign(16 * lanes_, 0);
+		i_.assign(lanes_, 0);
+		pc_.assign(lanes_, 0);
+		stack_.assign(16 * lanes_, 0);
+		sp_.assign(lanes_, 0);
+		halted_.assign(lanes_, 0);
+		delay_timer_.assign(lanes_, 0);
+		sound_timer_.assign(lanes_, 0);
+		keys_.assign(lanes_, 0);
+		hires_.assign(lanes_, 0);
+		seed_.assign(lanes_, DEFAULT_RANDOM_SEED);
+		random_state_.assign(lanes_, 0);
+
+		memory_.assign(count_ * 4096, 0);
+		gfx_.assign(count_ * GFX_WORDS, 0);
+		rpl_.assign(count_ * 16, 0);
+
+		active_.assign(lanes_, 0);
+		memset(&active_[0], 0xFF, count_);
+		todo_.assign(lanes_, 0);
+		group_.assign(lanes_, 0);
+		group_bits_.assign(lanes_ / LOCKSTEP_LANES, 0);
+
+		cycles_per_frame_ = DEFAULT_CYCLES_PER_FRAME;
+
+		// Nothing loaded yet, every copy starts from the fonts alone
+		image_.assign(4096, 0);
+		memcpy(&image_[0], chip8_fontset, sizeof(chip8_fontset));
+		memcpy(&image_[BIG_FONT_ADDRESS], schip_fontset, sizeof(schip_fontset));
+		for (unsigned int address = 0; address < 4096; address++)
+		{
+			decode_[address] = DecodeClassicOpcode(image_[address] << 8 | image_[(address + 1) & 0xFFF]);
+		}
+		Init();
+	}
+
+	RomError Lockstep::LoadGame(const std::string &game_name)
+	{
+		std::vector<unsigned char> rom;
+		RomError error = Chip8::ReadRom(game_name, rom);
+		if (error != ROM_OK)
+		{
+			return error;
+		}
+		return LoadGame(rom.empty() ? nullptr : &rom[0], (unsigned int)rom.size());
+	}
+
+	RomError Lockstep::LoadGame(const unsigned char *rom, unsigned int size)
+	{
+		if (size > 4096 - ROM_ADDRESS)
+		{
+			return ROM_TOO_LARGE;
+		}
+
+		memset(&image_[ROM_ADDRESS], 0, 4096 - ROM_ADDRESS);
+		if (size > 0)
+		{
+			memcpy(&image_[ROM_ADDRESS], rom, size);
+		}
+		for (unsigned int address = 0; address < 4096; address++)
+		{
+			decode_[address] = DecodeClassicOpcode(image_[address] << 8 | image_[(address + 1) & 0xFFF]);
+		}
+		Init();
+		return ROM_OK;
+	}
+
+	void Lockstep::Init()
+	{
+		std::fill(v_.begin(), v_.end(), 0);
+		std::fill(i_.begin(), i_.end(), 0);
+		std::fill(pc_.begin(), pc_.end(), 0x200);
+		std::fill(stack_.begin(), stack_.end(), 0);
+		std::fill(sp_.begin(), sp_.end(), 0);
+		std::fill(halted_.begin(), halted_.end(), 0);
+		std::fill(delay_timer_.begin(), delay_timer_.end(), 0);
+		std::fill(sound_timer_.begin(), sound_timer_.end(), 0);
+		std::fill(keys_.begin(), keys_.end(), 0);
+		std::fill(hires_.begin(), hires_.end(), 0);
+		std::fill(gfx_.begin(), gfx_.end(), 0);
+		for (unsigned int copy = 0; copy < count_; copy++)
+		{
+			memcpy(&memory_[copy * 4096], &image_[0], 4096);
+			random_state_[copy] = SeedState(seed_[copy]);
+		}
+
+		memset(written_, 0, sizeof(written_));
+		frame_cycle_ = 0;
+		steps_ = 0;
+		groups_ = 0;
+	}
+
+	unsigned int Lockstep::GetCount()
+	{
+		return count_;
+	}
+
+	void Lockstep::SetCyclesPerFrame(unsigned int cycles)
+	{
+		cycles_per_frame_ = cycles > 0 ? cycles : 1;
+		if (frame_cycle_ >= cycles_per_frame_)
+		{
+			frame_cycle_ = 0;
+		}
+	}
+
+	unsigned int Lockstep::GetCyclesPerFrame()
+	{
+		return cycles_per_frame_;
+	}
+
+	void Lockstep::Run(unsigned int cycles)
+	{
+		for (unsigned int i = 0; i < cycles; i++)
+		{
+			Step();
+		}
+	}
+
+	unsigned int Lockstep::RunFrame()
+	{
+		unsigned int cycles = cycles_per_frame_ - frame_cycle_;
+		Run(cycles);
+		return cycles;
+	}
+
+	void Lockstep::Step()
+	{
+		// Every copy runs one instruction. The copies at the pc of the first one left to run
+		// go as one group, until a group comes out so small that the rest may as well run
+		// one at a time.
+		memcpy(&todo_[0], &active_[0], lanes_);
+		unsigned int first = 0;
+		for (;;)
+		{
+			while (first < count_ && !todo_[first])
+			{
+				first++;
+			}
+			if (first == count_)
+			{
+				break;
+			}
+
+			unsigned short pc = pc_[first];
+			Instruction ins;
+			unsigned int members = SplitGroup(first, pc, FormGroup(pc), ins);
+			groups_++;
+			if (members >= LOCKSTEP_MIN_GROUP && ExecuteGroup(ins, sp_[first]))
+			{
+				continue;
+			}
+
+			for (unsigned int block = first / LOCKSTEP_LANES; block < group_bits_.size(); block++)
+			{
+				unsigned int copy = block * LOCKSTEP_LANES;
+				for (unsigned int bits = group_bits_[block]; bits != 0; bits >>= 1, copy++)
+				{
+					if (bits & 1)
+					{
+						ExecuteCopy(ins, copy);
+					}
+				}
+			}
+			if (members < LOCKSTEP_MIN_GROUP)
+			{
+				// The copies have gone their own ways, finish the step one at a time
+				for (unsigned int copy = first; copy < count_; copy++)
+				{
+					if (todo_[copy])
+					{
+						ExecuteCopy(Decode(copy), copy);
+						groups_++;
+					}
+				}
+				break;
+			}
+		}
+		steps_++;
+
+		if (++frame_cycle_ >= cycles_per_frame_)
+		{
+			// Frame boundary, the timers tick for every copy at once
+			frame_cycle_ = 0;
+			for (unsigned int copy = 0; copy < lanes_; copy++)
+			{
+				delay_timer_[copy] -= delay_timer_[copy] > 0 ? 1 : 0;
+				sound_timer_[copy] -= sound_timer_[copy] > 0 ? 1 : 0;
+			}
+		}
+	}
+
+	inline unsigned char &Lockstep::Register(unsigned int copy, unsigned int index)
+	{
+		return v_[index * lanes_ + copy];
+	}
+
+	Instruction Lockstep::Decode(unsigned int copy)
+	{
+		unsigned short pc = pc_[copy] & 0xFFF;
+		unsigned short next = (pc + 1) & 0xFFF;
+		if (!(written_[pc >> 3] & (1 << (pc & 7))) && !(written_[next >> 3] & (1 << (next & 7))))
+		{
+			return decode_[pc];
+		}
+		const unsigned char *memory = &memory_[copy * 4096];
+		return DecodeClassicOpcode(memory[pc] << 8 | memory[next]);
+	}
+
+	unsigned int Lockstep::FormGroup(unsigned short pc)
+	{
+		// group_ gets the copies left to run that are at pc, and they come off todo_
+		unsigned int members = 0;
+#if defined(__AVX2__)
+		__m256i target = _mm256_set1_epi16((short)pc);
+		for (unsigned int block = 0; block < lanes_; block += LOCKSTEP_LANES)
+		{
+			__m256i low = _mm256_cmpeq_epi16(Load(&pc_[block]), target);
+			__m256i high = _mm256_cmpeq_epi16(Load(&pc_[block + LOCKSTEP_LANES / 2]), target);
+			// Packing works within each 128 bit half, the permute puts the lanes back in order
+			__m256i at_pc = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+			__m256i todo = Load(&todo_[block]);
+			__m256i group = _mm256_and_si256(todo, at_pc);
+			Store(&group_[block], group);
+			Store(&todo_[block], _mm256_andnot_si256(at_pc, todo));
+			group_bits_[block / LOCKSTEP_LANES] = (unsigned int)_mm256_movemask_epi8(group);
+			members += BitCount(group_bits_[block / LOCKSTEP_LANES]);
+		}
+#else
+		const unsigned short *pcs = &pc_[0];
+		unsigned char *todo = &todo_[0];
+		unsigned char *group = &group_[0];
+		for (unsigned int block = 0; block < lanes_; block += LOCKSTEP_LANES)
+		{
+			unsigned int bits = 0;
+			for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++)
+			{
+				unsigned char member = pcs[block + lane] == pc ? todo[block + lane] : 0;
+				group[block + lane] = member;
+				todo[block + lane] &= ~member;
+				bits |= (member & 1u) << lane;
+			}
+			group_bits_[block / LOCKSTEP_LANES] = bits;
+			members += BitCount(bits);
+		}
+#endif
+		return members;
+	}
+
+	unsigned int Lockstep::SplitGroup(unsigned int first, unsigned short pc, unsigned int members, Instruction &ins)
+	{
+		ins = Decode(first);
+		unsigned short address = pc & 0xFFF;
+		unsigned short next = (address + 1) & 0xFFF;
+		if (!(written_[address >> 3] & (1 << (address & 7))) && !(written_[next >> 3] & (1 << (next & 7))))
+		{
+			// Still the ROM's code in every copy
+			return members;
+		}
+
+		// Some copy wrote here, the ones holding different code than the first wait for a group of their own
+		for (unsigned int copy = first + 1; copy < count_; copy++)
+		{
+			const unsigned char *memory = &memory_[copy * 4096];
+			if (group_[copy] && (memory[address] << 8 | memory[next]) != ins.opcode)
+			{
+				group_[copy] = 0;
+				group_bits_[copy / LOCKSTEP_LANES] &= ~(1u << (copy % LOCKSTEP_LANES));
+				todo_[copy] = 0xFF;
+				members--;
+			}
+		}
+		return members;
+	}
+
+	bool Lockstep::ExecuteGroup(const Instruction &ins, unsigned char sp)
+	{
+#if defined(__AVX2__)
+		// The instructions that only touch registers, timers and the pc, everything else
+		// runs copy by copy. When Vx or Vy is VF the order VF is written in matters, those
+		// go copy by copy too.
+		bool writes_vx = false;
+		bool writes_vf = false;
+		switch (ins.op)
+		{
+		case OP_6XKK: case OP_7XKK: case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_FX07:
+			writes_vx = true;
+			break;
+		case OP_8XY4: case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE:
+			if (ins.x == 0xF || ins.y == 0xF)
+			{
+				return false;
+			}
+			writes_vx = true;
+			writes_vf = true;
+			break;
+		case OP_FX1E:
+			if (ins.x == 0xF)
+			{
+				return false;
+			}
+			writes_vf = true;
+			break;
+		case OP_2NNN: case OP_00EE:
+			// Calls and returns only go together when the whole group is at the same depth,
+			// then the stack entry they use is one row. A full or empty stack is left to ExecuteCopy().
+			if (ins.op == OP_2NNN ? sp >= 16 : sp == 0)
+			{
+				return false;
+			}
+			for (unsigned int block = 0; block < lanes_; block += LOCKSTEP_LANES)
+			{
+				__m256i deeper = _mm256_xor_si256(_mm256_cmpeq_epi8(Load(&sp_[block]), Splat(sp)), Splat(0xFF));
+				if (!_mm256_testz_si256(deeper, Load(&group_[block])))
+				{
+					return false;
+				}
+			}
+			break;
+		case OP_1NNN: case OP_BNNN: case OP_3XKK: case OP_4XKK: case OP_5XY0: case OP_9XY0:
+		case OP_ANNN: case OP_FX15: case OP_FX18: case OP_FX29:
+			break;
+		default:
+			return false;
+		}
+
+		unsigned char *vx_row = &v_[ins.x * lanes_];
+		unsigned char *vy_row = &v_[ins.y * lanes_];
+		unsigned char *vf_row = &v_[0xF * lanes_];
+		const __m256i two = Splat(2);
+		const __m256i four = Splat(4);
+		for (unsigned int block = 0; block < lanes_; block += LOCKSTEP_LANES)
+		{
+			__m256i group = Load(&group_[block]);
+			if (_mm256_testz_si256(group, group))
+			{
+				continue;
+			}
+			unsigned short *pc = &pc_[block];
+			unsigned short *i = &i_[block];
+			__m256i vx = Load(vx_row + block);
+			__m256i vy = Load(vy_row + block);
+			__m256i result = vx;
+			__m256i flag = vx;
+			__m256i step = two;
+
+			switch (ins.op)
+			{
+			case OP_6XKK: result = Splat(ins.kk); break;
+			case OP_7XKK: result = _mm256_add_epi8(vx, Splat(ins.kk)); break;
+			case OP_8XY0: result = vy; break;
+			case OP_8XY1: result = _mm256_or_si256(vx, vy); break;
+			case OP_8XY2: result = _mm256_and_si256(vx, vy); break;
+			case OP_8XY3: result = _mm256_xor_si256(vx, vy); break;
+			case OP_8XY4:
+				flag = Bit(Greater(vy, _mm256_xor_si256(vx, Splat(0xFF))));
+				result = _mm256_add_epi8(vx, vy);
+				break;
+			case OP_8XY5:
+				flag = _mm256_andnot_si256(Greater(vy, vx), Splat(1));
+				result = _mm256_sub_epi8(vx, vy);
+				break;
+			case OP_8XY6:
+				flag = Bit(vx);
+				result = _mm256_and_si256(_mm256_srli_epi16(vx, 1), Splat(0x7F));
+				break;
+			case OP_8XY7:
+				flag = Bit(Greater(vy, vx));
+				result = _mm256_sub_epi8(vy, vx);
+				break;
+			case OP_8XYE:
+				flag = Bit(_mm256_cmpgt_epi8(_mm256_setzero_si256(), vx));
+				result = _mm256_add_epi8(vx, vx);
+				break;
+			case OP_2NNN: Store(&sp_[block], Select(group, _mm256_add_epi8(Load(&sp_[block]), Splat(1)), Load(&sp_[block]))); break;
+			case OP_00EE: Store(&sp_[block], Select(group, _mm256_sub_epi8(Load(&sp_[block]), Splat(1)), Load(&sp_[block]))); break;
+			case OP_FX07: result = Load(&delay_timer_[block]); break;
+			case OP_FX15: Store(&delay_timer_[block], Select(group, vx, Load(&delay_timer_[block]))); break;
+			case OP_FX18: Store(&sound_timer_[block], Select(group, vx, Load(&sound_timer_[block]))); break;
+			case OP_3XKK: step = Select(_mm256_cmpeq_epi8(vx, Splat(ins.kk)), four, two); break;
+			case OP_4XKK: step = Select(_mm256_cmpeq_epi8(vx, Splat(ins.kk)), two, four); break;
+			case OP_5XY0: step = Select(_mm256_cmpeq_epi8(vx, vy), four, two); break;
+			case OP_9XY0: step = Select(_mm256_cmpeq_epi8(vx, vy), two, four); break;
+			default: break;
+			}
+
+			// The 16 bit registers, a half block at a time
+			for (int half = 0; half < 2; half++)
+			{
+				unsigned int offset = half * LOCKSTEP_LANES / 2;
+				__m256i mask = WidenMask(group, half);
+				__m256i old_pc = Load(pc + offset);
+				__m256i new_pc;
+				switch (ins.op)
+				{
+				case OP_1NNN:
+					new_pc = _mm256_set1_epi16((short)ins.nnn);
+					break;
+				case OP_BNNN:
+					new_pc = _mm256_add_epi16(_mm256_set1_epi16((short)ins.nnn),
+						Widen(Load(&v_[block]), half));
+					break;
+				case OP_2NNN:
+				{
+					unsigned short *top = &stack_[(sp & 0xF) * lanes_ + block + offset];
+					Store(top, Select(mask, old_pc, Load(top)));
+					new_pc = _mm256_set1_epi16((short)ins.nnn);
+					break;
+				}
+				case OP_00EE:
+					new_pc = _mm256_add_epi16(Load(&stack_[((sp - 1) & 0xF) * lanes_ + block + offset]), _mm256_set1_epi16(2));
+					break;
+				default:
+					new_pc = _mm256_add_epi16(old_pc, Widen(step, half));
+					break;
+				}
+				Store(pc + offset, Select(mask, new_pc, old_pc));
+
+				if (ins.op == OP_ANNN || ins.op == OP_FX29 || ins.op == OP_FX1E)
+				{
+					__m256i old_i = Load(i + offset);
+					__m256i wide_vx = Widen(vx, half);
+					__m256i new_i;
+					if (ins.op == OP_ANNN)
+					{
+						new_i = _mm256_set1_epi16((short)ins.nnn);
+					}
+					else if (ins.op == OP_FX29)
+					{
+						new_i = _mm256_mullo_epi16(wide_vx, _mm256_set1_epi16(5));
+					}
+					else
+					{
+						new_i = _mm256_add_epi16(old_i, wide_vx);
+					}
+					Store(i + offset, Select(mask, new_i, old_i));
+				}
+			}
+
+			if (ins.op == OP_FX1E)
+			{
+				// VF is set when I + Vx goes past 0xFFF, i.e. unless I <= 0xFFF - Vx
+				__m256i limit_low = _mm256_sub_epi16(_mm256_set1_epi16(0xFFF), Widen(vx, 0));
+				__m256i limit_high = _mm256_sub_epi16(_mm256_set1_epi16(0xFFF), Widen(vx, 1));
+				// I has been added to already, take Vx back off to compare what it was
+				__m256i old_low = _mm256_sub_epi16(Load(i), Widen(vx, 0));
+				__m256i old_high = _mm256_sub_epi16(Load(i + LOCKSTEP_LANES / 2), Widen(vx, 1));
+				__m256i fits_low = _mm256_cmpeq_epi16(_mm256_max_epu16(old_low, limit_low), limit_low);
+				__m256i fits_high = _mm256_cmpeq_epi16(_mm256_max_epu16(old_high, limit_high), limit_high);
+				__m256i fits = _mm256_permute4x64_epi64(_mm256_packs_epi16(fits_low, fits_high), 0xD8);
+				flag = _mm256_andnot_si256(fits, Splat(1));
+			}
+
+			if (writes_vf)
+			{
+				Store(vf_row + block, Select(group, flag, Load(vf_row + block)));
+			}
+			if (writes_vx)
+			{
+				Store(vx_row + block, Select(group, result, vx));
+			}
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void Lockstep::StoreByte(unsigned int copy, unsigned short address, unsigned char value)
+	{
+		address &= 0xFFF;
+		memory_[copy * 4096 + address] = value;
+		written_[address >> 3] |= 1 << (address & 7);
+	}
+
+	unsigned char Lockstep::NextRandom(unsigned int copy)
+	{
+		// xorshift64* like Chip8::NextRandom()
+		unsigned long long &state = random_state_[copy];
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return (unsigned char)((state * 0x2545F4914F6CDD1Dull) >> 56);
+	}
+
+	void Lockstep::ExecuteCopy(const Instruction &ins, unsigned int copy)
+	{
+		// One instruction for one copy, the same as the Chip8 handlers with the default quirks
+		unsigned short &pc = pc_[copy];
+		unsigned short &i = i_[copy];
+		unsigned char &vx = Register(copy, ins.x);
+		unsigned char &vy = Register(copy, ins.y);
+		unsigned char &vf = Register(copy, 0xF);
+		unsigned char *memory = &memory_[copy * 4096];
+		unsigned long long *gfx = &gfx_[copy * GFX_WORDS];
+		bool hires = hires_[copy] != 0;
+
+		switch (ins.op)
+		{
+		case OP_00CN:
+		{
+			// Scroll down, half as far in low resolution
+			unsigned int lines = hires ? ins.kk & 0xF : (ins.kk & 0xF) / 2;
+			unsigned int words = hires ? 2 : 1;
+			unsigned int height = hires ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+			for (unsigned int y = height; y-- > 0;)
+			{
+				for (unsigned int w = 0; w < words; w++)
+				{
+					gfx[y * words + w] = y >= lines ? gfx[(y - lines) * words + w] : 0;
+				}
+			}
+			pc += 2;
+			break;
+		}
+		case OP_00E0:
+			memset(gfx, 0, GFX_WORDS * sizeof(gfx[0]));
+			pc += 2;
+			break;
+		case OP_00EE:
+			if (sp_[copy] == 0)
+			{
+				// Stops like Chip8 does
+				halted_[copy] = 1;
+				break;
+			}
+			sp_[copy]--;
+			pc = stack_[(sp_[copy] & 0xF) * lanes_ + copy] + 2;
+			break;
+		case OP_00FB:
+		case OP_00FC:
+		{
+			int pixels = (hires ? 4 : 2) * (ins.op == OP_00FB ? 1 : -1);
+			if (!hires)
+			{
+				for (unsigned int y = 0; y < CHIP8_PIXEL_HEIGHT; y++)
+				{
+					gfx[y] = pixels > 0 ? gfx[y] >> pixels : gfx[y] << -pixels;
+				}
+			}
+			else
+			{
+				for (unsigned int y = 0; y < SCHIP_PIXEL_HEIGHT; y++)
+				{
+					unsigned long long left = gfx[y * 2];
+					unsigned long long right = gfx[y * 2 + 1];
+					gfx[y * 2] = pixels > 0 ? left >> 4 : (left << 4) | (right >> 60);
+					gfx[y * 2 + 1] = pixels > 0 ? (right >> 4) | (left << 60) : right << 4;
+				}
+			}
+			pc += 2;
+			break;
+		}
+		case OP_00FE:
+		case OP_00FF:
+			hires_[copy] = ins.op == OP_00FF ? 1 : 0;
+			memset(gfx, 0, GFX_WORDS * sizeof(gfx[0]));
+			pc += 2;
+			break;
+		case OP_1NNN:
+			pc = ins.nnn;
+			break;
+		case OP_2NNN:
+			if (sp_[copy] >= 16)
+			{
+				halted_[copy] = 1;
+				break;
+			}
+			stack_[(sp_[copy] & 0xF) * lanes_ + copy] = pc;
+			sp_[copy]++;
+			pc = ins.nnn;
+			break;
+		case OP_3XKK: pc += vx == ins.kk ? 4 : 2; break;
+		case OP_4XKK: pc += vx != ins.kk ? 4 : 2; break;
+		case OP_5XY0: pc += vx == vy ? 4 : 2; break;
+		case OP_6XKK: vx = ins.kk; pc += 2; break;
+		case OP_7XKK: vx += ins.kk; pc += 2; break;
+		case OP_8XY0: vx = vy; pc += 2; break;
+		case OP_8XY1: vx |= vy; pc += 2; break;
+		case OP_8XY2: vx &= vy; pc += 2; break;
+		case OP_8XY3: vx ^= vy; pc += 2; break;
+		case OP_8XY4:
+			vf = vy > 0xFF - vx ? 1 : 0;
+			vx += vy;
+			pc += 2;
+			break;
+		case OP_8XY5:
+			vf = vy > vx ? 0 : 1;
+			vx -= vy;
+			pc += 2;
+			break;
+		case OP_8XY6:
+		{
+			unsigned char flag = vx & 0x1;
+			vx >>= 1;
+			vf = flag;
+			pc += 2;
+			break;
+		}
+		case OP_8XY7:
+			vf = vy > vx ? 1 : 0;
+			vx = vy - vx;
+			pc += 2;
+			break;
+		case OP_8XYE:
+		{
+			unsigned char flag = vx >> 7;
+			vx <<= 1;
+			vf = flag;
+			pc += 2;
+			break;
+		}
+		case OP_9XY0: pc += vx != vy ? 4 : 2; break;
+		case OP_ANNN: i = ins.nnn; pc += 2; break;
+		case OP_BNNN: pc = ins.nnn + Register(copy, 0); break;
+		case OP_CXKK: vx = NextRandom(copy) & ins.kk; pc += 2; break;
+		case OP_DXYN:
+		{
+			unsigned int x = vx % (hires ? SCHIP_PIXEL_WIDTH : CHIP8_PIXEL_WIDTH);
+			unsigned int y = vy % (hires ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT);
+			unsigned int height = ins.kk & 0xF;
+			bool wide = height == 0;
+			height = wide ? 16 : height;
+			unsigned long long collisions = 0;
+			for (unsigned int line = 0; line < height; line++)
+			{
+				unsigned long long sprite = wide ?
+					(unsigned long long)(memory[(i + line * 2) & 0xFFF] << 8 | memory[(i + line * 2 + 1) & 0xFFF]) << 48 :
+					(unsigned long long)memory[(i + line) & 0xFFF] << 56;
+				if (!hires)
+				{
+					unsigned long long &row = gfx[(y + line) % CHIP8_PIXEL_HEIGHT];
+					sprite = x == 0 ? sprite : (sprite >> x) | (sprite << (64 - x));
+					collisions |= row & sprite;
+					row ^= sprite;
+				}
+				else
+				{
+					unsigned long long *row = gfx + (y + line) % SCHIP_PIXEL_HEIGHT * 2;
+					unsigned long long &first = row[x >> 6];
+					unsigned long long &second = row[(x >> 6) ^ 1];
+					unsigned long long spill = (x & 63) == 0 ? 0 : sprite << (64 - (x & 63));
+					sprite >>= x & 63;
+					collisions |= (first & sprite) | (second & spill);
+					first ^= sprite;
+					second ^= spill;
+				}
+			}
+			vf = collisions != 0 ? 1 : 0;
+			pc += 2;
+			break;
+		}
+		case OP_EX9E: pc += (keys_[copy] >> (vx & 0xF) & 1) ? 4 : 2; break;
+		case OP_EXA1: pc += (keys_[copy] >> (vx & 0xF) & 1) ? 2 : 4; break;
+		case OP_FX07: vx = delay_timer_[copy]; pc += 2; break;
+		case OP_FX0A:
+			// No key, no progress, the same as Chip8
+			for (unsigned int key = 0; key < 16; key++)
+			{
+				if (keys_[copy] >> key & 1)
+				{
+					vx = key;
+					pc += 2;
+					break;
+				}
+			}
+			break;
+		case OP_FX15: delay_timer_[copy] = vx; pc += 2; break;
+		case OP_FX18: sound_timer_[copy] = vx; pc += 2; break;
+		case OP_FX1E:
+			vf = i + vx > 0xFFF ? 1 : 0;
+			i += vx;
+			pc += 2;
+			break;
+		case OP_FX29: i = vx * 0x5; pc += 2; break;
+		case OP_FX30: i = BIG_FONT_ADDRESS + (vx & 0xF) * 0xA; pc += 2; break;
+		case OP_FX33:
+			StoreByte(copy, i, vx / 100);
+			StoreByte(copy, i + 1, (vx / 10) % 10);
+			StoreByte(copy, i + 2, vx % 10);
+			pc += 2;
+			break;
+		case OP_FX55:
+			for (unsigned int r = 0; r <= ins.x; r++)
+			{
+				StoreByte(copy, i + r, Register(copy, r));
+			}
+			i += ins.x + 1;
+			pc += 2;
+			break;
+		case OP_FX65:
+			for (unsigned int r = 0; r <= ins.x; r++)
+			{
+				Register(copy, r) = memory[(i + r) & 0xFFF];
+			}
+			i += ins.x + 1;
+			pc += 2;
+			break;
+		case OP_FX75:
+			for (unsigned int r = 0; r <= ins.x; r++)
+			{
+				rpl_[copy * 16 + r] = Register(copy, r);
+			}
+			pc += 2;
+			break;
+		case OP_FX85:
+			for (unsigned int r = 0; r <= ins.x; r++)
+			{
+				Register(copy, r) = rpl_[copy * 16 + r];
+			}
+			pc += 2;
+			break;
+		case OP_00FD:
+			halted_[copy] = 1;
+			break;
+		default:
+			// Invalid opcodes leave the pc where it is
+			break;
+		}
+	}
+
+	void Lockstep::SetSeed(unsigned int copy, unsigned long long seed)
+	{
+		seed_[copy] = seed;
+		random_state_[copy] = SeedState(seed);
+	}
+
+	unsigned long long Lockstep::GetSeed(unsigned int copy)
+	{
+		return seed_[copy];
+	}
+
+	void Lockstep::SetKeyState(unsigned int copy, unsigned int key, bool state)
+	{
+		keys_[copy] = (unsigned short)((keys_[copy] & ~(1u << key)) | (state ? 1u << key : 0));
+	}
+
+	bool Lockstep::GetKeyState(unsigned int copy, unsigned int key)
+	{
+		return (keys_[copy] >> key & 1) != 0;
+	}
+
+	unsigned char Lockstep::GetRegister(unsigned int copy, unsigned int index)
+	{
+		return Register(copy, index);
+	}
+
+	unsigned short Lockstep::GetI(unsigned int copy)
+	{
+		return i_[copy];
+	}
+
+	unsigned short Lockstep::GetPc(unsigned int copy)
+	{
+		return pc_[copy];
+	}
+
+	unsigned char Lockstep::GetDelayTimer(unsigned int copy)
+	{
+		return delay_timer_[copy];
+	}
+
+	bool Lockstep::IsHalted(unsigned int copy)
+	{
+		return halted_[copy] != 0;
+	}
+
+	const unsigned char *Lockstep::GetMemory(unsigned int copy)
+	{
+		return &memory_[copy * 4096];
+	}
+
+	unsigned int Lockstep::GetScreenWidth(unsigned int copy)
+	{
+		return hires_[copy] ? SCHIP_PIXEL_WIDTH : CHIP8_PIXEL_WIDTH;
+	}
+
+	unsigned int Lockstep::GetScreenHeight(unsigned int copy)
+	{
+		return hires_[copy] ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+	}
+
+	const unsigned long long *Lockstep::GetGraphics(unsigned int copy)
+	{
+		return &gfx_[copy * GFX_WORDS];
+	}
+
+	unsigned long long Lockstep::GetSteps()
+	{
+		return steps_;
+	}
+
+	unsigned long long Lockstep::GetGroups()
+	{
+		return groups_;
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "chip8.h"
+#include "defines.h"
+#include "opcodes.h"
+#include <string>
+#include <vector>
+
+#define LOCKSTEP_LANES 32	// Copies in one AVX2 register of byte registers
+
+namespace chip8
+{
+	// Runs many copies of one ROM side by side, one instruction each per step. Meant for
+	// searches and fuzzing, where the copies only differ in their keys and random seeds
+	// and spend most of their time at the same pc.
+	//
+	// The state is kept as structure of arrays, register x of every copy next to each
+	// other, so all the copies at one pc run a register, timer, jump or call instruction together,
+	// LOCKSTEP_LANES at a time with AVX2 in builds that have it (-mavx2, /arch:AVX2).
+	// Everything else, and copies that went their own way, run one copy at a time.
+	// Instructions are decoded once for all copies, with the same table as Chip8.
+	//
+	// The copies behave like a Chip8 with the default machine and quirks and idle loop
+	// skipping off, down to the same random numbers for the same seed.
+	class Lockstep
+	{
+	private:
+		unsigned int count_;
+		// count_ rounded up to whole blocks of LOCKSTEP_LANES, the length of every row below.
+		// The copies past count_ are padding and never run.
+		unsigned int lanes_;
+
+		// Rows of lanes_ entries, register r of copy c is v_[r * lanes_ + c]
+		std::vector<unsigned char> v_;
+		std::vector<unsigned short> i_;
+		std::vector<unsigned short> pc_;
+		std::vector<unsigned short> stack_;
+		std::vector<unsigned char> sp_;
+		// Set by 00FD and stack faults, the copy stays on that instruction until Init()
+		std::vector<unsigned char> halted_;
+		std::vector<unsigned char> delay_timer_;
+		std::vector<unsigned char> sound_timer_;
+		// Bit k set while key k is held
+		std::vector<unsigned short> keys_;
+		std::vector<unsigned char> hires_;
+		std::vector<unsigned long long> seed_;
+		std::vector<unsigned long long> random_state_;
+
+		// Per copy, 4K of memory, GFX_WORDS of screen and 16 RPL flags each
+		std::vector<unsigned char> memory_;
+		std::vector<unsigned long long> gfx_;
+		std::vector<unsigned char> rpl_;
+
+		unsigned int cycles_per_frame_;
+		unsigned int frame_cycle_;
+
+		// The fonts and ROM every copy starts from, decoded once for all of them
+		std::vector<unsigned char> image_;
+		Instruction decode_[4096];
+		// One bit per address any copy has written to. Code there may differ between copies
+		// and is checked before a group shares its decode.
+		unsigned char written_[512];
+
+		// 0xFF for every copy, 0 for the padding
+		std::vector<unsigned char> active_;
+		// Copies still to run this step, and the ones running the current instruction
+		std::vector<unsigned char> todo_;
+		std::vector<unsigned char> group_;
+		// group_ again, one bit per copy and a word per block, to find the members quickly
+		std::vector<unsigned int> group_bits_;
+
+		unsigned long long steps_;
+		unsigned long long groups_;
+
+		unsigned char &Register(unsigned int copy, unsigned int index);
+		Instruction Decode(unsigned int copy);
+		unsigned int FormGroup(unsigned short pc);
+		unsigned int SplitGroup(unsigned int first, unsigned short pc, unsigned int members, Instruction &ins);
+		bool ExecuteGroup(const Instruction &ins, unsigned char sp);
+		void ExecuteCopy(const Instruction &ins, unsigned int copy);
+		void StoreByte(unsigned int copy, unsigned short address, unsigned char value);
+		unsigned char NextRandom(unsigned int copy);
+		void Step();
+	public:
+		explicit Lockstep(unsigned int count);
+
+		// Load the ROM into every copy and start them all over. If it can't be read or doesn't
+		// fit in 4K the copies are left alone.
+		RomError LoadGame(const std::string &game_name);
+		RomError LoadGame(const unsigned char *rom, unsigned int size);
+		// Start every copy over from the loaded ROM, each with its own seed
+		void Init();
+		unsigned int GetCount();
+
+		// Instructions per 60Hz frame for every copy, see Chip8::SetCyclesPerFrame()
+		void SetCyclesPerFrame(unsigned int cycles);
+		unsigned int GetCyclesPerFrame();
+		// Run cycles instructions on every copy
+		void Run(unsigned int cycles);
+		// Run every copy to the end of the current frame, returns the instructions each ran
+		unsigned int RunFrame();
+
+		// Per copy, like the Chip8 calls of the same name
+		void SetSeed(unsigned int copy, unsigned long long seed);
+		unsigned long long GetSeed(unsigned int copy);
+		void SetKeyState(unsigned int copy, unsigned int key, bool state);
+		bool GetKeyState(unsigned int copy, unsigned int key);
+		unsigned char GetRegister(unsigned int copy, unsigned int index);
+		unsigned short GetI(unsigned int copy);
+		unsigned short GetPc(unsigned int copy);
+		unsigned char GetDelayTimer(unsigned int copy);
+		bool IsHalted(unsigned int copy);
+		const unsigned char *GetMemory(unsigned int copy);
+		unsigned int GetScreenWidth(unsigned int copy);
+		unsigned int GetScreenHeight(unsigned int copy);
+		const unsigned long long *GetGraphics(unsigned int copy);
+
+		// Steps run since Init(), and the groups of copies at one pc they ran. A ratio close
+		// to 1 means the copies are running in lockstep.
+		unsigned long long GetSteps();
+		unsigned long long GetGroups();
+	};
+}
+
+#endif //LOCKSTEP_H
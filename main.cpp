@@ -2,19 +2,32 @@
 #include "defines.h"
 #include "pixel_renderer.h"
 #include "chip8.h"
+#include "profile.h"
+#include "replay.h"
+#include "rewind.h"
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
 
 using namespace chip8;
 
-#define FPS 720
+#define FAST_MODE_FRAMES 50	// Frames to run per loop while in fast mode
+#define REWIND_BUFFER_BYTES (8 * 1024 * 1024)	// Over an hour of history for most games
 
 Chip8 *engine;
 PixelRenderer *renderer;
+Rewind *history;
+InputRecorder *recorder;
 sf::RenderWindow *window;
 
 void Init()
 {
 	engine = new Chip8();
+	engine->SetSeed((unsigned long long)time(NULL));
 	renderer = new PixelRenderer();
+	history = new Rewind(REWIND_BUFFER_BYTES);
+	recorder = new InputRecorder();
 }
 
 void UpdateKeyStates()
@@ -39,6 +52,37 @@ void UpdateKeyStates()
 	engine->SetKeyState(0xB, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::C));
 	engine->SetKeyState(0xF, sf::Keyboard::isKeyPressed(sf::Keyboard::Key::V));
 
+	recorder->Keys(engine);
+}
+
+// SuperChip games keep high scores in the RPL flags, which the calculator never forgets.
+// They're kept next to the ROM from one run to the next.
+void LoadRplFlags(const std::string &file_name)
+{
+	unsigned char flags[16];
+	std::ifstream input(file_name, std::ios::binary);
+	if (input && input.read((char *)flags, sizeof(flags)))
+	{
+		engine->SetRplFlags(flags);
+	}
+}
+
+void SaveRplFlags(const std::string &file_name)
+{
+	static const unsigned char cleared[16] = { 0 };
+	std::ifstream existing(file_name, std::ios::binary);
+	if (!existing && memcmp(engine->GetRplFlags(), cleared, sizeof(cleared)) == 0)
+	{
+		// Nothing worth keeping, don't leave a file behind for every ROM
+		return;
+	}
+	existing.close();
+
+	std::ofstream output(file_name, std::ios::binary);
+	if (!output || !output.write((const char *)engine->GetRplFlags(), 16))
+	{
+		std::cout << "Error: could not write " << file_name << std::endl;
+	}
 }
 
 void Cleanup()
@@ -47,6 +91,10 @@ void Cleanup()
 	window = nullptr;
 	delete renderer;
 	renderer = nullptr;
+	delete history;
+	history = nullptr;
+	delete recorder;
+	recorder = nullptr;
 	delete engine;
 	engine = nullptr;
 }
@@ -56,6 +104,11 @@ int main(int argc, char** argv)
 	bool step_mode = false;
 	bool step = false;
 	bool fast_mode = false;
+	std::string profile_file;
+	std::string trace_file;
+	std::string record_file;
+	std::string rpl_file;
+	std::string quirks_name;
 
 	Init();
 
@@ -66,13 +119,80 @@ int main(int argc, char** argv)
 	else
 	{
 		std::string filename = std::string(argv[1]);
+
+		for (int i = 2; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--xo")
+			{
+				// Interpreter only, --jit has no effect with it
+				engine->SetMachine(MACHINE_XOCHIP);
+			}
+			else if (arg == "--quirks" && i + 1 < argc)
+			{
+				// Applied after --xo, which picks XO-CHIP's own. Anything but default is interpreter only.
+				quirks_name = argv[++i];
+			}
+			else if (arg == "--jit")
+			{
+				if (!engine->SetEngine(ENGINE_JIT))
+				{
+					std::cout << "JIT not available, using the interpreter" << std::endl;
+				}
+			}
+			else if (arg == "--profile" && i + 1 < argc)
+			{
+				profile_file = argv[++i];
+				if (!engine->SetProfiling(true))
+				{
+					std::cout << "Profiling not available, build with CHIP8_PROFILE defined" << std::endl;
+					profile_file.clear();
+				}
+			}
+			else if (arg == "--trace" && i + 1 < argc)
+			{
+				trace_file = argv[++i];
+			}
+			else if (arg == "--record" && i + 1 < argc)
+			{
+				record_file = argv[++i];
+			}
+		}
+
+		QuirkProfile quirks;
+		if (!quirks_name.empty())
+		{
+			if (Chip8::ParseQuirks(quirks_name, quirks))
+			{
+				engine->SetQuirks(quirks);
+			}
+			else
+			{
+				std::cout << "Unknown quirk profile " << quirks_name << ", use default, cosmac, schip or xochip" << std::endl;
+			}
+		}
+
 		engine->LoadGame(filename);
+		rpl_file = filename + ".rpl";
+		LoadRplFlags(rpl_file);
+	}
+
+	// Started once every option is in, so the trace begins with the first instruction
+	if (!trace_file.empty() && !engine->StartTrace(trace_file))
+	{
+		std::cout << "Error: could not create " << trace_file << std::endl;
+		trace_file.clear();
+	}
+	if (!record_file.empty() && !recorder->Open(record_file, engine))
+	{
+		std::cout << "Error: could not create " << record_file << std::endl;
+		record_file.clear();
 	}
 
 	window = new sf::RenderWindow(sf::VideoMode(SCREEN_WIDTH, SCREEN_HEIGHT), "CHIP8");
-	window->setFramerateLimit(FPS);
+	window->setFramerateLimit(FRAMES_PER_SECOND);
 
-	static float refresh_speed = 1.0 / FPS;
+	static float refresh_speed = 1.0 / FRAMES_PER_SECOND;
 	sf::Clock clock;
 
 	while (window->isOpen())
@@ -109,7 +229,29 @@ int main(int argc, char** argv)
 		{
 			UpdateKeyStates();
 
-			engine->Cycle();
+			if (step_mode)
+			{
+				engine->Cycle();
+				recorder->Advance(1);
+			}
+			else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Key::B))
+			{
+				// Hold B to play the recorded frames backwards
+				if (history->StepBack(engine))
+				{
+					recorder->State(engine);
+				}
+			}
+			else
+			{
+				// Timers tick per emulated frame, so running more frames per loop speeds the whole game up evenly
+				unsigned int frames = fast_mode ? FAST_MODE_FRAMES : 1;
+				for (unsigned int i = 0; i < frames; i++)
+				{
+					recorder->Advance(engine->RunFrame());
+					history->Record(engine);
+				}
+			}
 
 			// Update
 			bool need_redraw = engine->GetNeedRedraw();
@@ -117,12 +259,20 @@ int main(int argc, char** argv)
 			{
 				window->clear();
 				auto pixels = engine->GetGraphics();
-				renderer->SetPixels(pixels);
+				renderer->SetPixels(pixels, engine->GetScreenWidth(), engine->GetScreenHeight(), engine->GetDirtyRows(),
+					engine->GetMachine() == MACHINE_XOCHIP ? engine->GetGraphics(1) : nullptr);
+				engine->ClearDirtyRows();
 				renderer->Render(window);
 				window->display();
 				engine->SetNeedRedraw(false);
 			}
 			clock.restart();
+
+			if (engine->IsHalted())
+			{
+				// 00FD, the program asked to quit, or it broke its stack
+				window->close();
+			}
 			if (step_mode)
 			{
 				step = false;
@@ -131,8 +281,30 @@ int main(int argc, char** argv)
 
 		if (!step_mode && !fast_mode)
 		{
-			sf::sleep(sf::milliseconds(1000 / FPS));
+			sf::sleep(sf::milliseconds(1));
+		}
+	}
+
+	if (!profile_file.empty())
+	{
+		if (WriteProfile(*engine->GetProfile(), profile_file))
+		{
+			std::cout << "Profile written to " << profile_file << std::endl;
 		}
+		else
+		{
+			std::cout << "Error: could not write " << profile_file << std::endl;
+		}
+	}
+
+	SaveRplFlags(rpl_file);
+	if (!record_file.empty() && !recorder->Close())
+	{
+		std::cout << "Error: could not write all of " << record_file << std::endl;
+	}
+	if (!trace_file.empty() && !engine->StopTrace())
+	{
+		std::cout << "Error: could not write all of " << trace_file << std::endl;
 	}
 
 	Cleanup();
@@ -0,0 +1,122 @@
+#include "opcodes.h"
+
+namespace chip8
+{
+	namespace
+	{
+		// Work out the OpId of an opcode the slow way, only used to fill the table below
+		unsigned char Classify(unsigned short opcode)
+		{
+			switch (opcode & 0xF000)
+			{
+			case 0x0000:
+				if ((opcode & 0x00F0) == 0x00C0) return OP_00CN;
+				if ((opcode & 0x00F0) == 0x00D0) return OP_00DN;
+
+				switch (opcode & 0x00FF)
+				{
+				case 0x00E0: return OP_00E0;
+				case 0x00EE: return OP_00EE;
+				case 0x00FB: return OP_00FB;
+				case 0x00FC: return OP_00FC;
+				case 0x00FD: return OP_00FD;
+				case 0x00FE: return OP_00FE;
+				case 0x00FF: return OP_00FF;
+				default: return OP_INVALID;
+				}
+			case 0x1000: return OP_1NNN;
+			case 0x2000: return OP_2NNN;
+			case 0x3000: return OP_3XKK;
+			case 0x4000: return OP_4XKK;
+			case 0x5000:
+				switch (opcode & 0x000F)
+				{
+				case 0x0002: return OP_5XY2;
+				case 0x0003: return OP_5XY3;
+				default: return OP_5XY0;
+				}
+			case 0x6000: return OP_6XKK;
+			case 0x7000: return OP_7XKK;
+			case 0x8000:
+				switch (opcode & 0x000F)
+				{
+				case 0x0000: return OP_8XY0;
+				case 0x0001: return OP_8XY1;
+				case 0x0002: return OP_8XY2;
+				case 0x0003: return OP_8XY3;
+				case 0x0004: return OP_8XY4;
+				case 0x0005: return OP_8XY5;
+				case 0x0006: return OP_8XY6;
+				case 0x0007: return OP_8XY7;
+				case 0x000E: return OP_8XYE;
+				default: return OP_INVALID;
+				}
+			case 0x9000: return OP_9XY0;
+			case 0xA000: return OP_ANNN;
+			case 0xB000: return OP_BNNN;
+			case 0xC000: return OP_CXKK;
+			case 0xD000: return OP_DXYN;
+			case 0xE000:
+				switch (opcode & 0x00FF)
+				{
+				case 0x009E: return OP_EX9E;
+				case 0x00A1: return OP_EXA1;
+				default: return OP_INVALID;
+				}
+			case 0xF000:
+				switch (opcode & 0x00FF)
+				{
+				case 0x0000: return opcode == 0xF000 ? OP_F000 : OP_INVALID;
+				case 0x0001: return OP_FN01;
+				case 0x0002: return opcode == 0xF002 ? OP_F002 : OP_INVALID;
+				case 0x0007: return OP_FX07;
+				case 0x000A: return OP_FX0A;
+				case 0x0015: return OP_FX15;
+				case 0x0018: return OP_FX18;
+				case 0x001E: return OP_FX1E;
+				case 0x0029: return OP_FX29;
+				case 0x0030: return OP_FX30;
+				case 0x0033: return OP_FX33;
+				case 0x003A: return OP_FX3A;
+				case 0x0055: return OP_FX55;
+				case 0x0065: return OP_FX65;
+				case 0x0075: return OP_FX75;
+				case 0x0085: return OP_FX85;
+				default: return OP_INVALID;
+				}
+			default:
+				return OP_INVALID;
+			}
+		}
+	}
+
+	const char *const op_names[OP_COUNT] = {
+		"INVALID",
+		"00CN", "00E0", "00EE", "00FB", "00FC", "00FD", "00FE", "00FF",
+		"1NNN", "2NNN", "3XKK", "4XKK", "5XY0", "6XKK", "7XKK",
+		"8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+		"9XY0", "ANNN", "BNNN", "CXKK", "DXYN", "EX9E", "EXA1",
+		"FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30", "FX33", "FX55", "FX65", "FX75", "FX85",
+		"00DN", "5XY2", "5XY3", "F000", "FN01", "F002", "FX3A",
+		"UNDECODED"
+	};
+
+	// Filled in by the initializer below before main runs
+	unsigned char op_ids[0x10000];
+
+	namespace
+	{
+		struct OpIdsInitializer
+		{
+			OpIdsInitializer()
+			{
+				for (unsigned int i = 0; i < 0x10000; i++)
+				{
+					op_ids[i] = Classify((unsigned short)i);
+				}
+			}
+		};
+
+		const OpIdsInitializer op_ids_initializer;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+namespace chip8
+{
+	// Every instruction the core knows about. The values index the handler tables,
+	// so OP_COUNT must stay last.
+	enum OpId
+	{
+		OP_INVALID = 0,
+
+		OP_00CN,
+		OP_00E0,
+		OP_00EE,
+		OP_00FB,
+		OP_00FC,
+		OP_00FD,
+		OP_00FE,
+		OP_00FF,
+		OP_1NNN,
+		OP_2NNN,
+		OP_3XKK,
+		OP_4XKK,
+		OP_5XY0,
+		OP_6XKK,
+		OP_7XKK,
+		OP_8XY0,
+		OP_8XY1,
+		OP_8XY2,
+		OP_8XY3,
+		OP_8XY4,
+		OP_8XY5,
+		OP_8XY6,
+		OP_8XY7,
+		OP_8XYE,
+		OP_9XY0,
+		OP_ANNN,
+		OP_BNNN,
+		OP_CXKK,
+		OP_DXYN,
+		OP_EX9E,
+		OP_EXA1,
+		OP_FX07,
+		OP_FX0A,
+		OP_FX15,
+		OP_FX18,
+		OP_FX1E,
+		OP_FX29,
+		OP_FX30,
+		OP_FX33,
+		OP_FX55,
+		OP_FX65,
+		OP_FX75,
+		OP_FX85,
+
+		// XO-CHIP only, Chip8::Fetch() turns them back into what they were before for the other machines
+		OP_00DN,
+		OP_5XY2,
+		OP_5XY3,
+		OP_F000,
+		OP_FN01,
+		OP_F002,
+		OP_FX3A,
+
+		// Not an opcode, marks an empty slot in the decode cache
+		OP_UNDECODED,
+
+		OP_COUNT
+	};
+
+	// An opcode split into its fields so handlers don't have to mask them out again
+	struct Instruction
+	{
+		unsigned char op;		// OpId
+		unsigned char x;		// 0x?X??
+		unsigned char y;		// 0x??Y?
+		unsigned char kk;		// 0x??KK, N is the low nibble of this
+		unsigned short nnn;		// 0x?NNN
+		unsigned short opcode;	// The raw opcode
+	};
+
+	// OpId of every possible opcode, filled in once at startup
+	extern unsigned char op_ids[0x10000];
+
+	// Printable name of every OpId, like "DXYN"
+	extern const char *const op_names[OP_COUNT];
+
+	inline unsigned char ClassifyOpcode(unsigned short opcode)
+	{
+		return op_ids[opcode];
+	}
+
+	inline Instruction DecodeOpcode(unsigned short opcode)
+	{
+		Instruction ins;
+		ins.op = op_ids[opcode];
+		ins.x = (opcode & 0x0F00) >> 8;
+		ins.y = (opcode & 0x00F0) >> 4;
+		ins.kk = opcode & 0x00FF;
+		ins.nnn = opcode & 0x0FFF;
+		ins.opcode = opcode;
+		return ins;
+	}
+
+	// DecodeOpcode() for the machines without XO-CHIP's instructions. They mean nothing there,
+	// except that 5XY2 and 5XY3 always ran as 5XY0.
+	inline Instruction DecodeClassicOpcode(unsigned short opcode)
+	{
+		Instruction ins = DecodeOpcode(opcode);
+		if (ins.op >= OP_00DN && ins.op < OP_UNDECODED)
+		{
+			ins.op = ins.op == OP_5XY2 || ins.op == OP_5XY3 ? OP_5XY0 : OP_INVALID;
+		}
+		return ins;
+	}
+}
+
+#endif //OPCODES_H
\ No newline at end of file
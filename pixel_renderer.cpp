@@ -1,21 +1,79 @@
 #include "pixel_renderer.h"
+#include "chip8.h"
 #include <SFML/Graphics.hpp>
+#include <cstring>
 
 namespace chip8
 {
-	PixelRenderer::PixelRenderer()
+	namespace
 	{
+		// Built from bytes so the words come out as RGBA in memory whatever the byte order
+		unsigned int MakeTexel(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+		{
+			unsigned char bytes[4] = { r, g, b, a };
+			unsigned int texel;
+			memcpy(&texel, bytes, 4);
+			return texel;
+		}
+
+		// Indexed by a pixel's bit in the first plane plus twice its bit in the second:
+		// off, first plane only, second plane only, both
+		const unsigned char palette[4][3] = {
+			{ 0x00, 0x00, 0x00 },
+			{ 0xFF, 0xFF, 0xFF },
+			{ 0xFF, 0x66, 0x00 },
+			{ 0x99, 0x99, 0x99 }
+		};
+
+		// Stands in for the second plane of machines that only have one
+		const unsigned long long blank_plane[GFX_WORDS] = { 0 };
+	}
+
+	PixelRenderer::PixelRenderer(RenderMode mode)
+	{
+		mode_ = mode;
+		stale_ = true;
+		width_ = CHIP8_PIXEL_WIDTH;
+		height_ = CHIP8_PIXEL_HEIGHT;
+
+		for (int i = 0; i < PIXEL_COUNT; i++)
+		{
+			pixel_map_[i] = 0;
+		}
 		PopulateRects();
+
+		unsigned int off = MakeTexel(0, 0, 0, 0xFF);
+		for (int i = 0; i < PIXEL_COUNT; i++)
+		{
+			texels_[i] = off;
+		}
+		// Big enough for either resolution, the sprite only shows the part in use
+		texture_ = new sf::Texture();
+		texture_->create(SCHIP_PIXEL_WIDTH, SCHIP_PIXEL_HEIGHT);
+		texture_->update((const sf::Uint8 *)texels_);
+		sprite_ = new sf::Sprite(*texture_);
+		sprite_->setTextureRect(sf::IntRect(0, 0, width_, height_));
+		sprite_->setScale(PIXEL_SCALE, PIXEL_SCALE);
 	}
 
 	PixelRenderer::~PixelRenderer()
 	{
 		ClearRects();
+		delete sprite_;
+		sprite_ = nullptr;
+		delete texture_;
+		texture_ = nullptr;
 	}
 
 	void PixelRenderer::Render(sf::RenderWindow *window)
 	{
-		for (int i = 0; i < PIXEL_COUNT; i++)
+		if (mode_ == RENDER_TEXTURE)
+		{
+			window->draw(*sprite_);
+			return;
+		}
+
+		for (unsigned int i = 0; i < width_ * height_; i++)
 		{
 			if (this->pixel_map_[i])
 			{
@@ -31,30 +89,116 @@ namespace chip8
 
 	void PixelRenderer::PopulateRects()
 	{
-		int xpos, ypos;
-		ypos = 0;
-		for (int y = 0; y < CHIP8_PIXEL_HEIGHT; y++)
+		float scale = (float)SCREEN_WIDTH / width_;
+		for (unsigned int y = 0; y < height_; y++)
 		{
-			xpos = 0;
-			for (int x = 0; x < CHIP8_PIXEL_WIDTH; x++)
+			for (unsigned int x = 0; x < width_; x++)
 			{
-				sf::RectangleShape rect_shape(sf::Vector2f(PIXEL_SCALE, PIXEL_SCALE));
-				rect_shape.setPosition(xpos, ypos);
+				sf::RectangleShape rect_shape(sf::Vector2f(scale, scale));
+				rect_shape.setPosition(x * scale, y * scale);
 				rects_.push_back(rect_shape);
-				xpos += PIXEL_SCALE;
 			}
-			ypos += PIXEL_SCALE;
 		}
 	}
 
-	void PixelRenderer::SetPixels(const unsigned char *new_pixels)
+	void PixelRenderer::SetPixels(const unsigned long long *new_rows, unsigned int width, unsigned int height,
+		unsigned long long dirty_rows, const unsigned long long *second_plane)
 	{
-		if (new_pixels)
+		if (!new_rows)
+		{
+			return;
+		}
+		if (!second_plane)
+		{
+			second_plane = blank_plane;
+		}
+
+		if (width != width_ || height != height_)
 		{
-			for (int i = 0; i < PIXEL_COUNT; i++)
+			width_ = width;
+			height_ = height;
+			sprite_->setTextureRect(sf::IntRect(0, 0, width_, height_));
+			sprite_->setScale((float)SCREEN_WIDTH / width_, (float)SCREEN_HEIGHT / height_);
+			ClearRects();
+			PopulateRects();
+			stale_ = true;
+		}
+
+		if (stale_)
+		{
+			dirty_rows = ALL_ROWS_DIRTY;
+			stale_ = false;
+		}
+		dirty_rows &= height_ < 64 ? (1ull << height_) - 1 : ~0ull;
+		if (dirty_rows == 0)
+		{
+			return;
+		}
+
+		unsigned int words = width_ / 64;
+		if (mode_ == RENDER_RECTANGLES)
+		{
+			for (unsigned int y = 0; y < height_; y++)
 			{
-				this->pixel_map_[i] = new_pixels[i];
+				if ((dirty_rows >> y) & 1)
+				{
+					unsigned char *pixel = pixel_map_ + y * width_;
+					for (unsigned int x = 0; x < width_; x++)
+					{
+						unsigned int word = y * words + (x >> 6);
+						unsigned char color = ((new_rows[word] >> (63 - (x & 63))) & 0x1) |
+							((second_plane[word] >> (63 - (x & 63))) & 0x1) << 1;
+						if (color != 0)
+						{
+							rects_[y * width_ + x].setFillColor(sf::Color(palette[color][0], palette[color][1], palette[color][2]));
+						}
+						pixel[x] = color;
+					}
+				}
 			}
+			return;
+		}
+
+		// Straight from the packed rows to texels, then one upload covering the changed rows
+		unsigned int colors[4];
+		for (unsigned int c = 0; c < 4; c++)
+		{
+			colors[c] = MakeTexel(palette[c][0], palette[c][1], palette[c][2], 0xFF);
 		}
+		int first = -1;
+		int last = -1;
+		for (unsigned int y = 0; y < height_; y++)
+		{
+			if ((dirty_rows >> y) & 1)
+			{
+				unsigned int *texel = texels_ + y * width_;
+				for (unsigned int w = 0; w < words; w++)
+				{
+					unsigned long long row = new_rows[y * words + w];
+					unsigned long long row2 = second_plane[y * words + w];
+					for (int x = 63; x >= 0; x--)
+					{
+						*texel++ = colors[((row >> x) & 1) | ((row2 >> x) & 1) << 1];
+					}
+				}
+				first = first < 0 ? (int)y : first;
+				last = (int)y;
+			}
+		}
+		texture_->update((const sf::Uint8 *)(texels_ + first * width_), width_, last - first + 1, 0, first);
+	}
+
+	void PixelRenderer::SetMode(RenderMode mode)
+	{
+		if (mode != mode_)
+		{
+			mode_ = mode;
+			stale_ = true;
+		}
+	}
+
+	RenderMode PixelRenderer::GetMode()
+	{
+		return mode_;
 	}
 }
@@ -8,25 +8,54 @@ namespace sf
 {
 	class RenderWindow;
 	class RectangleShape;
+	class Texture;
+	class Sprite;
 }
 
 namespace chip8
 {
+	// How PixelRenderer gets the screen onto the window
+	enum RenderMode
+	{
+		RENDER_TEXTURE,		// Expand the rows into a texture the size of the screen and draw it scaled up in one call
+		RENDER_RECTANGLES	// One rectangle and one draw call per lit pixel, kept to compare against
+	};
+
 	class PixelRenderer
 	{
 	private:
+		RenderMode mode_;
+		// Set when the buffers of the current mode are out of date as a whole, after switching
+		// modes or resolutions
+		bool stale_;
+		unsigned int width_;
+		unsigned int height_;
+
 		unsigned char pixel_map_[PIXEL_COUNT];
 		std::vector<sf::RectangleShape> rects_;
 
+		// RGBA, one word per pixel
+		unsigned int texels_[PIXEL_COUNT];
+		sf::Texture *texture_;
+		sf::Sprite *sprite_;
+
 		void ClearRects();
 		void PopulateRects();
 	public:
-		PixelRenderer();
+		explicit PixelRenderer(RenderMode mode = RENDER_TEXTURE);
 		~PixelRenderer();
 
 		void Render(sf::RenderWindow *window);
-		void SetPixels(const unsigned char *new_pixels);
+		// new_rows holds height rows of width pixels, packed like Chip8::GetGraphics().
+		// Only the rows set in dirty_rows are copied, see Chip8::GetDirtyRows().
+		// An XO-CHIP's second plane goes in second_plane, each pixel then gets one of four
+		// colors from its bits in both.
+		void SetPixels(const unsigned long long *new_rows, unsigned int width, unsigned int height,
+			unsigned long long dirty_rows = ALL_ROWS_DIRTY, const unsigned long long *second_plane = nullptr);
+
+		void SetMode(RenderMode mode);
+		RenderMode GetMode();
 	};
 }
 
-#endif //PIXEL_RENDERER_H
\ No newline at end of file
+#endif //PIXEL_RENDERER_H
@@ -0,0 +1,135 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace chip8
+{
+	namespace
+	{
+		struct PcCount
+		{
+			unsigned short pc;
+			unsigned long long count;
+
+			bool operator<(const PcCount &other) const
+			{
+				return count != other.count ? count > other.count : pc < other.pc;
+			}
+		};
+
+		// Addresses that ran at all, busiest first
+		std::vector<PcCount> HotSpots(const Profile &profile)
+		{
+			std::vector<PcCount> spots;
+			for (unsigned int pc = 0; pc < 4096; pc++)
+			{
+				if (profile.pc_counts[pc] != 0)
+				{
+					PcCount spot = { (unsigned short)pc, profile.pc_counts[pc] };
+					spots.push_back(spot);
+				}
+			}
+			std::sort(spots.begin(), spots.end());
+			return spots;
+		}
+
+		double CollisionRate(const Profile &profile)
+		{
+			return profile.draws != 0 ? (double)profile.draw_collisions / profile.draws : 0.0;
+		}
+
+		double FrameMean(const Profile &profile)
+		{
+			return profile.frames != 0 ? (double)profile.instructions / profile.frames : 0.0;
+		}
+
+		void WriteJson(const Profile &profile, FILE *out)
+		{
+			fprintf(out, "{\n");
+			fprintf(out, "  \"instructions\": %llu,\n", profile.instructions);
+			fprintf(out, "  \"idle_cycles\": %llu,\n", profile.idle_cycles);
+			fprintf(out, "  \"frames\": %llu,\n", profile.frames);
+			fprintf(out, "  \"frame_instructions\": { \"min\": %llu, \"max\": %llu, \"mean\": %.3f },\n",
+				profile.frames != 0 ? profile.frame_min : 0, profile.frame_max, FrameMean(profile));
+			fprintf(out, "  \"draws\": %llu,\n", profile.draws);
+			fprintf(out, "  \"draw_collisions\": %llu,\n", profile.draw_collisions);
+			fprintf(out, "  \"collision_rate\": %.6f,\n", CollisionRate(profile));
+
+			fprintf(out, "  \"opcodes\": {");
+			const char *separator = "\n";
+			for (unsigned int op = 0; op < OP_COUNT; op++)
+			{
+				if (profile.op_counts[op] != 0)
+				{
+					fprintf(out, "%s    \"%s\": %llu", separator, op_names[op], profile.op_counts[op]);
+					separator = ",\n";
+				}
+			}
+			fprintf(out, "\n  },\n");
+
+			fprintf(out, "  \"pcs\": [");
+			std::vector<PcCount> spots = HotSpots(profile);
+			for (size_t i = 0; i < spots.size(); i++)
+			{
+				fprintf(out, "%s\n    { \"pc\": \"0x%03X\", \"count\": %llu }", i == 0 ? "" : ",", spots[i].pc, spots[i].count);
+			}
+			fprintf(out, "\n  ]\n}\n");
+		}
+
+		void WriteCsv(const Profile &profile, FILE *out)
+		{
+			fprintf(out, "section,key,value\n");
+			fprintf(out, "summary,instructions,%llu\n", profile.instructions);
+			fprintf(out, "summary,idle_cycles,%llu\n", profile.idle_cycles);
+			fprintf(out, "summary,frames,%llu\n", profile.frames);
+			fprintf(out, "summary,frame_min,%llu\n", profile.frames != 0 ? profile.frame_min : 0);
+			fprintf(out, "summary,frame_max,%llu\n", profile.frame_max);
+			fprintf(out, "summary,frame_mean,%.3f\n", FrameMean(profile));
+			fprintf(out, "summary,draws,%llu\n", profile.draws);
+			fprintf(out, "summary,draw_collisions,%llu\n", profile.draw_collisions);
+			fprintf(out, "summary,collision_rate,%.6f\n", CollisionRate(profile));
+
+			for (unsigned int op = 0; op < OP_COUNT; op++)
+			{
+				if (profile.op_counts[op] != 0)
+				{
+					fprintf(out, "opcode,%s,%llu\n", op_names[op], profile.op_counts[op]);
+				}
+			}
+
+			std::vector<PcCount> spots = HotSpots(profile);
+			for (size_t i = 0; i < spots.size(); i++)
+			{
+				fprintf(out, "pc,0x%03X,%llu\n", spots[i].pc, spots[i].count);
+			}
+		}
+	}
+
+	void ClearProfile(Profile &profile)
+	{
+		memset(&profile, 0, sizeof(profile));
+		profile.frame_min = ~0ull;
+	}
+
+	bool WriteProfile(const Profile &profile, const std::string &file_name)
+	{
+		FILE *out = fopen(file_name.c_str(), "w");
+		if (out == nullptr)
+		{
+			return false;
+		}
+
+		bool csv = file_name.size() >= 4 && file_name.compare(file_name.size() - 4, 4, ".csv") == 0;
+		if (csv)
+		{
+			WriteCsv(profile, out);
+		}
+		else
+		{
+			WriteJson(profile, out);
+		}
+		return fclose(out) == 0;
+	}
+}
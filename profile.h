@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "opcodes.h"
+#include <string>
+
+namespace chip8
+{
+	// What a ROM spends its time on, collected by Chip8::SetProfiling().
+	//
+	// Counting only happens in builds with CHIP8_PROFILE defined, without it none of
+	// the counting code is compiled in. While profiling everything runs through the
+	// interpreter so each instruction is seen, the results are the same either way.
+	struct Profile
+	{
+		unsigned long long instructions;
+		unsigned long long op_counts[OP_COUNT];
+		unsigned long long pc_counts[4096];
+
+		// Loops skipped as idle, these are not in the counts above
+		unsigned long long idle_cycles;
+
+		unsigned long long draws;
+		unsigned long long draw_collisions;
+
+		// Instructions actually run in each 60Hz frame
+		unsigned long long frames;
+		unsigned long long frame_instructions;	// So far in the current frame
+		unsigned long long frame_min;
+		unsigned long long frame_max;
+	};
+
+	void ClearProfile(Profile &profile);
+
+	// Writes CSV if file_name ends in .csv, JSON otherwise
+	bool WriteProfile(const Profile &profile, const std::string &file_name);
+}
+
+#endif //PROFILE_H
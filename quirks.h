@@ -0,0 +1,52 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+namespace chip8
+{
+	// The instructions interpreters have never agreed on. Each profile is a policy type the
+	// interpreter is compiled for once, so the quirks are settled at compile time and Execute()
+	// doesn't test any flags. Chip8::SetQuirks() picks the instantiation at run time.
+	//
+	//   increment_i     FX55/FX65 leave I pointing after the last register
+	//   add_i_sets_vf   FX1E sets VF when I goes past 0xFFF
+	//   shift_reads_vy  8XY6/8XYE shift Vy into Vx instead of shifting Vx itself
+	//   jump_adds_vx    BXNN jumps to XNN + VX instead of NNN + V0
+
+	// What this emulator has always done
+	struct DefaultQuirks
+	{
+		static const bool increment_i = true;
+		static const bool add_i_sets_vf = true;
+		static const bool shift_reads_vy = false;
+		static const bool jump_adds_vx = false;
+	};
+
+	// The original COSMAC VIP interpreter
+	struct CosmacQuirks
+	{
+		static const bool increment_i = true;
+		static const bool add_i_sets_vf = false;
+		static const bool shift_reads_vy = true;
+		static const bool jump_adds_vx = false;
+	};
+
+	// SuperChip 1.1 on the HP48, which most games written since expect
+	struct SchipQuirks
+	{
+		static const bool increment_i = false;
+		static const bool add_i_sets_vf = false;
+		static const bool shift_reads_vy = false;
+		static const bool jump_adds_vx = true;
+	};
+
+	// XO-CHIP as Octo runs it
+	struct XochipQuirks
+	{
+		static const bool increment_i = true;
+		static const bool add_i_sets_vf = false;
+		static const bool shift_reads_vy = true;
+		static const bool jump_adds_vx = false;
+	};
+}
+
+#endif //QUIRKS_H
@@ -0,0 +1,262 @@
+#include "replay.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#define REPLAY_HEADER_SIZE 6
+
+namespace chip8
+{
+	namespace
+	{
+		unsigned short KeyMask(Chip8 *engine)
+		{
+			unsigned short keys = 0;
+			for (unsigned int key = 0; key < 16; key++)
+			{
+				if (engine->GetKeyState(key))
+				{
+					keys |= 1 << key;
+				}
+			}
+			return keys;
+		}
+	}
+
+	InputRecorder::InputRecorder()
+	{
+		file_ = nullptr;
+		failed_ = false;
+		cycles_ = 0;
+		keys_ = 0;
+	}
+
+	InputRecorder::~InputRecorder()
+	{
+		Close();
+	}
+
+	bool InputRecorder::Open(const std::string &file_name, Chip8 *engine)
+	{
+		Close();
+
+		file_ = fopen(file_name.c_str(), "wb");
+		if (file_ == nullptr)
+		{
+			return false;
+		}
+
+		unsigned char header[REPLAY_HEADER_SIZE] = { 'C', '8', 'I', 'N', REPLAY_VERSION & 0xFF, REPLAY_VERSION >> 8 };
+		failed_ = fwrite(header, 1, sizeof(header), file_) != sizeof(header);
+		WriteState(engine);
+		cycles_ = 0;
+		return !failed_;
+	}
+
+	void InputRecorder::WriteEvent(unsigned char type)
+	{
+		unsigned char event[11];
+		unsigned char *out = event;
+		*out++ = type;
+
+		unsigned long long value = cycles_;
+		while (value >= 0x80)
+		{
+			*out++ = (unsigned char)(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = (unsigned char)value;
+
+		if (fwrite(event, 1, out - event, file_) != (size_t)(out - event))
+		{
+			failed_ = true;
+		}
+		cycles_ = 0;
+	}
+
+	void InputRecorder::WriteState(Chip8 *engine)
+	{
+		std::vector<unsigned char> state(engine->GetStateSize());
+		unsigned int size = engine->SaveState(&state[0], (unsigned int)state.size());
+		if (fwrite(&state[0], 1, size, file_) != size)
+		{
+			failed_ = true;
+		}
+		keys_ = KeyMask(engine);
+	}
+
+	void InputRecorder::Keys(Chip8 *engine)
+	{
+		unsigned short keys = KeyMask(engine);
+		if (file_ == nullptr || keys == keys_)
+		{
+			return;
+		}
+
+		WriteEvent(REPLAY_KEYS);
+		unsigned char mask[2] = { (unsigned char)keys, (unsigned char)(keys >> 8) };
+		if (fwrite(mask, 1, sizeof(mask), file_) != sizeof(mask))
+		{
+			failed_ = true;
+		}
+		keys_ = keys;
+	}
+
+	void InputRecorder::Advance(unsigned long long cycles)
+	{
+		cycles_ += cycles;
+	}
+
+	void InputRecorder::State(Chip8 *engine)
+	{
+		if (file_ == nullptr)
+		{
+			return;
+		}
+
+		WriteEvent(REPLAY_STATE);
+		WriteState(engine);
+	}
+
+	bool InputRecorder::Close()
+	{
+		if (file_ == nullptr)
+		{
+			return !failed_;
+		}
+
+		WriteEvent(REPLAY_END);
+		if (fclose(file_) != 0)
+		{
+			failed_ = true;
+		}
+		file_ = nullptr;
+		return !failed_;
+	}
+
+	InputReplay::InputReplay()
+	{
+		position_ = 0;
+		cycles_ = 0;
+		ended_ = false;
+	}
+
+	bool InputReplay::Open(const std::string &file_name)
+	{
+		data_.clear();
+		std::ifstream input(file_name, std::ios::binary);
+		if (!input)
+		{
+			return false;
+		}
+		data_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+
+		size_t position = REPLAY_HEADER_SIZE;
+		if (data_.size() < REPLAY_HEADER_SIZE || memcmp(&data_[0], "C8IN", 4) != 0 ||
+			(data_[4] | data_[5] << 8) != REPLAY_VERSION || !GetState(position, nullptr))
+		{
+			data_.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool InputReplay::Start(Chip8 *engine)
+	{
+		position_ = REPLAY_HEADER_SIZE;
+		cycles_ = 0;
+		ended_ = false;
+		return !data_.empty() && GetState(position_, engine);
+	}
+
+	bool InputReplay::GetState(size_t &position, Chip8 *engine)
+	{
+		// Each snapshot is as long as its header says, which depends on the machine
+		unsigned int available = data_.size() - position > CHIP8_STATE_SIZE ? CHIP8_STATE_SIZE : (unsigned int)(data_.size() - position);
+		unsigned int size = Chip8::GetStateSize(&data_[position], available);
+		if (size == 0 || size > available || (engine && !engine->LoadState(&data_[position], size)))
+		{
+			return false;
+		}
+		position += size;
+		return true;
+	}
+
+	bool InputReplay::GetVarint(unsigned long long &value)
+	{
+		value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7)
+		{
+			if (position_ >= data_.size())
+			{
+				return false;
+			}
+			unsigned char byte = data_[position_++];
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if (byte < 0x80)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool InputReplay::Run(Chip8 *engine)
+	{
+		while (!ended_)
+		{
+			unsigned long long cycles;
+			if (position_ >= data_.size())
+			{
+				return false;
+			}
+			unsigned char type = data_[position_++];
+			if (!GetVarint(cycles))
+			{
+				return false;
+			}
+
+			// Run() stops exactly where it's told to, so the keys land on the same instruction
+			// they did while recording, however the recording was run
+			while (cycles > 0)
+			{
+				unsigned int slice = cycles > 0x40000000 ? 0x40000000 : (unsigned int)cycles;
+				engine->Run(slice);
+				cycles -= slice;
+				cycles_ += slice;
+			}
+
+			switch (type)
+			{
+			case REPLAY_KEYS:
+				if (position_ + 2 > data_.size())
+				{
+					return false;
+				}
+				for (unsigned int key = 0; key < 16; key++)
+				{
+					engine->SetKeyState(key, ((data_[position_] | data_[position_ + 1] << 8) >> key) & 1);
+				}
+				position_ += 2;
+				break;
+			case REPLAY_STATE:
+				if (!GetState(position_, engine))
+				{
+					return false;
+				}
+				break;
+			case REPLAY_END:
+				ended_ = true;
+				break;
+			default:
+				return false;
+			}
+		}
+		return true;
+	}
+
+	unsigned long long InputReplay::GetCycles()
+	{
+		return cycles_;
+	}
+}
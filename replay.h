@@ -0,0 +1,93 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "chip8.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define REPLAY_VERSION 1
+
+namespace chip8
+{
+	// Input recordings, enough to play a session back exactly without a window.
+	//
+	// A recording starts with "C8IN", a u16 version and a snapshot of the machine
+	// when recording began, ROM, random seed and all. After that come events, each
+	// a type byte and a varint of the instructions run since the event before it:
+	//
+	//   REPLAY_KEYS   the keys held changed, u16 with bit k set for key k
+	//   REPLAY_STATE  the machine was put in another state, like when rewinding, a whole snapshot
+	//                 as long as its header says
+	//   REPLAY_END    recording stopped
+	//
+	// Only changes are stored, a few bytes for every key press or release.
+	enum ReplayEvent
+	{
+		REPLAY_KEYS = 1,
+		REPLAY_STATE = 2,
+		REPLAY_END = 3
+	};
+
+	class InputRecorder
+	{
+	private:
+		FILE *file_;
+		bool failed_;
+		unsigned long long cycles_;		// Since the last event
+		unsigned short keys_;
+
+		InputRecorder(const InputRecorder &other);
+		InputRecorder &operator=(const InputRecorder &other);
+
+		void WriteEvent(unsigned char type);
+		void WriteState(Chip8 *engine);
+	public:
+		InputRecorder();
+		~InputRecorder();
+
+		// Start recording engine as it is now
+		bool Open(const std::string &file_name, Chip8 *engine);
+		// Call after setting the keys and before running on, writes them if they changed
+		void Keys(Chip8 *engine);
+		// Call with every instruction count engine->Run() and the like return
+		void Advance(unsigned long long cycles);
+		// Call after loading a state into engine, rewinding included
+		void State(Chip8 *engine);
+		// Returns false if anything failed to write
+		bool Close();
+	};
+
+	class InputReplay
+	{
+	private:
+		std::vector<unsigned char> data_;
+		size_t position_;
+		unsigned long long cycles_;
+		bool ended_;
+
+		InputReplay(const InputReplay &other);
+		InputReplay &operator=(const InputReplay &other);
+
+		bool GetVarint(unsigned long long &value);
+		// Load the snapshot at position into engine and move position past it. With engine
+		// null it only checks that a whole snapshot is there.
+		bool GetState(size_t &position, Chip8 *engine);
+	public:
+		InputReplay();
+
+		// Read a whole recording. Returns false if it isn't a recording of this version.
+		bool Open(const std::string &file_name);
+		// Put engine in the state the recording starts from. The engine and idle skipping stay
+		// as they are, they don't change the outcome.
+		bool Start(Chip8 *engine);
+		// Play the recording to its end as fast as engine goes. Returns false if the recording
+		// turned out to be damaged, engine is left wherever it got to.
+		bool Run(Chip8 *engine);
+
+		// Instructions played since Start()
+		unsigned long long GetCycles();
+	};
+}
+
+#endif //REPLAY_H
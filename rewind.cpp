@@ -0,0 +1,232 @@
+#include "rewind.h"
+#include <cstring>
+
+namespace chip8
+{
+	namespace
+	{
+		void PutVarint(unsigned char *&out, unsigned int value)
+		{
+			while (value >= 0x80)
+			{
+				*out++ = (unsigned char)(value | 0x80);
+				value >>= 7;
+			}
+			*out++ = (unsigned char)value;
+		}
+
+		unsigned int GetVarint(const unsigned char *&in)
+		{
+			unsigned int value = 0;
+			for (unsigned int shift = 0; ; shift += 7)
+			{
+				unsigned char byte = *in++;
+				value |= (unsigned int)(byte & 0x7F) << shift;
+				if (byte < 0x80)
+				{
+					return value;
+				}
+			}
+		}
+
+		bool SameWord(const unsigned char *a, const unsigned char *b)
+		{
+			unsigned long long x, y;
+			memcpy(&x, a, 8);
+			memcpy(&y, b, 8);
+			return x == y;
+		}
+
+		// The bytes covered, then runs of (bytes that didn't change, bytes that did, the XOR of
+		// the ones that did). Most of a state is memory that stays put from frame to frame, so
+		// unchanged bytes are skipped a word at a time.
+		unsigned int EncodeDelta(const unsigned char *from, const unsigned char *to, unsigned int size, unsigned char *out)
+		{
+			unsigned char *start = out;
+			PutVarint(out, size);
+			unsigned int pos = 0;
+			while (pos < size)
+			{
+				unsigned int changed = pos;
+				while (changed + 8 <= size && SameWord(from + changed, to + changed))
+				{
+					changed += 8;
+				}
+				while (changed < size && from[changed] == to[changed])
+				{
+					changed++;
+				}
+
+				// A single unchanged byte costs more to encode as a run than to carry along
+				unsigned int end = changed;
+				while (end < size && (from[end] != to[end] || (end + 1 < size && from[end + 1] != to[end + 1])))
+				{
+					end++;
+				}
+
+				PutVarint(out, changed - pos);
+				PutVarint(out, end - changed);
+				for (unsigned int i = changed; i < end; i++)
+				{
+					*out++ = from[i] ^ to[i];
+				}
+				pos = end;
+			}
+			return (unsigned int)(out - start);
+		}
+
+		void PutLength(unsigned char *out, unsigned int length)
+		{
+			for (unsigned int b = 0; b < REWIND_LENGTH_SIZE; b++)
+			{
+				out[b] = (unsigned char)(length >> (b * 8));
+			}
+		}
+
+		unsigned int GetLength(const unsigned char *in)
+		{
+			unsigned int length = 0;
+			for (unsigned int b = 0; b < REWIND_LENGTH_SIZE; b++)
+			{
+				length |= (unsigned int)in[b] << (b * 8);
+			}
+			return length;
+		}
+
+		void ApplyDelta(const unsigned char *in, unsigned char *state)
+		{
+			unsigned int size = GetVarint(in);
+			unsigned int pos = 0;
+			while (pos < size)
+			{
+				pos += GetVarint(in);
+				unsigned int changed = GetVarint(in);
+				for (unsigned int i = 0; i < changed; i++)
+				{
+					state[pos++] ^= *in++;
+				}
+			}
+		}
+	}
+
+	Rewind::Rewind(unsigned int buffer_bytes)
+		: ring_(buffer_bytes)
+	{
+		Clear();
+	}
+
+	void Rewind::Clear()
+	{
+		current_ = states_[0];
+		next_ = states_[1];
+		current_size_ = 0;
+		head_ = 0;
+		tail_ = 0;
+		used_ = 0;
+		entries_ = 0;
+		has_current_ = false;
+	}
+
+	unsigned int Rewind::GetFrameCount()
+	{
+		return entries_;
+	}
+
+	unsigned int Rewind::GetUsedBytes()
+	{
+		return used_;
+	}
+
+	void Rewind::Write(const unsigned char *data, unsigned int size)
+	{
+		unsigned int capacity = (unsigned int)ring_.size();
+		unsigned int first = capacity - head_ < size ? capacity - head_ : size;
+		memcpy(&ring_[head_], data, first);
+		memcpy(&ring_[0], data + first, size - first);
+		head_ = (head_ + size) % capacity;
+		used_ += size;
+	}
+
+	void Rewind::Read(unsigned int position, unsigned char *data, unsigned int size)
+	{
+		unsigned int capacity = (unsigned int)ring_.size();
+		unsigned int first = capacity - position < size ? capacity - position : size;
+		memcpy(data, &ring_[position], first);
+		memcpy(data + first, &ring_[0], size - first);
+	}
+
+	void Rewind::DropOldest()
+	{
+		unsigned char length[REWIND_LENGTH_SIZE];
+		Read(tail_, length, REWIND_LENGTH_SIZE);
+		unsigned int size = GetLength(length) + 2 * REWIND_LENGTH_SIZE;
+		tail_ = (tail_ + size) % ring_.size();
+		used_ -= size;
+		entries_--;
+	}
+
+	void Rewind::Record(Chip8 *engine)
+	{
+		unsigned int state_size = engine->SaveState(next_, CHIP8_STATE_SIZE);
+		if (!has_current_)
+		{
+			current_ = next_;
+			next_ = current_ == states_[0] ? states_[1] : states_[0];
+			current_size_ = state_size;
+			has_current_ = true;
+			return;
+		}
+
+		// Each entry is the delta back to the previous state with its length on both ends,
+		// so the oldest can be dropped from the tail and the newest popped from the head.
+		// Snapshots change size with the resolution, the delta covers the longer of the two.
+		unsigned int span = state_size > current_size_ ? state_size : current_size_;
+		unsigned int size = EncodeDelta(next_, current_, span, delta_ + REWIND_LENGTH_SIZE);
+		PutLength(delta_, size);
+		PutLength(delta_ + REWIND_LENGTH_SIZE + size, size);
+		size += 2 * REWIND_LENGTH_SIZE;
+
+		if (size <= ring_.size())
+		{
+			while (used_ + size > ring_.size())
+			{
+				DropOldest();
+			}
+			Write(delta_, size);
+			entries_++;
+		}
+		else
+		{
+			// Too small to hold even one frame, all we can do is start over from here
+			head_ = tail_ = used_ = entries_ = 0;
+		}
+
+		unsigned char *previous = current_;
+		current_ = next_;
+		next_ = previous;
+		current_size_ = state_size;
+	}
+
+	bool Rewind::StepBack(Chip8 *engine)
+	{
+		if (entries_ == 0)
+		{
+			return false;
+		}
+
+		unsigned int capacity = (unsigned int)ring_.size();
+		unsigned char length[REWIND_LENGTH_SIZE];
+		Read((head_ + capacity - REWIND_LENGTH_SIZE) % capacity, length, REWIND_LENGTH_SIZE);
+		unsigned int size = GetLength(length) + 2 * REWIND_LENGTH_SIZE;
+		unsigned int start = (head_ + capacity - size) % capacity;
+
+		Read(start, delta_, size);
+		ApplyDelta(delta_ + REWIND_LENGTH_SIZE, current_);
+		head_ = start;
+		used_ -= size;
+		entries_--;
+
+		current_size_ = Chip8::GetStateSize(current_, CHIP8_STATE_SIZE);
+		return engine->LoadState(current_, current_size_);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "chip8.h"
+#include <vector>
+
+// Bytes of the length at each end of a ring entry
+#define REWIND_LENGTH_SIZE 4
+
+namespace chip8
+{
+	// History of machine states for stepping a game backwards, one entry per Record().
+	//
+	// Only the newest state is kept whole. Every older one is stored as the XOR of
+	// itself and the state after it, run-length encoded, which is mostly zeros and
+	// comes to a few dozen bytes a frame. The entries live in a fixed size ring,
+	// recording drops the oldest ones once it's full. Each entry carries its length as
+	// a u32 at both ends, an XO-CHIP delta can be bigger than 64K.
+	class Rewind
+	{
+	private:
+		std::vector<unsigned char> ring_;
+		unsigned int head_;		// Where the next entry gets written
+		unsigned int tail_;		// Start of the oldest entry
+		unsigned int used_;
+		unsigned int entries_;
+
+		// The last recorded state and scratch space for the next one, they swap on every Record()
+		unsigned char states_[2][CHIP8_STATE_SIZE];
+		unsigned char *current_;
+		unsigned char *next_;
+		unsigned int current_size_;
+		bool has_current_;
+
+		// Worst case encoding of one state, plus room for the lengths around it
+		unsigned char delta_[CHIP8_STATE_SIZE * 2 + 2 * REWIND_LENGTH_SIZE + 8];
+
+		Rewind(const Rewind &other);
+		Rewind &operator=(const Rewind &other);
+
+		void Write(const unsigned char *data, unsigned int size);
+		void Read(unsigned int position, unsigned char *data, unsigned int size);
+		void DropOldest();
+	public:
+		// Everything is allocated up front, recording never allocates
+		explicit Rewind(unsigned int buffer_bytes);
+
+		// Remember the state engine is in now
+		void Record(Chip8 *engine);
+		// Put engine back to the state recorded before the last one and forget the last one.
+		// Returns false once there is no older state left.
+		bool StepBack(Chip8 *engine);
+		void Clear();
+
+		// States that StepBack() can still go back to
+		unsigned int GetFrameCount();
+		// Bytes of the ring in use
+		unsigned int GetUsedBytes();
+	};
+}
+
+#endif //REWIND_H
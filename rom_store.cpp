@@ -0,0 +1,55 @@
+#include "rom_store.h"
+
+namespace chip8
+{
+	RomStore::RomStore()
+	{
+	}
+
+	RomError RomStore::Open(const std::string &file_name, RomView &view)
+	{
+		std::map<std::string, std::vector<unsigned char> >::iterator found;
+		bool cached;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			found = roms_.find(file_name);
+			cached = found != roms_.end();
+		}
+
+		if (!cached)
+		{
+			// Read without the lock, so workers missing different ROMs read them side by side
+			std::vector<unsigned char> rom;
+			RomError error = Chip8::ReadRom(file_name, rom);
+			if (error != ROM_OK)
+			{
+				return error;
+			}
+			// If another thread got the same ROM in first its entry stays, views of it may be out already
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::pair<std::map<std::string, std::vector<unsigned char> >::iterator, bool> inserted =
+				roms_.insert(std::make_pair(file_name, std::vector<unsigned char>()));
+			found = inserted.first;
+			if (inserted.second)
+			{
+				found->second.swap(rom);
+			}
+		}
+
+		view.data = found->second.empty() ? nullptr : &found->second[0];
+		view.size = (unsigned int)found->second.size();
+		return ROM_OK;
+	}
+
+	unsigned int RomStore::GetCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return (unsigned int)roms_.size();
+	}
+
+	void RomStore::Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		roms_.clear();
+	}
+}
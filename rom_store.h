@@ -0,0 +1,43 @@
+#ifndef ROM_STORE_H
+#define ROM_STORE_H
+
+#include "chip8.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace chip8
+{
+	// A ROM's bytes as a RomStore holds them, for Chip8::LoadGame()
+	struct RomView
+	{
+		const unsigned char *data;
+		unsigned int size;
+	};
+
+	// ROM files read once and kept in memory, for booting the same ROMs over and over, e.g.
+	// a batch runner starting thousands of machines. Open() can be called from any thread.
+	// The views stay valid until Clear() or the store goes away, and never change.
+	class RomStore
+	{
+	private:
+		std::mutex mutex_;
+		// std::map nodes don't move, so the views into the vectors stay put as ROMs are added
+		std::map<std::string, std::vector<unsigned char> > roms_;
+
+		RomStore(const RomStore &other);
+		RomStore &operator=(const RomStore &other);
+	public:
+		RomStore();
+
+		// The ROM in file_name, read the first time it's asked for. A file that failed isn't
+		// kept, the next Open() tries it again.
+		RomError Open(const std::string &file_name, RomView &view);
+		unsigned int GetCount();
+		// Forget every ROM. Views handed out before are invalid after this.
+		void Clear();
+	};
+}
+
+#endif //ROM_STORE_H
@@ -0,0 +1,44 @@
+#ifndef STATIC_CODE_H
+#define STATIC_CODE_H
+
+#include "jit.h"
+
+namespace chip8
+{
+	// A basic block translated ahead of time by tools/recompile, see Chip8::SetStaticCode().
+	// Works like a JitBlock, the function runs length instructions and returns the next pc.
+	struct StaticBlock
+	{
+		unsigned short pc;
+		unsigned short length;
+		BlockFn fn;
+	};
+
+	// Everything tools/recompile generates for one ROM
+	struct StaticCode
+	{
+		// The ROM the code was generated from, checked against memory before it's used
+		unsigned int rom_size;
+		unsigned int rom_hash;
+
+		// Returns the block starting at pc or nullptr if there isn't one
+		const StaticBlock *(*find)(unsigned short pc);
+
+		// One bit per address covered by a block, writing to any of them turns the static code off
+		const unsigned char *code_map;
+	};
+
+	// FNV-1a, used to tie generated code to the ROM it came from
+	inline unsigned int HashRom(const unsigned char *rom, unsigned int size)
+	{
+		unsigned int hash = 2166136261u;
+		for (unsigned int i = 0; i < size; i++)
+		{
+			hash ^= rom[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+}
+
+#endif //STATIC_CODE_H
\ No newline at end of file
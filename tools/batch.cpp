@@ -0,0 +1,261 @@
+// Runs a set of ROMs headless, each in its own Chip8, spread over every core.
+//
+// batch <directory | list file> <frames> <output.csv> [threads] [--jit] [--xo] [--quirks profile]
+//
+// A list file has one ROM path per line. Every ROM runs for the given number
+// of 60Hz frames and gets one CSV row: the ROM, the instructions executed,
+// how many of those were skipped as idle, an FNV-1a hash of the final
+// framebuffer and the wall time it took. --xo runs them all as XO-CHIP programs,
+// --quirks with default, cosmac, schip or xochip behaviour instead of the machine's own.
+#include "../chip8.h"
+#include "../rom_store.h"
+#include "../work_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	struct Result
+	{
+		chip8::RomError error;
+		unsigned long long cycles;
+		unsigned long long idle_cycles;
+		unsigned long long framebuffer_hash;
+		double wall_ms;
+	};
+
+	bool IsDirectory(const std::string &path)
+	{
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+	}
+
+	// Plain files only, no directories, devices, pipes or links to anything else
+	bool IsRegularFile(const std::string &path)
+	{
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES &&
+			(attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE | FILE_ATTRIBUTE_REPARSE_POINT)) == 0;
+#else
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+#endif
+	}
+
+	void ListDirectory(const std::string &path, std::vector<std::string> &roms)
+	{
+#ifdef _WIN32
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		do
+		{
+			std::string rom = path + "\\" + data.cFileName;
+			if (IsRegularFile(rom))
+			{
+				roms.push_back(rom);
+			}
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR *dir = opendir(path.c_str());
+		if (dir == nullptr)
+		{
+			return;
+		}
+		while (struct dirent *entry = readdir(dir))
+		{
+			std::string rom = path + "/" + entry->d_name;
+			if (IsRegularFile(rom))
+			{
+				roms.push_back(rom);
+			}
+		}
+		closedir(dir);
+#endif
+	}
+
+	void ReadList(const std::string &path, std::vector<std::string> &roms)
+	{
+		std::ifstream list(path);
+		std::string line;
+		while (std::getline(list, line))
+		{
+			if (!line.empty() && line[line.size() - 1] == '\r')
+			{
+				line.erase(line.size() - 1);
+			}
+			if (!line.empty())
+			{
+				roms.push_back(line);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		std::cerr << "Usage: batch <directory | list file> <frames> <output.csv> [threads] [--jit] [--xo] [--quirks profile]" << std::endl;
+		return 1;
+	}
+
+	std::string source = argv[1];
+	unsigned int frames = strtoul(argv[2], nullptr, 10);
+	std::string output = argv[3];
+	unsigned int threads = 0;
+	bool use_jit = false;
+	chip8::Machine machine = chip8::MACHINE_CHIP8;
+	bool set_quirks = false;
+	chip8::QuirkProfile quirks = chip8::QUIRKS_DEFAULT;
+	for (int i = 4; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--jit")
+		{
+			use_jit = true;
+		}
+		else if (std::string(argv[i]) == "--xo")
+		{
+			machine = chip8::MACHINE_XOCHIP;
+		}
+		else if (std::string(argv[i]) == "--quirks" && i + 1 < argc)
+		{
+			set_quirks = true;
+			if (!chip8::Chip8::ParseQuirks(argv[++i], quirks))
+			{
+				std::cerr << "Error: unknown quirk profile " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else
+		{
+			threads = strtoul(argv[i], nullptr, 10);
+		}
+	}
+
+	std::vector<std::string> roms;
+	if (IsDirectory(source))
+	{
+		ListDirectory(source, roms);
+		std::sort(roms.begin(), roms.end());
+	}
+	else
+	{
+		ReadList(source, roms);
+	}
+
+	if (roms.empty())
+	{
+		std::cerr << "Error: no ROMs found in " << source << std::endl;
+		return 1;
+	}
+
+	std::vector<Result> results(roms.size());
+	// Every ROM is read once and loaded straight from here, LoadGame() with a file name would
+	// read it again and report every ROM on cout from all the workers at once
+	chip8::RomStore store;
+
+	chip8::WorkPool pool(threads);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	pool.Run((unsigned int)roms.size(), [&](unsigned int index)
+	{
+		std::chrono::steady_clock::time_point rom_start = std::chrono::steady_clock::now();
+
+		chip8::Chip8 *engine = new chip8::Chip8();
+		engine->SetMachine(machine);
+		if (set_quirks)
+		{
+			engine->SetQuirks(quirks);
+		}
+		Result &result = results[index];
+		chip8::RomView rom;
+		result.error = store.Open(roms[index], rom);
+		if (result.error == chip8::ROM_OK)
+		{
+			result.error = engine->LoadGame(rom.data, rom.size);
+		}
+		if (result.error != chip8::ROM_OK)
+		{
+			// Its row comes out all zeros rather than the run of an empty machine
+			delete engine;
+			result.cycles = 0;
+			result.idle_cycles = 0;
+			result.framebuffer_hash = 0;
+			result.wall_ms = 0;
+			return;
+		}
+		if (use_jit)
+		{
+			engine->SetEngine(chip8::ENGINE_JIT);
+		}
+
+		// Nothing changes the keys in between, so the whole run can go in one call
+		// and idle loops get skipped right up to the end of it
+		unsigned long long cycles = 0;
+		unsigned long long total = (unsigned long long)frames * engine->GetCyclesPerFrame();
+		while (cycles < total)
+		{
+			cycles += engine->Run((unsigned int)(total - cycles < 0x80000000u ? total - cycles : 0x80000000u));
+		}
+
+		result.cycles = cycles;
+		result.idle_cycles = engine->GetIdleCycles();
+		result.framebuffer_hash = engine->GetScreenHash();
+		delete engine;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - rom_start;
+		result.wall_ms = elapsed.count();
+	});
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	FILE *out = fopen(output.c_str(), "w");
+	if (out == nullptr)
+	{
+		std::cerr << "Error: could not write " << output << std::endl;
+		return 1;
+	}
+	fprintf(out, "rom,cycles,idle_cycles,framebuffer_hash,wall_ms\n");
+	unsigned long long total_cycles = 0;
+	unsigned int failed = 0;
+	for (size_t i = 0; i < roms.size(); i++)
+	{
+		failed += results[i].error != chip8::ROM_OK ? 1 : 0;
+		fprintf(out, "%s,%llu,%llu,%016llx,%.3f\n", roms[i].c_str(), results[i].cycles, results[i].idle_cycles,
+			results[i].framebuffer_hash, results[i].wall_ms);
+		total_cycles += results[i].cycles;
+	}
+	fclose(out);
+
+	printf("%u ROMs, %u frames each, %u threads, %.3f s, %.2f MIPS\n", (unsigned int)roms.size(), frames,
+		pool.GetThreadCount(), elapsed.count(), total_cycles / elapsed.count() / 1e6);
+	if (failed > 0)
+	{
+		printf("%u ROMs could not be loaded, their rows are all zeros\n", failed);
+	}
+	return 0;
+}
\ No newline at end of file
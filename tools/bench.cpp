@@ -0,0 +1,596 @@
+// Benchmark suite for the Chip8 core, no SFML needed.
+//
+// bench [--cycles N] [--engine interpreter|jit|all] [--rewind] [--lockstep N] [--env N] [--fork] [rom ...]
+//
+// Runs a set of synthetic opcode mixes and small bundled ROMs with each engine,
+// then any ROM files given, and times LoadGame() from a file and from a RomStore,
+// and Reset(). Every result is one CSV line
+//
+//   case,engine,iterations,seconds,rate,unit
+//
+// so runs can be diffed and tracked over time. Cycle counts are the best of
+// BENCH_REPEATS runs. Idle loop skipping is turned off, every instruction counts.
+// Figures that aren't timings, like sizes and ratios, come after a blank line as
+// a second table
+//
+//   case,engine,value,unit
+//
+// --rewind also times recording every frame for rewinding, and reports the bytes
+// each frame took.
+//
+// --lockstep N also runs N copies of each bundled ROM, each with its own seed, as N
+// interpreters and as one Lockstep. The rate counts the instructions of every copy,
+// and the groups of copies Lockstep ran per step go in the second table.
+//
+// --env N also steps each bundled ROM as an EnvBatch of N environments on every core,
+// 4 frames a step with random keys, and counts the frames all of them ran.
+//
+// --fork also forks each bundled ROM after every frame, keeping every fork, and reports
+// the time each one took, and the bytes in the second table.
+#include "../chip8.h"
+#include "../env_batch.h"
+#include "../lockstep.h"
+#include "../rewind.h"
+#include "../rom_store.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_REPEATS 5
+#define BENCH_LOADS 2000
+#define REWIND_BENCH_BYTES (64 * 1024 * 1024)
+
+namespace
+{
+	struct BenchRom
+	{
+		const char *name;
+		const unsigned short *words;
+		size_t count;
+	};
+
+	// Register arithmetic only, the best case for dispatch
+	const unsigned short alu_rom[] = {
+		0x6001,	// 0x200 LD V0, 0x01
+		0x6103,	// 0x202 LD V1, 0x03
+		0x8014,	// 0x204 ADD V0, V1
+		0x8105,	// 0x206 SUB V1, V0
+		0x8202,	// 0x208 AND V2, V0
+		0x8211,	// 0x20A OR V2, V1
+		0x8303,	// 0x20C XOR V3, V0
+		0x8306,	// 0x20E SHR V3
+		0x840E,	// 0x210 SHL V4
+		0x7405,	// 0x212 ADD V4, 0x05
+		0x8517,	// 0x214 SUBN V5, V1
+		0x8650,	// 0x216 LD V6, V5
+		0x1204	// 0x218 JP 0x204
+	};
+
+	// Sprites all over the screen, with wrapping and the occasional clear
+	const unsigned short dxyn_rom[] = {
+		0x6000,	// 0x200 LD V0, 0x00
+		0x6100,	// 0x202 LD V1, 0x00
+		0xA000,	// 0x204 LD I, 0x000 (font)
+		0xD01F,	// 0x206 DRW V0, V1, 15
+		0x7007,	// 0x208 ADD V0, 0x07
+		0xD015,	// 0x20A DRW V0, V1, 5
+		0x7105,	// 0x20C ADD V1, 0x05
+		0xD018,	// 0x20E DRW V0, V1, 8
+		0x70FD,	// 0x210 ADD V0, 0xFD
+		0x4100,	// 0x212 SNE V1, 0x00
+		0x00E0,	// 0x214 CLS
+		0x1206	// 0x216 JP 0x206
+	};
+
+	// Nested subroutine calls and returns
+	const unsigned short call_rom[] = {
+		0x2206,	// 0x200 CALL 0x206
+		0x1200,	// 0x202 JP 0x200
+		0x0000,	// 0x204
+		0x220C,	// 0x206 CALL 0x20C
+		0x220C,	// 0x208 CALL 0x20C
+		0x00EE,	// 0x20A RET
+		0x2212,	// 0x20C CALL 0x212
+		0x00EE,	// 0x20E RET
+		0x0000,	// 0x210
+		0x7001,	// 0x212 ADD V0, 0x01
+		0x00EE	// 0x214 RET
+	};
+
+	// A tight loop of ALU ops, skips and a call/return, the kind of code most ROMs spend their time in
+	const unsigned short mixed_rom[] = {
+		0x6000,	// 0x200 LD V0, 0x00
+		0x6101,	// 0x202 LD V1, 0x01
+		0x8014,	// 0x204 ADD V0, V1
+		0x7102,	// 0x206 ADD V1, 0x02
+		0x8203,	// 0x208 XOR V2, V0
+		0x3000,	// 0x20A SE V0, 0x00
+		0x8326,	// 0x20C SHR V3
+		0x4105,	// 0x20E SNE V1, 0x05
+		0x8415,	// 0x210 SUB V4, V1
+		0xA300,	// 0x212 LD I, 0x300
+		0x2220,	// 0x214 CALL 0x220
+		0x1204,	// 0x216 JP 0x204
+		0x0000,	// 0x218
+		0x0000,	// 0x21A
+		0x0000,	// 0x21C
+		0x0000,	// 0x21E
+		0x8540,	// 0x220 LD V5, V4
+		0x5450,	// 0x222 SE V4, V5
+		0x6500,	// 0x224 LD V5, 0x00
+		0x00EE	// 0x226 RET
+	};
+
+	// Random diagonal maze that starts over once the screen is full.
+	// Written for this suite, public domain.
+	const unsigned short maze_rom[] = {
+		0x00E0,	// 0x200 CLS
+		0x6000,	// 0x202 LD V0, 0x00
+		0x6100,	// 0x204 LD V1, 0x00
+		0xA222,	// 0x206 LD I, 0x222
+		0xC201,	// 0x208 RND V2, 0x01
+		0x3201,	// 0x20A SE V2, 0x01
+		0xA21E,	// 0x20C LD I, 0x21E
+		0xD014,	// 0x20E DRW V0, V1, 4
+		0x7004,	// 0x210 ADD V0, 0x04
+		0x3040,	// 0x212 SE V0, 0x40
+		0x1206,	// 0x214 JP 0x206
+		0x6000,	// 0x216 LD V0, 0x00
+		0x7104,	// 0x218 ADD V1, 0x04
+		0x1226,	// 0x21A JP 0x226
+		0x0000,	// 0x21C
+		0x8040,	// 0x21E sprite \ .
+		0x2010,	// 0x220
+		0x2040,	// 0x222 sprite /
+		0x8010,	// 0x224
+		0x3120,	// 0x226 SE V1, 0x20
+		0x1206,	// 0x228 JP 0x206
+		0x1200	// 0x22A JP 0x200
+	};
+
+	// A box bouncing around the screen, paced by the delay timer like a real game.
+	// Written for this suite, public domain.
+	const unsigned short bounce_rom[] = {
+		0x6010,	// 0x200 LD V0, 0x10     x
+		0x6108,	// 0x202 LD V1, 0x08     y
+		0x6201,	// 0x204 LD V2, 0x01     dx
+		0x6301,	// 0x206 LD V3, 0x01     dy
+		0xA232,	// 0x208 LD I, 0x232
+		0xD014,	// 0x20A DRW V0, V1, 4   draw
+		0x6401,	// 0x20C LD V4, 0x01
+		0xF415,	// 0x20E LD DT, V4
+		0xF407,	// 0x210 LD V4, DT       wait a frame
+		0x3400,	// 0x212 SE V4, 0x00
+		0x1210,	// 0x214 JP 0x210
+		0xD014,	// 0x216 DRW V0, V1, 4   erase
+		0x8024,	// 0x218 ADD V0, V2
+		0x8134,	// 0x21A ADD V1, V3
+		0x303C,	// 0x21C SE V0, 0x3C
+		0x1222,	// 0x21E JP 0x222
+		0x62FF,	// 0x220 LD V2, 0xFF
+		0x4000,	// 0x222 SNE V0, 0x00
+		0x6201,	// 0x224 LD V2, 0x01
+		0x311C,	// 0x226 SE V1, 0x1C
+		0x122C,	// 0x228 JP 0x22C
+		0x63FF,	// 0x22A LD V3, 0xFF
+		0x4100,	// 0x22C SNE V1, 0x00
+		0x6301,	// 0x22E LD V3, 0x01
+		0x120A,	// 0x230 JP 0x20A
+		0xF0F0,	// 0x232 sprite
+		0xF0F0	// 0x234
+	};
+
+	const BenchRom bench_roms[] = {
+		{ "alu", alu_rom, sizeof(alu_rom) / sizeof(alu_rom[0]) },
+		{ "dxyn", dxyn_rom, sizeof(dxyn_rom) / sizeof(dxyn_rom[0]) },
+		{ "call", call_rom, sizeof(call_rom) / sizeof(call_rom[0]) },
+		{ "mixed", mixed_rom, sizeof(mixed_rom) / sizeof(mixed_rom[0]) },
+		{ "rom_maze", maze_rom, sizeof(maze_rom) / sizeof(maze_rom[0]) },
+		{ "rom_bounce", bounce_rom, sizeof(bounce_rom) / sizeof(bounce_rom[0]) }
+	};
+
+	const char *rom_path = "bench_rom.ch8";
+
+	bool WriteRom(const char *path, const unsigned short *words, size_t count)
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			char bytes[2] = { (char)(words[i] >> 8), (char)(words[i] & 0xFF) };
+			out.write(bytes, 2);
+		}
+		return out.good();
+	}
+
+	// LoadGame() reports on cout, keep that out of the results
+	class QuietCout
+	{
+	private:
+		std::ostringstream sink_;
+		std::streambuf *old_;
+	public:
+		QuietCout() : old_(std::cout.rdbuf(sink_.rdbuf())) {}
+		~QuietCout() { std::cout.rdbuf(old_); }
+	};
+
+	chip8::Chip8 *Boot(const std::string &path, chip8::Engine engine_type)
+	{
+		chip8::Chip8 *engine = new chip8::Chip8();
+		{
+			QuietCout quiet;
+			engine->LoadGame(path);
+		}
+		engine->SetIdleSkip(false);
+		engine->SetEngine(engine_type);
+		return engine;
+	}
+
+	void Report(const std::string &name, const char *engine_name, unsigned long long iterations, double seconds,
+		double rate, const char *unit)
+	{
+		printf("%s,%s,%llu,%.6f,%.3f,%s\n", name.c_str(), engine_name, iterations, seconds, rate, unit);
+		fflush(stdout);
+	}
+
+	// A figure that isn't a timing, kept back and printed after all the timings
+	struct Stat
+	{
+		std::string name;
+		std::string engine_name;
+		double value;
+		const char *unit;
+	};
+
+	std::vector<Stat> stats;
+
+	void ReportStat(const std::string &name, const char *engine_name, double value, const char *unit)
+	{
+		Stat stat = { name, engine_name, value, unit };
+		stats.push_back(stat);
+	}
+
+	void BenchCycles(const std::string &name, const std::string &path, chip8::Engine engine_type,
+		const char *engine_name, unsigned int cycles)
+	{
+		double best = 0;
+		for (unsigned int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+		{
+			chip8::Chip8 *engine = Boot(path, engine_type);
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			engine->Run(cycles);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+			delete engine;
+			if (repeat == 0 || elapsed.count() < best)
+			{
+				best = elapsed.count();
+			}
+		}
+		Report(name, engine_name, cycles, best, cycles / best / 1e6, "MIPS");
+	}
+
+	void BenchLockstep(const std::string &name, const std::string &path, unsigned int copies, unsigned int cycles)
+	{
+		// The same instructions in total as the other cases, spread over the copies
+		unsigned int steps = cycles / copies;
+		unsigned long long total = (unsigned long long)steps * copies;
+
+		std::vector<chip8::Chip8 *> engines;
+		for (unsigned int c = 0; c < copies; c++)
+		{
+			engines.push_back(Boot(path, chip8::ENGINE_INTERPRETER));
+			engines[c]->SetSeed(c + 1);
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int c = 0; c < copies; c++)
+		{
+			engines[c]->Run(steps);
+		}
+		std::chrono::duration<double> separate = std::chrono::steady_clock::now() - start;
+		for (unsigned int c = 0; c < copies; c++)
+		{
+			delete engines[c];
+		}
+
+		chip8::Lockstep *lockstep = new chip8::Lockstep(copies);
+		lockstep->LoadGame(path);
+		for (unsigned int c = 0; c < copies; c++)
+		{
+			lockstep->SetSeed(c, c + 1);
+		}
+		lockstep->Init();
+		start = std::chrono::steady_clock::now();
+		lockstep->Run(steps);
+		std::chrono::duration<double> together = std::chrono::steady_clock::now() - start;
+
+		std::ostringstream case_name;
+		case_name << name << "_x" << copies;
+		Report(case_name.str(), "separate", total, separate.count(), total / separate.count() / 1e6, "MIPS");
+		Report(case_name.str(), "lockstep", total, together.count(), total / together.count() / 1e6, "MIPS");
+		ReportStat(case_name.str(), "lockstep", (double)lockstep->GetGroups() / lockstep->GetSteps(), "groups/step");
+		delete lockstep;
+	}
+
+	void BenchEnv(const std::string &name, const std::string &path, unsigned int count, unsigned int cycles)
+	{
+		const unsigned int frames_per_step = 4;
+		chip8::EnvBatch *batch = new chip8::EnvBatch(count, chip8::OBSERVATION_BITS);
+		{
+			QuietCout quiet;
+			batch->LoadGame(path);
+		}
+		std::vector<unsigned char> observations(count * batch->GetObservationSize());
+		std::vector<unsigned short> actions(count);
+		std::vector<float> rewards(count);
+		batch->Reset(1, &observations[0]);
+
+		// The same instructions in total as the other cases, if no loop is skipped as idle
+		unsigned int steps = cycles / DEFAULT_CYCLES_PER_FRAME / frames_per_step / count;
+		steps = steps > 0 ? steps : 1;
+		unsigned int random = 1;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int step = 0; step < steps; step++)
+		{
+			for (unsigned int e = 0; e < count; e++)
+			{
+				random = random * 1103515245 + 12345;
+				actions[e] = (unsigned short)(random >> 16);
+			}
+			batch->Step(&actions[0], frames_per_step, &observations[0], &rewards[0], nullptr);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		delete batch;
+
+		unsigned long long frames = (unsigned long long)steps * frames_per_step * count;
+		std::ostringstream case_name;
+		case_name << name << "_env" << count;
+		Report(case_name.str(), "batch", frames, elapsed.count(), frames / elapsed.count() / 1e6, "Mframes/s");
+	}
+
+	void BenchFork(const std::string &name, const std::string &path, unsigned int cycles)
+	{
+		chip8::Chip8 *engine = Boot(path, chip8::ENGINE_INTERPRETER);
+		unsigned int frames = cycles / engine->GetCyclesPerFrame();
+		std::vector<std::shared_ptr<const chip8::ForkState> > forks;
+		forks.reserve(frames);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < frames; i++)
+		{
+			engine->RunFrame();
+			forks.push_back(engine->Fork());
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		delete engine;
+
+		// Every page a fork doesn't share with the one before is its own
+		unsigned long long bytes = 0;
+		for (size_t f = 0; f < forks.size(); f++)
+		{
+			bytes += sizeof(chip8::ForkState) + forks[f]->pages.size() * sizeof(forks[f]->pages[0]);
+			for (size_t p = 0; p < forks[f]->pages.size(); p++)
+			{
+				if (f == 0 || forks[f]->pages[p] != forks[f - 1]->pages[p])
+				{
+					bytes += sizeof(chip8::ForkPage);
+				}
+			}
+		}
+
+		Report(name + "_fork", "interpreter", frames, elapsed.count(), elapsed.count() / frames * 1e6, "us/frame");
+		ReportStat(name + "_fork", "interpreter", (double)bytes / frames, "bytes/fork");
+	}
+
+	void BenchLoadGame()
+	{
+		// The largest ROM that fits, so the copy into memory is as long as it gets
+		std::vector<unsigned short> words((4096 - 0x200) / 2, 0x1200);
+		WriteRom(rom_path, &words[0], words.size());
+
+		chip8::Chip8 *engine = new chip8::Chip8();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		{
+			QuietCout quiet;
+			for (unsigned int i = 0; i < BENCH_LOADS; i++)
+			{
+				engine->LoadGame(rom_path);
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		Report("loadgame", "-", BENCH_LOADS, elapsed.count(), elapsed.count() / BENCH_LOADS * 1e6, "us/load");
+
+		// The same ROM from a RomStore, read from the file once
+		chip8::RomStore store;
+		chip8::RomView rom;
+		start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < BENCH_LOADS; i++)
+		{
+			store.Open(rom_path, rom);
+			engine->LoadGame(rom.data, rom.size);
+		}
+		elapsed = std::chrono::steady_clock::now() - start;
+		Report("loadgame_store", "-", BENCH_LOADS, elapsed.count(), elapsed.count() / BENCH_LOADS * 1e6, "us/load");
+
+		// Starting the ROM over after a frame, only the Reset() counts
+		elapsed = std::chrono::duration<double>::zero();
+		for (unsigned int i = 0; i < BENCH_LOADS; i++)
+		{
+			engine->RunFrame();
+			start = std::chrono::steady_clock::now();
+			engine->Reset();
+			elapsed += std::chrono::steady_clock::now() - start;
+		}
+		Report("reset", "-", BENCH_LOADS, elapsed.count(), elapsed.count() / BENCH_LOADS * 1e6, "us/reset");
+		delete engine;
+	}
+
+	void BenchRewind(const std::string &path, chip8::Engine engine_type, const char *engine_name, unsigned int cycles)
+	{
+		chip8::Chip8 *engine = Boot(path, engine_type);
+		unsigned int frames = cycles / engine->GetCyclesPerFrame();
+		chip8::Rewind *history = new chip8::Rewind(REWIND_BENCH_BYTES);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < frames; i++)
+		{
+			engine->RunFrame();
+		}
+		std::chrono::duration<double> plain = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < frames; i++)
+		{
+			engine->RunFrame();
+			history->Record(engine);
+		}
+		std::chrono::duration<double> recorded = std::chrono::steady_clock::now() - start;
+
+		double extra = recorded.count() - plain.count();
+		Report("rewind_record", engine_name, frames, extra, extra / frames * 1e6, "us/frame");
+		ReportStat("rewind_record", engine_name, (double)history->GetUsedBytes() / history->GetFrameCount(), "bytes/frame");
+
+		delete history;
+		delete engine;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int cycles = 20000000;
+	std::string engines = "all";
+	bool rewind = false;
+	unsigned int lockstep = 0;
+	unsigned int envs = 0;
+	bool fork = false;
+	std::vector<std::string> rom_files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--cycles" && i + 1 < argc)
+		{
+			cycles = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--engine" && i + 1 < argc)
+		{
+			engines = argv[++i];
+		}
+		else if (arg == "--rewind")
+		{
+			rewind = true;
+		}
+		else if (arg == "--lockstep" && i + 1 < argc)
+		{
+			lockstep = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--env" && i + 1 < argc)
+		{
+			envs = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--fork")
+		{
+			fork = true;
+		}
+		else
+		{
+			rom_files.push_back(arg);
+		}
+	}
+
+	std::vector<chip8::Engine> engine_types;
+	std::vector<const char *> engine_names;
+	if (engines == "interpreter" || engines == "all")
+	{
+		engine_types.push_back(chip8::ENGINE_INTERPRETER);
+		engine_names.push_back("interpreter");
+	}
+	if (engines == "jit" || engines == "all")
+	{
+		chip8::Chip8 probe;
+		if (probe.SetEngine(chip8::ENGINE_JIT))
+		{
+			engine_types.push_back(chip8::ENGINE_JIT);
+			engine_names.push_back("jit");
+		}
+		else if (engines == "jit")
+		{
+			std::cerr << "Error: the jit engine is not available" << std::endl;
+			return 1;
+		}
+	}
+	if (engine_types.empty())
+	{
+		std::cerr << "Usage: bench [--cycles N] [--engine interpreter|jit|all] [--rewind] [--lockstep N] [--env N] [--fork] [rom ...]" << std::endl;
+		return 1;
+	}
+
+	printf("case,engine,iterations,seconds,rate,unit\n");
+
+	for (size_t r = 0; r < sizeof(bench_roms) / sizeof(bench_roms[0]); r++)
+	{
+		const BenchRom &rom = bench_roms[r];
+		if (!WriteRom(rom_path, rom.words, rom.count))
+		{
+			std::cerr << "Error: could not write " << rom_path << std::endl;
+			return 1;
+		}
+		for (size_t e = 0; e < engine_types.size(); e++)
+		{
+			BenchCycles(rom.name, rom_path, engine_types[e], engine_names[e], cycles);
+		}
+		if (rewind && std::string(rom.name) == "mixed")
+		{
+			for (size_t e = 0; e < engine_types.size(); e++)
+			{
+				BenchRewind(rom_path, engine_types[e], engine_names[e], cycles);
+			}
+		}
+		if (lockstep > 0)
+		{
+			BenchLockstep(rom.name, rom_path, lockstep, cycles);
+		}
+		if (envs > 0)
+		{
+			BenchEnv(rom.name, rom_path, envs, cycles);
+		}
+		if (fork)
+		{
+			BenchFork(rom.name, rom_path, cycles);
+		}
+	}
+
+	for (size_t r = 0; r < rom_files.size(); r++)
+	{
+		std::string name = rom_files[r];
+		size_t slash = name.find_last_of("/\\");
+		name = "file_" + (slash == std::string::npos ? name : name.substr(slash + 1));
+		for (size_t e = 0; e < engine_types.size(); e++)
+		{
+			BenchCycles(name, rom_files[r], engine_types[e], engine_names[e], cycles);
+		}
+	}
+
+	BenchLoadGame();
+
+	if (!stats.empty())
+	{
+		printf("\ncase,engine,value,unit\n");
+		for (size_t i = 0; i < stats.size(); i++)
+		{
+			printf("%s,%s,%.3f,%s\n", stats[i].name.c_str(), stats[i].engine_name.c_str(), stats[i].value, stats[i].unit);
+		}
+	}
+
+	remove(rom_path);
+	return 0;
+}
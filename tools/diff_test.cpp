@@ -0,0 +1,998 @@
+// Differential tests for the Chip8 core, no SFML needed.
+//
+// diff_test [--seeds N] [--write-static-rom file]
+//
+// Runs the same programs two ways that have to agree and compares the machines:
+//
+//   engines    the interpreter against the JIT and idle loop skipping, on random ROMs
+//   static     the interpreter against code from tools/recompile, see below
+//   draw       DXYN in both resolutions and on both XO-CHIP planes against a pixel by pixel reference
+//   quirks     what each quirk profile does to the shifts, FX55, FX1E and BNNN, with the JIT too
+//   faults     stack overflow and underflow, out of range keys, FX0A and 00FD, with each engine and Lockstep
+//   snapshots  SaveState() and LoadState(), Fork() and LoadFork() and the snapshot sizes
+//   rewind     stepping back through recorded frames against the states they were recorded from
+//   replay     playing an input recording back with each engine against the recorded run
+//   lockstep   Lockstep against one Chip8 per copy
+//
+// Every check prints one CSV line, check,cases,mismatches, and the first mismatch of a seed
+// on stderr. Exits with 1 if anything mismatched. Random ROMs come from fixed seeds, so a
+// failure repeats on every run.
+//
+// The static check only runs in builds with DIFF_TEST_STATIC_CODE defined, linked with the
+// recompiled test ROM:
+//
+//   diff_test --write-static-rom static_test.ch8
+//   recompile static_test.ch8 static_test.cpp diff_test_code
+//   (build again with -DDIFF_TEST_STATIC_CODE and static_test.cpp)
+#include "../chip8.h"
+#include "../lockstep.h"
+#include "../replay.h"
+#include "../rewind.h"
+#include "../static_code.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The registers follow the header and the first 4K in every snapshot, see chip8.cpp
+#define STATE_REGISTERS (12 + CHIP8_MEMORY_SIZE)
+#define STATE_I (STATE_REGISTERS + 16)
+#define STATE_PC (STATE_REGISTERS + 18)
+#define STATE_OPCODE (STATE_REGISTERS + 20)
+#define STATE_SP (STATE_REGISTERS + 54)
+#define STATE_DELAY_TIMER (STATE_REGISTERS + 55)
+
+#define STATIC_ROM_SEED 0x5354
+#define REPLAY_FILE "diff_test.rec"
+
+#ifdef DIFF_TEST_STATIC_CODE
+namespace chip8
+{
+	extern const StaticCode diff_test_code;
+}
+#endif
+
+namespace
+{
+	typedef std::vector<unsigned char> Bytes;
+
+	struct Result
+	{
+		unsigned long long cases;
+		unsigned long long mismatches;
+	};
+
+	// xorshift64*, small and the same everywhere, so every seed makes the same ROMs
+	class Random
+	{
+	private:
+		unsigned long long state_;
+	public:
+		explicit Random(unsigned long long seed) : state_(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+		unsigned int Next(unsigned int range)
+		{
+			state_ ^= state_ >> 12;
+			state_ ^= state_ << 25;
+			state_ ^= state_ >> 27;
+			return (unsigned int)((state_ * 0x2545F4914F6CDD1Dull) >> 32) % range;
+		}
+	};
+
+	enum RomFlags
+	{
+		ROM_CALLS = 1,			// 2NNN and 00EE, which are bound to overflow or underflow the stack sooner or later
+		ROM_WAITS = 2,			// Key skips and waits, delay timer waits and 00FD
+		ROM_SUPERCHIP = 4,		// High resolution, scrolling, the big font and the RPL flags
+		ROM_SELF_MODIFY = 8,	// I may point into the program, so FX33 and FX55 rewrite it
+		ROM_EVERYTHING = 15
+	};
+
+	// count instructions followed by 256 random bytes of sprites and data. Jumps, calls and
+	// skips land inside the program. The waits give idle loop skipping something to find.
+	Bytes RandomRom(Random &random, unsigned int count, unsigned int flags)
+	{
+		std::vector<unsigned short> words;
+		unsigned short data_address = (unsigned short)(ROM_ADDRESS + count * 2);
+		while (words.size() < count)
+		{
+			unsigned short here = (unsigned short)(ROM_ADDRESS + words.size() * 2);
+			unsigned short x = (unsigned short)random.Next(16);
+			unsigned short y = (unsigned short)random.Next(16);
+			unsigned short kk = (unsigned short)random.Next(256);
+			unsigned short target = (unsigned short)(ROM_ADDRESS + random.Next(count) * 2);
+			unsigned short data = (flags & ROM_SELF_MODIFY) && random.Next(2) ? target : (unsigned short)(data_address + random.Next(256));
+
+			unsigned int kind = random.Next(36);
+			if (((kind == 19 || kind == 20) && !(flags & ROM_CALLS)) || (kind >= 24 && kind <= 27 && !(flags & ROM_WAITS)) ||
+				(kind >= 29 && !(flags & ROM_SUPERCHIP)))
+			{
+				continue;
+			}
+			switch (kind)
+			{
+			case 0: words.push_back(0x6000 | x << 8 | kk); break;
+			case 1: words.push_back(0x7000 | x << 8 | kk); break;
+			case 2: words.push_back(0x8000 | x << 8 | y << 4 | random.Next(8)); break;
+			case 3: words.push_back(0x800E | x << 8 | y << 4); break;
+			case 4: words.push_back(0x3000 | x << 8 | kk); break;
+			case 5: words.push_back(0x4000 | x << 8 | kk); break;
+			case 6: words.push_back(0x5000 | x << 8 | y << 4); break;
+			case 7: words.push_back(0x9000 | x << 8 | y << 4); break;
+			case 8: words.push_back(0xA000 | data); break;
+			case 9: words.push_back(0xF01E | x << 8); break;
+			case 10: words.push_back(0xF029 | x << 8); break;
+			case 11: words.push_back(0xF033 | x << 8); break;
+			case 12: words.push_back(0xF055 | x << 8); break;
+			case 13: words.push_back(0xF065 | x << 8); break;
+			case 14: words.push_back(0xF015 | x << 8); break;
+			case 15: words.push_back(0xF007 | x << 8); break;
+			case 16: words.push_back(0xF018 | x << 8); break;
+			case 17: words.push_back(0x1000 | target); break;
+			case 18: words.push_back(0xB000 | target); break;
+			case 19: words.push_back(0x2000 | target); break;
+			case 20: words.push_back(0x00EE); break;
+			case 21: words.push_back(0xC000 | x << 8 | kk); break;
+			case 22: words.push_back(0xD000 | x << 8 | y << 4 | (1 + random.Next(15))); break;
+			case 23: words.push_back(0x00E0); break;
+			case 24: words.push_back(0xE09E | x << 8); break;
+			case 25: words.push_back(0xE0A1 | x << 8); break;
+			case 26: words.push_back(0xF00A | x << 8); break;
+			case 27:
+				// Wait a few frames on the delay timer
+				words.push_back(0x6000 | x << 8 | (1 + random.Next(8)));
+				words.push_back(0xF015 | x << 8);
+				words.push_back(0xF007 | x << 8);
+				words.push_back(0x3000 | x << 8);
+				words.push_back(0x1000 | (here + 4));
+				break;
+			case 28: words.push_back(0xA000 | (random.Next(16) * 5)); break;
+			case 29: words.push_back(random.Next(2) ? 0x00FF : 0x00FE); break;
+			case 30: words.push_back(0x00C0 | random.Next(16)); break;
+			case 31: words.push_back(random.Next(2) ? 0x00FB : 0x00FC); break;
+			case 32: words.push_back(0xF030 | x << 8); break;
+			case 33: words.push_back(0xF075 | (x & 7) << 8); break;
+			case 34: words.push_back(0xF085 | (x & 7) << 8); break;
+			default:
+				// A 16x16 sprite, or now and then the end of the program
+				words.push_back(random.Next(8) || !(flags & ROM_WAITS) ? 0xD000 | x << 8 | y << 4 : 0x00FD);
+				break;
+			}
+		}
+		words.resize(count);
+
+		Bytes rom;
+		for (size_t w = 0; w < words.size(); w++)
+		{
+			rom.push_back((unsigned char)(words[w] >> 8));
+			rom.push_back((unsigned char)(words[w] & 0xFF));
+		}
+		for (unsigned int b = 0; b < 256; b++)
+		{
+			rom.push_back((unsigned char)random.Next(256));
+		}
+		return rom;
+	}
+
+	Bytes MakeRom(const unsigned short *words, unsigned int count)
+	{
+		Bytes rom;
+		for (unsigned int w = 0; w < count; w++)
+		{
+			rom.push_back((unsigned char)(words[w] >> 8));
+			rom.push_back((unsigned char)(words[w] & 0xFF));
+		}
+		return rom;
+	}
+
+	chip8::Chip8 *Boot(const Bytes &rom, chip8::Machine machine, bool idle_skip)
+	{
+		chip8::Chip8 *engine = new chip8::Chip8();
+		engine->SetMachine(machine);
+		engine->LoadGame(&rom[0], (unsigned int)rom.size());
+		engine->SetIdleSkip(idle_skip);
+		return engine;
+	}
+
+	// The whole snapshot but the last opcode, which the JIT and static code don't keep
+	Bytes State(chip8::Chip8 *engine)
+	{
+		Bytes state(engine->GetStateSize());
+		engine->SaveState(&state[0], (unsigned int)state.size());
+		state[STATE_OPCODE] = 0;
+		state[STATE_OPCODE + 1] = 0;
+		return state;
+	}
+
+	unsigned int GetWord(const Bytes &state, unsigned int offset)
+	{
+		return state[offset] | state[offset + 1] << 8;
+	}
+
+	// Returns false and says where on stderr if the states differ
+	bool SameState(const char *check, unsigned int seed, unsigned int step, const Bytes &expected, const Bytes &actual)
+	{
+		if (expected == actual)
+		{
+			return true;
+		}
+		size_t offset = 0;
+		while (offset < expected.size() && offset < actual.size() && expected[offset] == actual[offset])
+		{
+			offset++;
+		}
+		fprintf(stderr, "%s: seed %u step %u: states differ at byte %u of %u/%u, pc %03X/%03X\n", check, seed, step,
+			(unsigned int)offset, (unsigned int)expected.size(), (unsigned int)actual.size(),
+			GetWord(expected, STATE_PC), actual.size() > STATE_PC + 1 ? GetWord(actual, STATE_PC) : 0);
+		return false;
+	}
+
+	void PressRandomKey(Random &random, std::vector<chip8::Chip8 *> &engines)
+	{
+		unsigned int key = random.Next(16);
+		bool state = random.Next(2) != 0;
+		for (size_t e = 0; e < engines.size(); e++)
+		{
+			engines[e]->SetKeyState(key, state);
+		}
+	}
+
+	bool HasJit()
+	{
+		chip8::Chip8 *probe = new chip8::Chip8();
+		bool available = probe->SetEngine(chip8::ENGINE_JIT);
+		delete probe;
+		return available;
+	}
+
+	// Runs engines[0] and the rest in the same chunks with the same keys and compares
+	// them all with engines[0] after every chunk
+	Result RunTogether(const char *check, unsigned int seed, Random &random, std::vector<chip8::Chip8 *> &engines,
+		unsigned int chunks)
+	{
+		Result result = { 0, 0 };
+		for (unsigned int chunk = 0; chunk < chunks; chunk++)
+		{
+			if (random.Next(4) == 0)
+			{
+				PressRandomKey(random, engines);
+			}
+			bool frame = random.Next(8) == 0;
+			unsigned int cycles = 1 + random.Next(random.Next(4) == 0 ? 2000 : 40);
+			for (size_t e = 0; e < engines.size(); e++)
+			{
+				if (frame)
+				{
+					engines[e]->RunFrame();
+				}
+				else
+				{
+					engines[e]->Run(cycles);
+				}
+			}
+
+			Bytes expected = State(engines[0]);
+			for (size_t e = 1; e < engines.size(); e++)
+			{
+				result.cases++;
+				if (!SameState(check, seed, chunk, expected, State(engines[e])))
+				{
+					result.mismatches++;
+					return result;
+				}
+			}
+		}
+		return result;
+	}
+
+	Result CheckEngines(unsigned int seeds, bool jit)
+	{
+		Result total = { 0, 0 };
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			Bytes rom = RandomRom(random, 128, ROM_EVERYTHING);
+
+			// The interpreter running every instruction is the reference
+			std::vector<chip8::Chip8 *> engines;
+			engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, false));
+			engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, true));
+			if (jit)
+			{
+				engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, false));
+				engines.back()->SetEngine(chip8::ENGINE_JIT);
+				engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, true));
+				engines.back()->SetEngine(chip8::ENGINE_JIT);
+			}
+
+			Result result = RunTogether("engines", seed, random, engines, 400);
+			total.cases += result.cases;
+			total.mismatches += result.mismatches;
+			for (size_t e = 0; e < engines.size(); e++)
+			{
+				delete engines[e];
+			}
+		}
+		return total;
+	}
+
+	Bytes StaticRom()
+	{
+		// No self modification, or the static code would be dropped right away, and nothing
+		// that stops the program, so it keeps running code that was translated
+		Random random(STATIC_ROM_SEED);
+		return RandomRom(random, 512, 0);
+	}
+
+#ifdef DIFF_TEST_STATIC_CODE
+	Result CheckStaticCode(unsigned int seeds, bool jit)
+	{
+		Result total = { 0, 0 };
+		Bytes rom = StaticRom();
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			std::vector<chip8::Chip8 *> engines;
+			engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, false));
+			engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, random.Next(2) != 0));
+			if (jit)
+			{
+				engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, random.Next(2) != 0));
+				engines.back()->SetEngine(chip8::ENGINE_JIT);
+			}
+			for (size_t e = 0; e < engines.size(); e++)
+			{
+				// The seed decides the CXKK numbers, so every seed takes its own way through the ROM
+				engines[e]->SetSeed(seed);
+				if (e > 0 && !engines[e]->SetStaticCode(&chip8::diff_test_code))
+				{
+					fprintf(stderr, "static: the static code was generated from a different ROM\n");
+					total.mismatches++;
+				}
+			}
+
+			Result result = RunTogether("static", seed, random, engines, 400);
+			total.cases += result.cases;
+			total.mismatches += result.mismatches;
+			for (size_t e = 0; e < engines.size(); e++)
+			{
+				delete engines[e];
+			}
+		}
+		return total;
+	}
+#endif
+
+	// One byte per pixel and plane, drawn the slow and obvious way with wrapping at the edges
+	struct ReferenceScreen
+	{
+		unsigned int width;
+		unsigned int height;
+		unsigned char pixels[2][PIXEL_COUNT];
+	};
+
+	bool ReferenceDraw(ReferenceScreen &screen, unsigned int plane, const unsigned char *sprite, unsigned int x,
+		unsigned int y, unsigned int height, bool wide)
+	{
+		bool collision = false;
+		unsigned int columns = wide ? 16 : 8;
+		for (unsigned int row = 0; row < height; row++)
+		{
+			for (unsigned int column = 0; column < columns; column++)
+			{
+				unsigned char byte = wide ? sprite[row * 2 + column / 8] : sprite[row];
+				if (((byte >> (7 - column % 8)) & 1) == 0)
+				{
+					continue;
+				}
+				unsigned char &pixel = screen.pixels[plane][((y + row) % screen.height) * screen.width + (x + column) % screen.width];
+				collision = collision || pixel != 0;
+				pixel ^= 1;
+			}
+		}
+		return collision;
+	}
+
+	Result CheckDraw(unsigned int seeds)
+	{
+		const unsigned int draws = 64;
+		Result total = { 0, 0 };
+		std::vector<unsigned char> pixels(PIXEL_COUNT);
+		ReferenceScreen *screen = new ReferenceScreen();
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			bool xo = seed % 2 != 0;
+			bool hires = seed % 4 >= 2;
+			screen->width = hires ? SCHIP_PIXEL_WIDTH : CHIP8_PIXEL_WIDTH;
+			screen->height = hires ? SCHIP_PIXEL_HEIGHT : CHIP8_PIXEL_HEIGHT;
+			memset(screen->pixels, 0, sizeof(screen->pixels));
+
+			// Every draw is 4 instructions, or 5 with the plane selection: FN01, LD I, LD V0, LD V1, DRW V0, V1, n
+			std::vector<unsigned short> words;
+			std::vector<unsigned int> heights(draws);
+			std::vector<unsigned int> planes(draws);
+			std::vector<unsigned short> addresses(draws);
+			std::vector<unsigned char> xs(draws);
+			std::vector<unsigned char> ys(draws);
+			unsigned short data_address = ROM_ADDRESS + 2 + draws * 5 * 2 + 2;
+			if (hires)
+			{
+				words.push_back(0x00FF);
+			}
+			for (unsigned int d = 0; d < draws; d++)
+			{
+				heights[d] = random.Next(16);
+				planes[d] = xo ? 1 + random.Next(3) : 1;
+				addresses[d] = (unsigned short)(data_address + random.Next(256));
+				xs[d] = (unsigned char)random.Next(256);
+				ys[d] = (unsigned char)random.Next(256);
+				if (xo)
+				{
+					words.push_back((unsigned short)(0xF001 | planes[d] << 8));
+				}
+				words.push_back(0xA000 | addresses[d]);
+				words.push_back(0x6000 | xs[d]);
+				words.push_back(0x6100 | ys[d]);
+				words.push_back((unsigned short)(0xD010 | heights[d]));
+			}
+			words.push_back((unsigned short)(0x1000 | (ROM_ADDRESS + words.size() * 2)));
+			Bytes rom = MakeRom(&words[0], (unsigned int)words.size());
+			rom.resize(data_address - ROM_ADDRESS, 0);
+			for (unsigned int b = 0; b < 256 + 64; b++)
+			{
+				rom.push_back((unsigned char)random.Next(256));
+			}
+
+			chip8::Chip8 *engine = Boot(rom, xo ? chip8::MACHINE_XOCHIP : chip8::MACHINE_CHIP8, true);
+			engine->Run(hires ? 1 : 0);
+			for (unsigned int d = 0; d < draws; d++)
+			{
+				engine->Run(xo ? 5 : 4);
+
+				bool wide = heights[d] == 0;
+				unsigned int height = wide ? 16 : heights[d];
+				unsigned short address = addresses[d];
+				bool collision = false;
+				for (unsigned int plane = 0; plane < 2; plane++)
+				{
+					if (planes[d] & (1 << plane))
+					{
+						collision = ReferenceDraw(*screen, plane, &rom[address - ROM_ADDRESS], xs[d] % screen->width,
+							ys[d] % screen->height, height, wide) || collision;
+						address += wide ? 32 : height;
+					}
+				}
+
+				Bytes state = State(engine);
+				total.cases++;
+				bool same = engine->GetScreenWidth() == screen->width && state[STATE_REGISTERS + 15] == (collision ? 1 : 0);
+				for (unsigned int plane = 0; plane < 2 && same; plane++)
+				{
+					chip8::Chip8::UnpackGraphics(engine->GetGraphics(plane), screen->width, screen->height, &pixels[0]);
+					same = memcmp(&pixels[0], screen->pixels[plane], screen->width * screen->height) == 0;
+				}
+				if (!same)
+				{
+					fprintf(stderr, "draw: seed %u draw %u: %ux%u sprite at %u,%u on planes %u doesn't match the reference\n",
+						seed, d, wide ? 16 : 8, height, xs[d] % screen->width, ys[d] % screen->height, planes[d]);
+					total.mismatches++;
+					break;
+				}
+			}
+			delete engine;
+		}
+		delete screen;
+		return total;
+	}
+
+	struct QuirkCase
+	{
+		chip8::QuirkProfile quirks;
+		unsigned short words[4];
+		unsigned int count;
+		// Register to check, 16 for I and 17 for the pc
+		unsigned int index;
+		unsigned int expected;
+	};
+
+	const QuirkCase quirk_cases[] = {
+		// The shifts write VF last, even when VF is the source or the destination
+		{ chip8::QUIRKS_COSMAC, { 0x6F83, 0x81F6 }, 2, 0x1, 0x41 },
+		{ chip8::QUIRKS_COSMAC, { 0x6F83, 0x81F6 }, 2, 0xF, 0x01 },
+		{ chip8::QUIRKS_COSMAC, { 0x6F83, 0x81FE }, 2, 0x1, 0x06 },
+		{ chip8::QUIRKS_COSMAC, { 0x6F83, 0x81FE }, 2, 0xF, 0x01 },
+		{ chip8::QUIRKS_DEFAULT, { 0x6F83, 0x8FF6 }, 2, 0xF, 0x01 },
+		{ chip8::QUIRKS_DEFAULT, { 0x6F02, 0x8FFE }, 2, 0xF, 0x00 },
+		// 8XY6 and 8XYE shift Vy on the COSMAC VIP and XO-CHIP, Vx otherwise
+		{ chip8::QUIRKS_DEFAULT, { 0x6081, 0x6106, 0x8016 }, 3, 0x0, 0x40 },
+		{ chip8::QUIRKS_DEFAULT, { 0x6081, 0x6106, 0x8016 }, 3, 0xF, 0x01 },
+		{ chip8::QUIRKS_COSMAC, { 0x6081, 0x6106, 0x8016 }, 3, 0x0, 0x03 },
+		{ chip8::QUIRKS_COSMAC, { 0x6081, 0x6106, 0x8016 }, 3, 0xF, 0x00 },
+		{ chip8::QUIRKS_SCHIP, { 0x6041, 0x6181, 0x801E }, 3, 0x0, 0x82 },
+		{ chip8::QUIRKS_XOCHIP, { 0x6041, 0x6181, 0x801E }, 3, 0x0, 0x02 },
+		{ chip8::QUIRKS_XOCHIP, { 0x6041, 0x6181, 0x801E }, 3, 0xF, 0x01 },
+		// FX55 and FX65 move I on, except on the SuperChip
+		{ chip8::QUIRKS_DEFAULT, { 0xA300, 0x6005, 0xF155 }, 3, 16, 0x302 },
+		{ chip8::QUIRKS_SCHIP, { 0xA300, 0x6005, 0xF155 }, 3, 16, 0x300 },
+		{ chip8::QUIRKS_COSMAC, { 0xA300, 0xF265 }, 2, 16, 0x303 },
+		// FX1E sets VF when I goes past 0xFFF only by default
+		{ chip8::QUIRKS_DEFAULT, { 0xAFFF, 0x6005, 0x6F07, 0xF01E }, 4, 0xF, 0x01 },
+		{ chip8::QUIRKS_COSMAC, { 0xAFFF, 0x6005, 0x6F07, 0xF01E }, 4, 0xF, 0x07 },
+		// BNNN jumps by VX on the SuperChip, by V0 everywhere else
+		{ chip8::QUIRKS_DEFAULT, { 0x6004, 0x6210, 0xB220 }, 3, 17, 0x224 },
+		{ chip8::QUIRKS_SCHIP, { 0x6004, 0x6210, 0xB220 }, 3, 17, 0x230 }
+	};
+
+	unsigned int GetRegister(const Bytes &state, unsigned int index)
+	{
+		if (index == 16)
+		{
+			return GetWord(state, STATE_I);
+		}
+		if (index == 17)
+		{
+			return GetWord(state, STATE_PC);
+		}
+		return state[STATE_REGISTERS + index];
+	}
+
+	Result CheckQuirks(bool jit)
+	{
+		Result total = { 0, 0 };
+		for (unsigned int c = 0; c < sizeof(quirk_cases) / sizeof(quirk_cases[0]); c++)
+		{
+			const QuirkCase &test = quirk_cases[c];
+			Bytes rom = MakeRom(test.words, test.count);
+			// Only the default profile runs on the JIT
+			unsigned int engines = jit && test.quirks == chip8::QUIRKS_DEFAULT ? 2 : 1;
+			for (unsigned int e = 0; e < engines; e++)
+			{
+				chip8::Chip8 *engine = Boot(rom, chip8::MACHINE_CHIP8, false);
+				engine->SetQuirks(test.quirks);
+				engine->SetEngine(e == 0 ? chip8::ENGINE_INTERPRETER : chip8::ENGINE_JIT);
+				engine->Run(test.count);
+				unsigned int actual = GetRegister(State(engine), test.index);
+				delete engine;
+
+				total.cases++;
+				if (actual != test.expected)
+				{
+					fprintf(stderr, "quirks: case %u on the %s: got %X, expected %X\n", c, e == 0 ? "interpreter" : "jit",
+						actual, test.expected);
+					total.mismatches++;
+				}
+			}
+		}
+		return total;
+	}
+
+	struct FaultCase
+	{
+		const char *name;
+		unsigned short words[4];
+		unsigned int count;
+		unsigned int frames;
+		// Key held from the start, or 16 for none
+		unsigned int key;
+		unsigned int pc;
+		unsigned int sp;
+		bool halted;
+		unsigned int delay_timer;
+	};
+
+	const FaultCase fault_cases[] = {
+		// Returning with nothing on the stack halts on the 00EE
+		{ "underflow", { 0x00EE }, 1, 2, 16, 0x200, 0, true, 0 },
+		// Calling with a full stack halts on the call, the 16 entries stay
+		{ "overflow", { 0x2200 }, 1, 4, 16, 0x200, 16, true, 0 },
+		// EX9E only looks at the low nibble, 0x13 is key 3
+		{ "key", { 0x6013, 0xE09E, 0x6101, 0x1206 }, 4, 1, 3, 0x206, 0, false, 0 },
+		// FX0A waits on itself for a key, the timers go on meanwhile
+		{ "wait", { 0x6005, 0xF015, 0xF00A, 0x1206 }, 4, 2, 16, 0x204, 0, false, 3 },
+		// 00FD stays put and stops running, the timers go on
+		{ "exit", { 0x6005, 0xF015, 0x00FD, 0x7001 }, 4, 2, 16, 0x204, 0, true, 3 }
+	};
+
+	Result CheckFaults(bool jit)
+	{
+		Result total = { 0, 0 };
+		for (unsigned int c = 0; c < sizeof(fault_cases) / sizeof(fault_cases[0]); c++)
+		{
+			const FaultCase &test = fault_cases[c];
+			Bytes rom = MakeRom(test.words, test.count);
+
+			// The interpreter, the JIT and single Cycle() calls each run the frames
+			for (unsigned int mode = 0; mode < 3; mode++)
+			{
+				if (mode == 1 && !jit)
+				{
+					continue;
+				}
+				chip8::Chip8 *engine = Boot(rom, chip8::MACHINE_CHIP8, mode != 0);
+				engine->SetEngine(mode == 1 ? chip8::ENGINE_JIT : chip8::ENGINE_INTERPRETER);
+				if (test.key < 16)
+				{
+					engine->SetKeyState(test.key, true);
+				}
+				for (unsigned int frame = 0; frame < test.frames; frame++)
+				{
+					if (mode == 2)
+					{
+						for (unsigned int cycle = 0; cycle < engine->GetCyclesPerFrame(); cycle++)
+						{
+							engine->Cycle();
+						}
+					}
+					else
+					{
+						engine->RunFrame();
+					}
+				}
+				Bytes state = State(engine);
+
+				// The machine has to carry on exactly like that from its snapshot
+				chip8::Chip8 *loaded = new chip8::Chip8();
+				bool loads = loaded->LoadState(&state[0], (unsigned int)state.size()) && loaded->IsHalted() == test.halted;
+				loaded->RunFrame();
+				engine->RunFrame();
+				loads = loads && State(loaded) == State(engine);
+				loaded->Reset();
+				loads = loads && !loaded->IsHalted();
+				delete loaded;
+
+				total.cases++;
+				if (GetWord(state, STATE_PC) != test.pc || state[STATE_SP] != test.sp || engine->IsHalted() != test.halted || !loads ||
+					state[STATE_DELAY_TIMER] != test.delay_timer)
+				{
+					fprintf(stderr, "faults: %s in mode %u: pc %03X sp %u halted %d delay %u, expected pc %03X sp %u halted %d delay %u%s\n",
+						test.name, mode, GetWord(state, STATE_PC), state[STATE_SP], engine->IsHalted() ? 1 : 0, state[STATE_DELAY_TIMER],
+						test.pc, test.sp, test.halted ? 1 : 0, test.delay_timer, loads ? "" : ", the snapshot didn't carry on the same");
+					total.mismatches++;
+				}
+				delete engine;
+			}
+
+			// Lockstep stops on the same instruction, halted the same way
+			chip8::Lockstep *lockstep = new chip8::Lockstep(3);
+			lockstep->LoadGame(&rom[0], (unsigned int)rom.size());
+			lockstep->Init();
+			for (unsigned int copy = 0; copy < 3 && test.key < 16; copy++)
+			{
+				lockstep->SetKeyState(copy, test.key, true);
+			}
+			for (unsigned int frame = 0; frame < test.frames; frame++)
+			{
+				lockstep->RunFrame();
+			}
+			total.cases++;
+			if (lockstep->GetPc(1) != test.pc || lockstep->IsHalted(1) != test.halted)
+			{
+				fprintf(stderr, "faults: %s on Lockstep: pc %03X halted %d, expected pc %03X halted %d\n", test.name,
+					lockstep->GetPc(1), lockstep->IsHalted(1) ? 1 : 0, test.pc, test.halted ? 1 : 0);
+				total.mismatches++;
+			}
+			delete lockstep;
+		}
+		return total;
+	}
+
+	Result CheckSnapshots(unsigned int seeds)
+	{
+		Result total = { 0, 0 };
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			bool xo = seed % 2 != 0;
+			Bytes rom = RandomRom(random, 128, ROM_EVERYTHING);
+			chip8::Chip8 *engine = Boot(rom, xo ? chip8::MACHINE_XOCHIP : chip8::MACHINE_CHIP8, true);
+			engine->SetSeed(seed);
+			for (unsigned int step = 0; step < 50; step++)
+			{
+				engine->Run(1 + random.Next(500));
+				Bytes state(engine->GetStateSize());
+				engine->SaveState(&state[0], (unsigned int)state.size());
+
+				// The header, the first 4K and the registers, then each plane only as big as the
+				// resolution and the rest of XO-CHIP's 64K
+				unsigned int plane_bytes = engine->GetScreenWidth() / 64 * engine->GetScreenHeight() * 8;
+				unsigned int expected_size = 12 + CHIP8_MEMORY_SIZE + CHIP8_REGISTERS_SIZE + plane_bytes +
+					(xo ? MEMORY_SIZE - CHIP8_MEMORY_SIZE + plane_bytes : 0);
+
+				chip8::Chip8 *loaded = new chip8::Chip8();
+				bool same = state.size() == expected_size &&
+					chip8::Chip8::GetStateSize(&state[0], (unsigned int)state.size()) == expected_size &&
+					!loaded->LoadState(&state[0], (unsigned int)state.size() - 1) &&
+					loaded->LoadState(&state[0], (unsigned int)state.size()) &&
+					loaded->GetStateHash() == engine->GetStateHash();
+
+				chip8::Chip8 *forked = new chip8::Chip8();
+				std::shared_ptr<const chip8::ForkState> fork = engine->Fork();
+				forked->LoadFork(fork);
+				same = same && fork->hash == engine->GetStateHash() && forked->GetStateHash() == engine->GetStateHash();
+
+				total.cases++;
+				if (!same)
+				{
+					fprintf(stderr, "snapshots: seed %u step %u: %u byte snapshot, expected %u, didn't load back the same\n",
+						seed, step, (unsigned int)state.size(), expected_size);
+					total.mismatches++;
+					delete loaded;
+					delete forked;
+					break;
+				}
+
+				// And all three run on the same
+				std::vector<chip8::Chip8 *> engines;
+				engines.push_back(engine);
+				engines.push_back(loaded);
+				engines.push_back(forked);
+				Result result = RunTogether("snapshots", seed, random, engines, 4);
+				total.cases += result.cases;
+				total.mismatches += result.mismatches;
+				delete loaded;
+				delete forked;
+				if (result.mismatches > 0)
+				{
+					break;
+				}
+			}
+			delete engine;
+		}
+		return total;
+	}
+
+	Result CheckRewind(unsigned int seeds)
+	{
+		const unsigned int frames = 300;
+		Result total = { 0, 0 };
+		chip8::Rewind *history = new chip8::Rewind(32 * 1024 * 1024);
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			bool xo = seed % 2 != 0;
+			Bytes rom = RandomRom(random, 128, ROM_EVERYTHING);
+			chip8::Chip8 *engine = Boot(rom, xo ? chip8::MACHINE_XOCHIP : chip8::MACHINE_CHIP8, true);
+			std::vector<chip8::Chip8 *> engines(1, engine);
+
+			history->Clear();
+			std::vector<Bytes> states;
+			for (unsigned int frame = 0; frame < frames; frame++)
+			{
+				if (random.Next(4) == 0)
+				{
+					PressRandomKey(random, engines);
+				}
+				engine->RunFrame();
+				history->Record(engine);
+				states.push_back(State(engine));
+			}
+
+			// Every recorded state comes back, newest first
+			for (unsigned int frame = frames - 1; frame-- > 0;)
+			{
+				total.cases++;
+				if (!history->StepBack(engine) || !SameState("rewind", seed, frame, states[frame], State(engine)))
+				{
+					total.mismatches++;
+					break;
+				}
+			}
+			total.cases++;
+			if (history->StepBack(engine))
+			{
+				fprintf(stderr, "rewind: seed %u: stepped back past the first frame\n", seed);
+				total.mismatches++;
+			}
+			delete engine;
+		}
+		delete history;
+		return total;
+	}
+
+	Result CheckReplay(unsigned int seeds, bool jit)
+	{
+		Result total = { 0, 0 };
+		chip8::Rewind *history = new chip8::Rewind(4 * 1024 * 1024);
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			bool xo = seed % 2 != 0;
+			Bytes rom = RandomRom(random, 128, ROM_EVERYTHING);
+			chip8::Chip8 *engine = Boot(rom, xo ? chip8::MACHINE_XOCHIP : chip8::MACHINE_CHIP8, true);
+			engine->SetSeed(seed);
+			std::vector<chip8::Chip8 *> engines(1, engine);
+
+			// Played like the frontend does: frames with the odd single step and rewind
+			chip8::InputRecorder *recorder = new chip8::InputRecorder();
+			bool recorded = recorder->Open(REPLAY_FILE, engine);
+			history->Clear();
+			for (unsigned int frame = 0; frame < 200; frame++)
+			{
+				if (random.Next(3) == 0)
+				{
+					PressRandomKey(random, engines);
+				}
+				recorder->Keys(engine);
+				unsigned int action = random.Next(16);
+				if (action == 0)
+				{
+					engine->Cycle();
+					recorder->Advance(1);
+				}
+				else if (action == 1 && history->StepBack(engine))
+				{
+					recorder->State(engine);
+				}
+				else
+				{
+					recorder->Advance(engine->RunFrame());
+					history->Record(engine);
+				}
+			}
+			recorded = recorder->Close() && recorded;
+			delete recorder;
+			Bytes expected = State(engine);
+			delete engine;
+
+			for (unsigned int e = 0; e < (jit ? 2u : 1u); e++)
+			{
+				chip8::InputReplay *replay = new chip8::InputReplay();
+				chip8::Chip8 *played = new chip8::Chip8();
+				played->SetIdleSkip(e == 0);
+				bool plays = recorded && replay->Open(REPLAY_FILE) && replay->Start(played) &&
+					(xo || e == 0 || played->SetEngine(chip8::ENGINE_JIT)) && replay->Run(played);
+
+				total.cases++;
+				if (!plays)
+				{
+					fprintf(stderr, "replay: seed %u: the recording didn't play back\n", seed);
+					total.mismatches++;
+				}
+				else if (!SameState("replay", seed, e, expected, State(played)))
+				{
+					total.mismatches++;
+				}
+				delete played;
+				delete replay;
+			}
+		}
+		remove(REPLAY_FILE);
+		delete history;
+		return total;
+	}
+
+	Result CheckLockstep(unsigned int seeds)
+	{
+		const unsigned int copies = 37;
+		Result total = { 0, 0 };
+		for (unsigned int seed = 0; seed < seeds; seed++)
+		{
+			Random random(seed);
+			Bytes rom = RandomRom(random, 128, ROM_EVERYTHING);
+			chip8::Lockstep *lockstep = new chip8::Lockstep(copies);
+			lockstep->LoadGame(&rom[0], (unsigned int)rom.size());
+			std::vector<chip8::Chip8 *> engines;
+			for (unsigned int copy = 0; copy < copies; copy++)
+			{
+				engines.push_back(Boot(rom, chip8::MACHINE_CHIP8, false));
+				engines[copy]->SetSeed(seed * copies + copy);
+				lockstep->SetSeed(copy, seed * copies + copy);
+			}
+			lockstep->Init();
+
+			bool same = true;
+			for (unsigned int frame = 0; frame < 100 && same; frame++)
+			{
+				for (unsigned int copy = 0; copy < copies; copy++)
+				{
+					// Some copies get keys of their own, the rest stay together
+					if (copy % 3 != 0 && random.Next(4) == 0)
+					{
+						unsigned int key = random.Next(16);
+						bool state = random.Next(2) != 0;
+						engines[copy]->SetKeyState(key, state);
+						lockstep->SetKeyState(copy, key, state);
+					}
+				}
+				lockstep->RunFrame();
+				for (unsigned int copy = 0; copy < copies && same; copy++)
+				{
+					chip8::Chip8 *engine = engines[copy];
+					engine->RunFrame();
+					Bytes state = State(engine);
+					same = memcmp(&state[12], lockstep->GetMemory(copy), CHIP8_MEMORY_SIZE) == 0 &&
+						GetWord(state, STATE_I) == lockstep->GetI(copy) && GetWord(state, STATE_PC) == lockstep->GetPc(copy) &&
+						state[STATE_DELAY_TIMER] == lockstep->GetDelayTimer(copy) && engine->IsHalted() == lockstep->IsHalted(copy) &&
+						engine->GetScreenWidth() == lockstep->GetScreenWidth(copy) &&
+						memcmp(engine->GetGraphics(), lockstep->GetGraphics(copy), GFX_WORDS * 8) == 0;
+					for (unsigned int x = 0; x < 16; x++)
+					{
+						same = same && state[STATE_REGISTERS + x] == lockstep->GetRegister(copy, x);
+					}
+					total.cases++;
+					if (!same)
+					{
+						fprintf(stderr, "lockstep: seed %u frame %u: copy %u differs, pc %03X/%03X\n", seed, frame, copy,
+							GetWord(state, STATE_PC), lockstep->GetPc(copy));
+						total.mismatches++;
+					}
+				}
+			}
+			for (unsigned int copy = 0; copy < copies; copy++)
+			{
+				delete engines[copy];
+			}
+			delete lockstep;
+		}
+		return total;
+	}
+
+	void Report(const char *check, const Result &result, unsigned long long &failed)
+	{
+		printf("%s,%llu,%llu\n", check, result.cases, result.mismatches);
+		fflush(stdout);
+		failed += result.mismatches;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int seeds = 200;
+	std::string static_rom_file;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--seeds" && i + 1 < argc)
+		{
+			seeds = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--write-static-rom" && i + 1 < argc)
+		{
+			static_rom_file = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Usage: diff_test [--seeds N] [--write-static-rom file]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!static_rom_file.empty())
+	{
+		Bytes rom = StaticRom();
+		std::ofstream out(static_rom_file, std::ios::binary);
+		out.write((const char *)&rom[0], rom.size());
+		if (!out.good())
+		{
+			std::cerr << "Error: could not write " << static_rom_file << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	bool jit = HasJit();
+	if (!jit)
+	{
+		std::cerr << "The jit engine is not available, only the interpreter is checked" << std::endl;
+	}
+
+	unsigned long long failed = 0;
+	printf("check,cases,mismatches\n");
+	Report("engines", CheckEngines(seeds, jit), failed);
+#ifdef DIFF_TEST_STATIC_CODE
+	Report("static", CheckStaticCode(seeds, jit), failed);
+#endif
+	Report("draw", CheckDraw(seeds), failed);
+	Report("quirks", CheckQuirks(jit), failed);
+	Report("faults", CheckFaults(jit), failed);
+	Report("snapshots", CheckSnapshots(seeds / 4 + 1), failed);
+	Report("rewind", CheckRewind(seeds / 10 + 1), failed);
+	Report("replay", CheckReplay(seeds / 10 + 1, jit), failed);
+	Report("lockstep", CheckLockstep(seeds / 10 + 1), failed);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,318 @@
+// Translates a ROM ahead of time into a C++ file with one function per basic block.
+// Link the output with the core and hand it to Chip8::SetStaticCode() after LoadGame().
+//
+// recompile <rom> <output.cpp> [symbol]
+//
+// Control flow is followed from 0x200. Only blocks of register-only instructions are
+// translated, anything touching the stack, timers, keys, memory or the screen is left
+// for the interpreter, as is code only reachable through BNNN.
+#include "../defines.h"
+#include "../opcodes.h"
+#include "../static_code.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const unsigned short START = 0x200;
+
+	struct Rom
+	{
+		unsigned char memory[4096];
+		unsigned short end;	// One past the last ROM byte
+
+		chip8::Instruction At(unsigned short address) const
+		{
+			return chip8::DecodeOpcode(memory[address] << 8 | memory[address + 1]);
+		}
+
+		bool Contains(unsigned short address) const
+		{
+			return address >= START && address + 1 < end;
+		}
+	};
+
+	bool IsSkip(unsigned char op)
+	{
+		return op == chip8::OP_3XKK || op == chip8::OP_4XKK || op == chip8::OP_5XY0 || op == chip8::OP_9XY0 ||
+			op == chip8::OP_EX9E || op == chip8::OP_EXA1;
+	}
+
+	// C++ for an instruction that falls through to the next one, empty if the interpreter has to run it.
+	// These mirror the handlers in chip8.cpp statement for statement, including when VF gets written.
+	std::string TranslateStraight(const chip8::Instruction &ins)
+	{
+		char x[8], y[8], kk[8], nnn[8];
+		sprintf(x, "0x%X", ins.x);
+		sprintf(y, "0x%X", ins.y);
+		sprintf(kk, "0x%02X", ins.kk);
+		sprintf(nnn, "0x%03X", ins.nnn);
+		std::string vx = std::string("v[") + x + "]";
+		std::string vy = std::string("v[") + y + "]";
+
+		switch (ins.op)
+		{
+		case chip8::OP_6XKK: return vx + " = " + kk + ";";
+		case chip8::OP_7XKK: return vx + " += " + kk + ";";
+		case chip8::OP_8XY0: return vx + " = " + vy + ";";
+		case chip8::OP_8XY1: return vx + " |= " + vy + ";";
+		case chip8::OP_8XY2: return vx + " &= " + vy + ";";
+		case chip8::OP_8XY3: return vx + " ^= " + vy + ";";
+		case chip8::OP_8XY4: return "v[0xF] = " + vy + " > (0xFF - " + vx + ") ? 1 : 0; " + vx + " += " + vy + ";";
+		case chip8::OP_8XY5: return "v[0xF] = " + vy + " > " + vx + " ? 0 : 1; " + vx + " -= " + vy + ";";
+		case chip8::OP_8XY6: return "{ unsigned char flag = " + vx + " & 0x1; " + vx + " >>= 1; v[0xF] = flag; }";
+		case chip8::OP_8XY7: return "v[0xF] = " + vy + " > " + vx + " ? 1 : 0; " + vx + " = " + vy + " - " + vx + ";";
+		case chip8::OP_8XYE: return "{ unsigned char flag = " + vx + " >> 7; " + vx + " <<= 1; v[0xF] = flag; }";
+		case chip8::OP_ANNN: return std::string("*i = ") + nnn + ";";
+		case chip8::OP_FX1E: return "v[0xF] = *i + " + vx + " > 0xFFF ? 1 : 0; *i += " + vx + ";";
+		case chip8::OP_FX29: return "*i = " + vx + " * 0x5;";
+		default: return "";
+		}
+	}
+
+	// C++ for a jump or skip that ends a block, empty if the interpreter has to run it
+	std::string TranslateBranch(const chip8::Instruction &ins, unsigned short address)
+	{
+		char line[128];
+		switch (ins.op)
+		{
+		case chip8::OP_1NNN:
+			sprintf(line, "return 0x%03X;", ins.nnn);
+			break;
+		case chip8::OP_BNNN:
+			sprintf(line, "return (unsigned short)(0x%03X + v[0x0]);", ins.nnn);
+			break;
+		case chip8::OP_3XKK:
+			sprintf(line, "return v[0x%X] == 0x%02X ? 0x%03X : 0x%03X;", ins.x, ins.kk, address + 4, address + 2);
+			break;
+		case chip8::OP_4XKK:
+			sprintf(line, "return v[0x%X] != 0x%02X ? 0x%03X : 0x%03X;", ins.x, ins.kk, address + 4, address + 2);
+			break;
+		case chip8::OP_5XY0:
+			sprintf(line, "return v[0x%X] == v[0x%X] ? 0x%03X : 0x%03X;", ins.x, ins.y, address + 4, address + 2);
+			break;
+		case chip8::OP_9XY0:
+			sprintf(line, "return v[0x%X] != v[0x%X] ? 0x%03X : 0x%03X;", ins.x, ins.y, address + 4, address + 2);
+			break;
+		default:
+			return "";
+		}
+		return line;
+	}
+
+	// Walk every path from 0x200 and collect the addresses blocks have to start at
+	std::set<unsigned short> FindLeaders(const Rom &rom)
+	{
+		std::set<unsigned short> leaders;
+		std::set<unsigned short> visited;
+		std::vector<unsigned short> pending;
+		pending.push_back(START);
+		leaders.insert(START);
+
+		while (!pending.empty())
+		{
+			unsigned short address = pending.back();
+			pending.pop_back();
+
+			while (rom.Contains(address) && visited.insert(address).second)
+			{
+				chip8::Instruction ins = rom.At(address);
+
+				if (ins.op == chip8::OP_1NNN)
+				{
+					leaders.insert(ins.nnn);
+					pending.push_back(ins.nnn);
+					break;
+				}
+				else if (ins.op == chip8::OP_2NNN)
+				{
+					leaders.insert(ins.nnn);
+					pending.push_back(ins.nnn);
+					leaders.insert(address + 2);
+					pending.push_back(address + 2);
+					break;
+				}
+				else if (IsSkip(ins.op))
+				{
+					leaders.insert(address + 2);
+					leaders.insert(address + 4);
+					pending.push_back(address + 2);
+					pending.push_back(address + 4);
+					break;
+				}
+				else if (ins.op == chip8::OP_00EE || ins.op == chip8::OP_BNNN || ins.op == chip8::OP_00FD || ins.op == chip8::OP_INVALID)
+				{
+					// Returns are covered by the call sites, BNNN can't be followed
+					break;
+				}
+				else if (TranslateStraight(ins).empty())
+				{
+					// The interpreter runs this one and carries on at the next instruction
+					leaders.insert(address + 2);
+				}
+
+				address += 2;
+			}
+		}
+
+		return leaders;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: recompile <rom> <output.cpp> [symbol]" << std::endl;
+		return 1;
+	}
+
+	std::string symbol = argc > 3 ? argv[3] : "rom_code";
+
+	// Sized up front like Chip8::ReadRom() does, a ROM filling memory to the last byte is fine.
+	// Static code only runs on CHIP-8, so the limit is its 4K.
+	std::ifstream input(argv[1], std::ios::binary | std::ios::ate);
+	if (!input)
+	{
+		std::cerr << "Error: problem loading " << argv[1] << std::endl;
+		return 1;
+	}
+	std::streamoff size = input.tellg();
+	if (size > CHIP8_MEMORY_SIZE - START)
+	{
+		std::cerr << "Error: " << argv[1] << " is too large to load into memory." << std::endl;
+		return 1;
+	}
+
+	Rom rom;
+	for (unsigned int i = 0; i < 4096; i++)
+	{
+		rom.memory[i] = 0;
+	}
+	input.seekg(0, std::ios::beg);
+	if (size < 0 || (size > 0 && !input.read((char *)rom.memory + START, size)))
+	{
+		std::cerr << "Error: problem reading " << argv[1] << std::endl;
+		return 1;
+	}
+	rom.end = (unsigned short)(START + size);
+
+	std::set<unsigned short> leaders = FindLeaders(rom);
+
+	std::ofstream out(argv[2]);
+	if (!out)
+	{
+		std::cerr << "Error: could not write " << argv[2] << std::endl;
+		return 1;
+	}
+
+	out << "// Generated by tools/recompile from " << argv[1] << ", do not edit\n";
+	out << "#include \"static_code.h\"\n\n";
+	out << "namespace\n{\n";
+
+	std::vector<unsigned short> block_pcs;
+	std::vector<unsigned short> block_lengths;
+	unsigned char code_map[512] = {};
+
+	for (std::set<unsigned short>::const_iterator it = leaders.begin(); it != leaders.end(); ++it)
+	{
+		unsigned short start = *it;
+		unsigned short address = start;
+		std::vector<std::string> lines;
+		bool returned = false;
+
+		while (rom.Contains(address))
+		{
+			// Stop where another block starts so every function is a basic block
+			if (address != start && leaders.count(address))
+			{
+				break;
+			}
+
+			chip8::Instruction ins = rom.At(address);
+			std::string line = TranslateStraight(ins);
+			if (line.empty())
+			{
+				line = TranslateBranch(ins, address);
+				if (!line.empty())
+				{
+					lines.push_back(line);
+					address += 2;
+					returned = true;
+				}
+				break;
+			}
+
+			lines.push_back(line);
+			address += 2;
+		}
+
+		if (lines.empty())
+		{
+			continue;
+		}
+
+		char header[128];
+		sprintf(header, "\tunsigned short Block%03X(unsigned char *v, unsigned short *i)\n\t{\n", start);
+		out << header;
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			out << "\t\t" << lines[i] << "\n";
+		}
+		if (!returned)
+		{
+			char line[64];
+			sprintf(line, "\t\treturn 0x%03X;\n", address);
+			out << line;
+		}
+		out << "\t}\n\n";
+
+		for (unsigned short a = start; a < address; a++)
+		{
+			code_map[a >> 3] |= 1 << (a & 7);
+		}
+		block_pcs.push_back(start);
+		block_lengths.push_back((unsigned short)lines.size());
+	}
+
+	out << "\tconst chip8::StaticBlock blocks[] = {\n";
+	for (size_t i = 0; i < block_pcs.size(); i++)
+	{
+		char line[96];
+		sprintf(line, "\t\t{ 0x%03X, %u, Block%03X },\n", block_pcs[i], block_lengths[i], block_pcs[i]);
+		out << line;
+	}
+	out << "\t\t{ 0, 0, nullptr }\n\t};\n\n";
+
+	out << "\tconst chip8::StaticBlock *Find(unsigned short pc)\n\t{\n\t\tswitch (pc)\n\t\t{\n";
+	for (size_t i = 0; i < block_pcs.size(); i++)
+	{
+		char line[64];
+		sprintf(line, "\t\tcase 0x%03X: return &blocks[%u];\n", block_pcs[i], (unsigned int)i);
+		out << line;
+	}
+	out << "\t\tdefault: return nullptr;\n\t\t}\n\t}\n\n";
+
+	out << "\tconst unsigned char code_map[512] = {";
+	for (unsigned int i = 0; i < 512; i++)
+	{
+		char value[8];
+		sprintf(value, "%s0x%02X", i % 16 == 0 ? "\n\t\t" : " ", code_map[i]);
+		out << value << (i + 1 < 512 ? "," : "");
+	}
+	out << "\n\t};\n}\n\n";
+
+	char hash[16];
+	sprintf(hash, "0x%08X", chip8::HashRom(rom.memory + START, size));
+	out << "namespace chip8\n{\n";
+	out << "\textern const StaticCode " << symbol << ";\n";
+	out << "\tconst StaticCode " << symbol << " = { " << size << ", " << hash << ", Find, code_map };\n";
+	out << "}\n";
+
+	std::cout << "Translated " << block_pcs.size() << " blocks from " << argv[1] << " into " << argv[2] << std::endl;
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+// Measures how long PixelRenderer takes to get a frame on screen, for each render mode.
+// Unlike the other tools this one needs SFML, it opens a window to draw into.
+//
+// render_bench [frames]
+//
+// Every frame gets a new screen with about half the pixels lit, close to the worst
+// case for the rectangle path, and is drawn and displayed without vsync.
+#include "../chip8.h"
+#include "../pixel_renderer.h"
+#include <SFML/Graphics.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+	double TimeFrames(sf::RenderWindow *window, chip8::PixelRenderer *renderer, unsigned int width, unsigned int height,
+		unsigned int frames)
+	{
+		unsigned long long rows[GFX_WORDS];
+		unsigned long long state = 0x9E3779B97F4A7C15ull;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int frame = 0; frame < frames; frame++)
+		{
+			for (unsigned int w = 0; w < width / 64 * height; w++)
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				rows[w] = state;
+			}
+
+			window->clear();
+			renderer->SetPixels(rows, width, height);
+			renderer->Render(window);
+			window->display();
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / frames;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int frames = 2000;
+	if (argc > 1)
+	{
+		frames = strtoul(argv[1], nullptr, 10);
+	}
+
+	sf::RenderWindow *window = new sf::RenderWindow(sf::VideoMode(SCREEN_WIDTH, SCREEN_HEIGHT), "CHIP8 render bench");
+	window->setVerticalSyncEnabled(false);
+	window->setFramerateLimit(0);
+
+	chip8::PixelRenderer *renderer = new chip8::PixelRenderer();
+
+	const chip8::RenderMode modes[] = { chip8::RENDER_RECTANGLES, chip8::RENDER_TEXTURE };
+	const char *names[] = { "rectangles", "texture" };
+	const unsigned int widths[] = { CHIP8_PIXEL_WIDTH, SCHIP_PIXEL_WIDTH };
+	const unsigned int heights[] = { CHIP8_PIXEL_HEIGHT, SCHIP_PIXEL_HEIGHT };
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		renderer->SetMode(modes[i]);
+		for (unsigned int r = 0; r < 2; r++)
+		{
+			TimeFrames(window, renderer, widths[r], heights[r], frames / 10 + 1);	// Warm up the driver
+			double ms = TimeFrames(window, renderer, widths[r], heights[r], frames);
+			printf("render %s %ux%u %u frames %.3f ms per frame\n", names[i], widths[r], heights[r], frames, ms);
+		}
+	}
+
+	delete renderer;
+	delete window;
+	return 0;
+}
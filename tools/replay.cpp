@@ -0,0 +1,113 @@
+// Plays back an input recording made with `chip8 <rom> --record <file>`, headless and as
+// fast as the core goes.
+//
+// replay <recording> [--jit] [--repeat N] [--expect hash] [--state output]
+//
+// Prints the instructions played, an FNV-1a hash of the final framebuffer (the same
+// one tools/batch writes) and how much faster than real time it ran. The recording
+// holds the machine state it started from, random seed included, so every playback
+// ends up in the same place. --expect exits with 1 if the hash comes out different,
+// which makes a recording of a bug report into a regression test. --state saves the
+// final machine for loading into the frontend.
+#include "../chip8.h"
+#include "../replay.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace chip8;
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: replay <recording> [--jit] [--repeat N] [--expect hash] [--state output]" << std::endl;
+		return 2;
+	}
+
+	Chip8 *engine = new Chip8();
+	unsigned long repeat = 1;
+	bool expect = false;
+	unsigned long long expected_hash = 0;
+	std::string state_file;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--jit")
+		{
+			if (!engine->SetEngine(ENGINE_JIT))
+			{
+				std::cerr << "JIT not available, using the interpreter" << std::endl;
+			}
+		}
+		else if (arg == "--repeat" && i + 1 < argc)
+		{
+			repeat = strtoul(argv[++i], nullptr, 10);
+			repeat = repeat > 0 ? repeat : 1;
+		}
+		else if (arg == "--expect" && i + 1 < argc)
+		{
+			expect = true;
+			expected_hash = strtoull(argv[++i], nullptr, 16);
+		}
+		else if (arg == "--state" && i + 1 < argc)
+		{
+			state_file = argv[++i];
+		}
+	}
+
+	InputReplay replay;
+	if (!replay.Open(argv[1]))
+	{
+		std::cerr << "Error: " << argv[1] << " is not an input recording" << std::endl;
+		delete engine;
+		return 2;
+	}
+
+	unsigned long long hash = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long run = 0; run < repeat; run++)
+	{
+		if (!replay.Start(engine) || !replay.Run(engine))
+		{
+			std::cerr << "Error: " << argv[1] << " is damaged, stopped after " << replay.GetCycles() << " instructions" << std::endl;
+			delete engine;
+			return 2;
+		}
+
+		unsigned long long run_hash = engine->GetScreenHash();
+		if (run > 0 && run_hash != hash)
+		{
+			std::cerr << "Error: run " << run + 1 << " ended differently from the first" << std::endl;
+			delete engine;
+			return 1;
+		}
+		hash = run_hash;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Real time is however long the instructions took at the recording's speed
+	double seconds = (double)replay.GetCycles() / engine->GetCyclesPerFrame() / FRAMES_PER_SECOND;
+	double per_run = elapsed.count() / repeat;
+	printf("instructions %llu\n", replay.GetCycles());
+	printf("framebuffer_hash %016llx\n", hash);
+	printf("wall_ms %.3f\n", per_run * 1000.0);
+	printf("speedup %.1f\n", per_run > 0.0 ? seconds / per_run : 0.0);
+
+	if (!state_file.empty() && !engine->SaveStateFile(state_file))
+	{
+		delete engine;
+		return 2;
+	}
+	delete engine;
+
+	if (expect && hash != expected_hash)
+	{
+		printf("expected %016llx\n", expected_hash);
+		return 1;
+	}
+	return 0;
+}
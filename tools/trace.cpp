@@ -0,0 +1,325 @@
+// Records, prints and compares execution traces, see trace.h for the format.
+//
+// trace record <rom> <frames> <output> [--jit] [--no-idle-skip]
+// trace dump <trace> [--pc first-last]
+// trace stats <trace>
+// trace diff <trace> <trace> [--pc first-last]
+//
+// record runs a ROM headless for the given number of 60Hz frames with the trace on,
+// so traces of the same ROM under different engines can be diffed. dump prints one
+// line per step, only for steps starting inside the pc range if one is given.
+//
+// diff walks both traces by instruction count. A compiled block in one trace covers
+// several instructions of the other, so pc and opcode are compared where both traces
+// start a step at the same count, I and V where both end one. It prints the first
+// difference and exits with 1, or 0 if the traces agree all the way to the same end.
+// One trace ending before the other counts as a difference, e.g. an engine that halted early.
+#include "../chip8.h"
+#include "../opcodes.h"
+#include "../trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace chip8;
+
+namespace
+{
+	struct PcRange
+	{
+		unsigned short first;
+		unsigned short last;
+
+		bool Contains(unsigned short pc) const
+		{
+			return (pc & 0xFFF) >= first && (pc & 0xFFF) <= last;
+		}
+	};
+
+	bool ParseRange(const char *text, PcRange &range)
+	{
+		char *end;
+		unsigned long first = strtoul(text, &end, 16);
+		if (*end != '-')
+		{
+			return false;
+		}
+		unsigned long last = strtoul(end + 1, &end, 16);
+		if (*end != '\0' || first > last || last > 0xFFF)
+		{
+			return false;
+		}
+		range.first = (unsigned short)first;
+		range.last = (unsigned short)last;
+		return true;
+	}
+
+	void PrintRecord(const char *prefix, const TraceRecord &record)
+	{
+		printf("%s%12llu  %03X  %04X  %-9s", prefix, record.cycle, record.pc, record.opcode,
+			op_names[ClassifyOpcode(record.opcode)]);
+		if (record.steps != 1)
+		{
+			printf("  +%u", record.steps);
+		}
+		if (record.i_changed)
+		{
+			printf("  I=%03X", record.i);
+		}
+		for (unsigned int x = 0; x < 16; x++)
+		{
+			if (record.v_changed & (1 << x))
+			{
+				printf("  V%X=%02X", x, record.v[x]);
+			}
+		}
+		printf("\n");
+	}
+
+	bool OpenTrace(TraceReader &reader, const char *file_name)
+	{
+		if (!reader.Open(file_name))
+		{
+			std::cerr << "Error: " << file_name << " is not a trace" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	void EndTrace(TraceReader &reader, const char *file_name)
+	{
+		if (reader.IsCorrupt())
+		{
+			std::cerr << "Warning: " << file_name << " ends in the middle of a record" << std::endl;
+		}
+	}
+
+	int Record(int argc, char **argv)
+	{
+		if (argc < 5)
+		{
+			std::cerr << "usage: trace record <rom> <frames> <output> [--jit] [--no-idle-skip]" << std::endl;
+			return 2;
+		}
+
+		Chip8 *engine = new Chip8();
+		if (engine->LoadGame(argv[2]) != ROM_OK)
+		{
+			delete engine;
+			return 2;
+		}
+		unsigned long frames = strtoul(argv[3], nullptr, 10);
+		for (int i = 5; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--jit") == 0 && !engine->SetEngine(ENGINE_JIT))
+			{
+				std::cerr << "JIT not available, using the interpreter" << std::endl;
+			}
+			else if (strcmp(argv[i], "--no-idle-skip") == 0)
+			{
+				engine->SetIdleSkip(false);
+			}
+		}
+
+		if (!engine->StartTrace(argv[4]))
+		{
+			std::cerr << "Error: could not create " << argv[4] << std::endl;
+			delete engine;
+			return 2;
+		}
+		for (unsigned long frame = 0; frame < frames; frame++)
+		{
+			engine->RunFrame();
+		}
+		bool written = engine->StopTrace();
+		delete engine;
+
+		if (!written)
+		{
+			std::cerr << "Error: could not write all of " << argv[4] << std::endl;
+			return 2;
+		}
+		return 0;
+	}
+
+	int Dump(int argc, char **argv)
+	{
+		PcRange range = { 0, 0xFFF };
+		if (argc < 3 || argc == 4 || (argc >= 5 && (strcmp(argv[3], "--pc") != 0 || !ParseRange(argv[4], range))))
+		{
+			std::cerr << "usage: trace dump <trace> [--pc first-last]" << std::endl;
+			return 2;
+		}
+
+		TraceReader reader;
+		if (!OpenTrace(reader, argv[2]))
+		{
+			return 2;
+		}
+
+		printf("%12s  %3s  %4s  %s\n", "cycle", "pc", "code", "op");
+		TraceRecord record;
+		while (reader.Next(record))
+		{
+			if (range.Contains(record.pc))
+			{
+				PrintRecord("", record);
+			}
+		}
+		EndTrace(reader, argv[2]);
+		return 0;
+	}
+
+	int Stats(int argc, char **argv)
+	{
+		if (argc < 3)
+		{
+			std::cerr << "usage: trace stats <trace>" << std::endl;
+			return 2;
+		}
+
+		TraceReader reader;
+		if (!OpenTrace(reader, argv[2]))
+		{
+			return 2;
+		}
+
+		unsigned long long steps = 0;
+		unsigned long long blocks = 0;
+		unsigned long long instructions = 0;
+		TraceRecord record;
+		while (reader.Next(record))
+		{
+			steps++;
+			blocks += record.steps != 1;
+			instructions = record.cycle;
+		}
+		EndTrace(reader, argv[2]);
+
+		FILE *file = fopen(argv[2], "rb");
+		fseek(file, 0, SEEK_END);
+		long bytes = ftell(file);
+		fclose(file);
+
+		printf("instructions %llu\n", instructions);
+		printf("steps %llu\n", steps);
+		printf("multi_instruction_steps %llu\n", blocks);
+		printf("bytes %ld\n", bytes);
+		printf("bytes_per_instruction %.3f\n", instructions != 0 ? (double)bytes / instructions : 0.0);
+		return 0;
+	}
+
+	int Diff(int argc, char **argv)
+	{
+		PcRange range = { 0, 0xFFF };
+		if (argc < 4 || argc == 5 || (argc >= 6 && (strcmp(argv[4], "--pc") != 0 || !ParseRange(argv[5], range))))
+		{
+			std::cerr << "usage: trace diff <trace> <trace> [--pc first-last]" << std::endl;
+			return 2;
+		}
+
+		TraceReader a, b;
+		if (!OpenTrace(a, argv[2]) || !OpenTrace(b, argv[3]))
+		{
+			return 2;
+		}
+
+		if (a.GetStartPc() != b.GetStartPc() || a.GetStartI() != b.GetStartI() ||
+			memcmp(a.GetStartV(), b.GetStartV(), 16) != 0)
+		{
+			printf("traces start from different states\n");
+			return 1;
+		}
+
+		TraceRecord ra, rb;
+		bool more_a = a.Next(ra);
+		bool more_b = b.Next(rb);
+		while (more_a && more_b)
+		{
+			bool check = range.Contains(ra.pc) || range.Contains(rb.pc);
+			const char *difference = nullptr;
+			if (ra.cycle - ra.steps == rb.cycle - rb.steps && check)
+			{
+				if (ra.pc != rb.pc)
+				{
+					difference = "pc";
+				}
+				else if (ra.opcode != rb.opcode)
+				{
+					difference = "opcode";
+				}
+			}
+			if (ra.cycle == rb.cycle && check && difference == nullptr)
+			{
+				if (ra.i != rb.i)
+				{
+					difference = "I";
+				}
+				else if (memcmp(ra.v, rb.v, sizeof(ra.v)) != 0)
+				{
+					difference = "V";
+				}
+			}
+
+			if (difference)
+			{
+				printf("%s differs by cycle %llu\n", difference, ra.cycle < rb.cycle ? ra.cycle : rb.cycle);
+				PrintRecord("< ", ra);
+				PrintRecord("> ", rb);
+				return 1;
+			}
+
+			// Step whichever trace is behind, both when they line up
+			unsigned long long cycle_a = ra.cycle;
+			unsigned long long cycle_b = rb.cycle;
+			if (cycle_a <= cycle_b)
+			{
+				more_a = a.Next(ra);
+			}
+			if (cycle_b <= cycle_a)
+			{
+				more_b = b.Next(rb);
+			}
+		}
+		EndTrace(a, argv[2]);
+		EndTrace(b, argv[3]);
+
+		if (more_a || more_b)
+		{
+			printf("traces agree until %s ends at cycle %llu, the other goes on\n", more_a ? argv[3] : argv[2],
+				more_a ? rb.cycle : ra.cycle);
+			return 1;
+		}
+		printf("traces agree\n");
+		return 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string command = argc > 1 ? argv[1] : "";
+	if (command == "record")
+	{
+		return Record(argc, argv);
+	}
+	else if (command == "dump")
+	{
+		return Dump(argc, argv);
+	}
+	else if (command == "stats")
+	{
+		return Stats(argc, argv);
+	}
+	else if (command == "diff")
+	{
+		return Diff(argc, argv);
+	}
+
+	std::cerr << "usage: trace record <rom> <frames> <output> [--jit] [--no-idle-skip]" << std::endl;
+	std::cerr << "       trace dump <trace> [--pc first-last]" << std::endl;
+	std::cerr << "       trace stats <trace>" << std::endl;
+	std::cerr << "       trace diff <trace> <trace> [--pc first-last]" << std::endl;
+	return 2;
+}
@@ -0,0 +1,506 @@
+#include "trace.h"
+#include <chrono>
+#include <cstring>
+
+#define TRACE_HEADER_SIZE 26
+#define TRACE_RECORD_MAX 40		// Flags, pc, opcode, steps, I and all 16 registers with their mask
+
+namespace chip8
+{
+	namespace
+	{
+		void PutVarint(unsigned char *&out, unsigned int value)
+		{
+			while (value >= 0x80)
+			{
+				*out++ = (unsigned char)(value | 0x80);
+				value >>= 7;
+			}
+			*out++ = (unsigned char)value;
+		}
+
+		// Small steps either way become small numbers, -1 is 1, 1 is 2 and so on
+		unsigned int ZigZag(unsigned short from, unsigned short to)
+		{
+			short difference = (short)(to - from);
+			return (unsigned short)((difference << 1) ^ (difference >> 15));
+		}
+
+		unsigned short UnZigZag(unsigned short from, unsigned int value)
+		{
+			return (unsigned short)(from + ((value >> 1) ^ (0 - (value & 1))));
+		}
+
+		unsigned short ChangedRegisters(const unsigned char *from, const unsigned char *to)
+		{
+			unsigned long long a[2], b[2];
+			memcpy(a, from, 16);
+			memcpy(b, to, 16);
+			if (a[0] == b[0] && a[1] == b[1])
+			{
+				return 0;
+			}
+
+			unsigned short changed = 0;
+			for (unsigned int x = 0; x < 16; x++)
+			{
+				if (from[x] != to[x])
+				{
+					changed |= 1 << x;
+				}
+			}
+			return changed;
+		}
+	}
+
+	TraceWriter::TraceWriter(unsigned int buffer_bytes)
+	{
+		size_t size = 1024;
+		while (size < buffer_bytes)
+		{
+			size <<= 1;
+		}
+		ring_.resize(size);
+		mask_ = size - 1;
+
+		head_ = 0;
+		tail_ = 0;
+		closing_ = false;
+		tail_cache_ = 0;
+		file_ = nullptr;
+		failed_ = false;
+		records_ = 0;
+		instructions_ = 0;
+		bytes_ = 0;
+		stalls_ = 0;
+	}
+
+	TraceWriter::~TraceWriter()
+	{
+		Close();
+	}
+
+	bool TraceWriter::Open(const std::string &file_name, unsigned short pc, unsigned short i, const unsigned char *v)
+	{
+		Close();
+
+		file_ = fopen(file_name.c_str(), "wb");
+		if (file_ == nullptr)
+		{
+			return false;
+		}
+
+		unsigned char header[TRACE_HEADER_SIZE];
+		memcpy(header, "C8TR", 4);
+		header[4] = TRACE_VERSION & 0xFF;
+		header[5] = TRACE_VERSION >> 8;
+		header[6] = pc & 0xFF;
+		header[7] = pc >> 8;
+		header[8] = i & 0xFF;
+		header[9] = i >> 8;
+		memcpy(header + 10, v, 16);
+		if (fwrite(header, 1, sizeof(header), file_) != sizeof(header))
+		{
+			fclose(file_);
+			file_ = nullptr;
+			return false;
+		}
+
+		pc_ = pc;
+		i_ = i;
+		memcpy(v_, v, sizeof(v_));
+		memset(opcodes_, 0, sizeof(opcodes_));
+
+		head_ = 0;
+		tail_ = 0;
+		closing_ = false;
+		tail_cache_ = 0;
+		failed_ = false;
+		records_ = 0;
+		instructions_ = 0;
+		bytes_ = sizeof(header);
+		stalls_ = 0;
+
+		writer_ = std::thread(&TraceWriter::Writer, this);
+		return true;
+	}
+
+	void TraceWriter::Record(unsigned short pc, unsigned short opcode, unsigned int steps, unsigned short i, const unsigned char *v)
+	{
+		unsigned char record[TRACE_RECORD_MAX];
+		unsigned char *out = record + 1;
+		unsigned char flags = 0;
+
+		if (pc != pc_)
+		{
+			flags |= TRACE_PC;
+			PutVarint(out, ZigZag(pc_, pc));
+		}
+
+		// Code mostly stays put, so each opcode only has to be written the first time its address runs
+		unsigned short address = pc & 0xFFF;
+		if (opcode != opcodes_[address])
+		{
+			flags |= TRACE_OPCODE;
+			*out++ = (unsigned char)(opcode >> 8);
+			*out++ = (unsigned char)opcode;
+			opcodes_[address] = opcode;
+		}
+
+		if (steps != 1)
+		{
+			flags |= TRACE_STEPS;
+			PutVarint(out, steps);
+		}
+
+		if (i != i_)
+		{
+			flags |= TRACE_I;
+			PutVarint(out, ZigZag(i_, i));
+			i_ = i;
+		}
+
+		unsigned short changed = ChangedRegisters(v_, v);
+		if (changed != 0)
+		{
+			if ((changed & (changed - 1)) == 0)
+			{
+				// Nearly every instruction writes at most one register, leaving VF aside
+				unsigned char x = 0;
+				while (!(changed & (1 << x)))
+				{
+					x++;
+				}
+				flags |= TRACE_V;
+				*out++ = x;
+				*out++ = v[x];
+			}
+			else
+			{
+				flags |= TRACE_V_MASK;
+				PutVarint(out, changed);
+				for (unsigned int x = 0; x < 16; x++)
+				{
+					if (changed & (1 << x))
+					{
+						*out++ = v[x];
+					}
+				}
+			}
+			memcpy(v_, v, sizeof(v_));
+		}
+
+		record[0] = flags;
+		pc_ = (unsigned short)(pc + 2 * steps);
+		records_++;
+		instructions_ += steps;
+		Push(record, out - record);
+	}
+
+	void TraceWriter::Push(const unsigned char *data, size_t size)
+	{
+		if (file_ == nullptr)
+		{
+			return;
+		}
+
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head + size - tail_cache_ > ring_.size())
+		{
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if (head + size - tail_cache_ > ring_.size())
+			{
+				// The disk fell behind, wait rather than lose records
+				stalls_++;
+				do
+				{
+					std::this_thread::yield();
+					tail_cache_ = tail_.load(std::memory_order_acquire);
+				} while (head + size - tail_cache_ > ring_.size());
+			}
+		}
+
+		size_t start = head & mask_;
+		size_t first = ring_.size() - start;
+		if (first >= size)
+		{
+			memcpy(&ring_[start], data, size);
+		}
+		else
+		{
+			memcpy(&ring_[start], data, first);
+			memcpy(&ring_[0], data + first, size - first);
+		}
+		head_.store(head + size, std::memory_order_release);
+		bytes_ += size;
+	}
+
+	void TraceWriter::Writer()
+	{
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			// Look at closing_ first, everything pushed before it was set is in head_ then
+			bool closing = closing_.load(std::memory_order_acquire);
+			size_t head = head_.load(std::memory_order_acquire);
+			if (head == tail)
+			{
+				if (closing)
+				{
+					return;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			size_t start = tail & mask_;
+			size_t size = head - tail;
+			if (size > ring_.size() - start)
+			{
+				size = ring_.size() - start;
+			}
+			if (fwrite(&ring_[start], 1, size, file_) != size)
+			{
+				failed_ = true;
+			}
+			tail += size;
+			tail_.store(tail, std::memory_order_release);
+		}
+	}
+
+	bool TraceWriter::Close()
+	{
+		if (file_ == nullptr)
+		{
+			return !failed_;
+		}
+
+		closing_.store(true, std::memory_order_release);
+		writer_.join();
+		if (fclose(file_) != 0)
+		{
+			failed_ = true;
+		}
+		file_ = nullptr;
+		return !failed_;
+	}
+
+	unsigned long long TraceWriter::GetRecords()
+	{
+		return records_;
+	}
+
+	unsigned long long TraceWriter::GetInstructions()
+	{
+		return instructions_;
+	}
+
+	unsigned long long TraceWriter::GetBytes()
+	{
+		return bytes_;
+	}
+
+	unsigned long long TraceWriter::GetStalls()
+	{
+		return stalls_;
+	}
+
+	TraceReader::TraceReader()
+	{
+		file_ = nullptr;
+		position_ = 0;
+		size_ = 0;
+		corrupt_ = false;
+	}
+
+	TraceReader::~TraceReader()
+	{
+		Close();
+	}
+
+	bool TraceReader::Open(const std::string &file_name)
+	{
+		Close();
+
+		file_ = fopen(file_name.c_str(), "rb");
+		if (file_ == nullptr)
+		{
+			return false;
+		}
+
+		unsigned char header[TRACE_HEADER_SIZE];
+		if (fread(header, 1, sizeof(header), file_) != sizeof(header) || memcmp(header, "C8TR", 4) != 0 ||
+			(header[4] | header[5] << 8) != TRACE_VERSION)
+		{
+			Close();
+			return false;
+		}
+
+		start_pc_ = (unsigned short)(header[6] | header[7] << 8);
+		start_i_ = (unsigned short)(header[8] | header[9] << 8);
+		memcpy(start_v_, header + 10, sizeof(start_v_));
+
+		cycle_ = 0;
+		pc_ = start_pc_;
+		i_ = start_i_;
+		memcpy(v_, start_v_, sizeof(v_));
+		memset(opcodes_, 0, sizeof(opcodes_));
+		position_ = 0;
+		size_ = 0;
+		corrupt_ = false;
+		return true;
+	}
+
+	void TraceReader::Close()
+	{
+		if (file_)
+		{
+			fclose(file_);
+			file_ = nullptr;
+		}
+	}
+
+	bool TraceReader::GetByte(unsigned char &byte)
+	{
+		if (position_ == size_)
+		{
+			size_ = file_ ? fread(buffer_, 1, sizeof(buffer_), file_) : 0;
+			position_ = 0;
+			if (size_ == 0)
+			{
+				return false;
+			}
+		}
+		byte = buffer_[position_++];
+		return true;
+	}
+
+	bool TraceReader::GetVarint(unsigned int &value)
+	{
+		value = 0;
+		for (unsigned int shift = 0; shift < 35; shift += 7)
+		{
+			unsigned char byte;
+			if (!GetByte(byte))
+			{
+				return false;
+			}
+			value |= (unsigned int)(byte & 0x7F) << shift;
+			if (byte < 0x80)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool TraceReader::Next(TraceRecord &record)
+	{
+		unsigned char flags;
+		if (!GetByte(flags))
+		{
+			// Ending between records is the normal way for a trace to end
+			return false;
+		}
+
+		unsigned int value;
+		unsigned char byte[2];
+		if (flags & ~(TRACE_PC | TRACE_OPCODE | TRACE_STEPS | TRACE_I | TRACE_V | TRACE_V_MASK))
+		{
+			goto Corrupt;
+		}
+
+		if (flags & TRACE_PC)
+		{
+			if (!GetVarint(value))
+			{
+				goto Corrupt;
+			}
+			pc_ = UnZigZag(pc_, value);
+		}
+		record.pc = pc_;
+
+		if (flags & TRACE_OPCODE)
+		{
+			if (!GetByte(byte[0]) || !GetByte(byte[1]))
+			{
+				goto Corrupt;
+			}
+			opcodes_[pc_ & 0xFFF] = (unsigned short)(byte[0] << 8 | byte[1]);
+		}
+		record.opcode = opcodes_[pc_ & 0xFFF];
+
+		record.steps = 1;
+		if ((flags & TRACE_STEPS) && !GetVarint(record.steps))
+		{
+			goto Corrupt;
+		}
+
+		record.i_changed = (flags & TRACE_I) != 0;
+		if (record.i_changed)
+		{
+			if (!GetVarint(value))
+			{
+				goto Corrupt;
+			}
+			i_ = UnZigZag(i_, value);
+		}
+
+		record.v_changed = 0;
+		if (flags & TRACE_V)
+		{
+			if (!GetByte(byte[0]) || !GetByte(byte[1]) || byte[0] >= 16)
+			{
+				goto Corrupt;
+			}
+			record.v_changed = (unsigned short)(1 << byte[0]);
+			v_[byte[0]] = byte[1];
+		}
+		if (flags & TRACE_V_MASK)
+		{
+			if (!GetVarint(value) || value > 0xFFFF)
+			{
+				goto Corrupt;
+			}
+			record.v_changed |= (unsigned short)value;
+			for (unsigned int x = 0; x < 16; x++)
+			{
+				if ((value & (1 << x)) && !GetByte(v_[x]))
+				{
+					goto Corrupt;
+				}
+			}
+		}
+
+		cycle_ += record.steps;
+		pc_ = (unsigned short)(pc_ + 2 * record.steps);
+		record.cycle = cycle_;
+		record.i = i_;
+		memcpy(record.v, v_, sizeof(record.v));
+		return true;
+
+	Corrupt:
+		corrupt_ = true;
+		return false;
+	}
+
+	bool TraceReader::IsCorrupt()
+	{
+		return corrupt_;
+	}
+
+	unsigned short TraceReader::GetStartPc()
+	{
+		return start_pc_;
+	}
+
+	unsigned short TraceReader::GetStartI()
+	{
+		return start_i_;
+	}
+
+	const unsigned char *TraceReader::GetStartV()
+	{
+		return start_v_;
+	}
+}
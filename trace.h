@@ -0,0 +1,158 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_BYTES (1024 * 1024)	// About half a million instructions in flight
+
+namespace chip8
+{
+	// Execution traces, written by Chip8::StartTrace() and read back by tools/trace.
+	//
+	// A trace file starts with "C8TR", a u16 version and the pc, I and V registers
+	// the trace started from, then holds one record per step. A step is usually one
+	// instruction, but a whole block when compiled code ran and a whole loop when an
+	// idle loop was skipped. Each record is a flags byte followed by only what the
+	// flags say changed:
+	//
+	//   TRACE_PC      pc isn't the last one plus two per step, zigzag varint of the difference
+	//   TRACE_OPCODE  the opcode at pc isn't the one seen there last, two bytes
+	//   TRACE_STEPS   more than one instruction ran, varint count
+	//   TRACE_I       I changed, zigzag varint of the difference
+	//   TRACE_V       one V register changed, its index and new value
+	//   TRACE_V_MASK  several V registers changed, varint bit mask and the new values
+	//
+	// Straight-line code comes to two or three bytes an instruction.
+	enum TraceFlags
+	{
+		TRACE_PC = 0x01,
+		TRACE_OPCODE = 0x02,
+		TRACE_STEPS = 0x04,
+		TRACE_I = 0x08,
+		TRACE_V = 0x10,
+		TRACE_V_MASK = 0x20
+	};
+
+	// Streams records to a file from a background thread.
+	//
+	// Record() only encodes into a single producer, single consumer ring and never
+	// locks, the writer thread drains the ring to disk. Nothing is ever dropped,
+	// if the disk falls behind and the ring fills up Record() waits for room.
+	class TraceWriter
+	{
+	private:
+		std::vector<unsigned char> ring_;
+		size_t mask_;
+
+		// head_ is only written by Record(), tail_ only by the writer thread
+		std::atomic<size_t> head_;
+		std::atomic<size_t> tail_;
+		std::atomic<bool> closing_;
+		size_t tail_cache_;		// Last tail_ Record() saw, saves reloading it every time
+
+		FILE *file_;
+		std::thread writer_;
+		bool failed_;
+
+		// Last recorded state, records only carry what changed since
+		unsigned short pc_;
+		unsigned short i_;
+		unsigned char v_[16];
+		unsigned short opcodes_[4096];
+
+		unsigned long long records_;
+		unsigned long long instructions_;
+		unsigned long long bytes_;
+		unsigned long long stalls_;
+
+		TraceWriter(const TraceWriter &other);
+		TraceWriter &operator=(const TraceWriter &other);
+
+		void Push(const unsigned char *data, size_t size);
+		void Writer();
+	public:
+		// buffer_bytes is rounded up to a power of two
+		explicit TraceWriter(unsigned int buffer_bytes);
+		~TraceWriter();
+
+		// Create file_name, write the header and start the writer thread.
+		// pc, i and v are the state the trace starts from.
+		bool Open(const std::string &file_name, unsigned short pc, unsigned short i, const unsigned char *v);
+		// steps instructions ran starting at pc, which holds opcode, and left I and V like this
+		void Record(unsigned short pc, unsigned short opcode, unsigned int steps, unsigned short i, const unsigned char *v);
+		// Drain the ring, stop the writer thread and close the file.
+		// Returns false if anything failed to write.
+		bool Close();
+
+		unsigned long long GetRecords();
+		unsigned long long GetInstructions();
+		// Bytes written so far, header included
+		unsigned long long GetBytes();
+		// Times Record() had to wait for the writer thread
+		unsigned long long GetStalls();
+	};
+
+	// One decoded trace record
+	struct TraceRecord
+	{
+		unsigned long long cycle;	// Instructions run by the end of this step, since the trace started
+		unsigned short pc;			// Where the step started
+		unsigned short opcode;		// Instruction at pc
+		unsigned int steps;			// Instructions in this step
+		unsigned short i;			// I and V once the step was done
+		unsigned char v[16];
+		bool i_changed;
+		unsigned short v_changed;	// Bit x set if Vx changed
+	};
+
+	class TraceReader
+	{
+	private:
+		FILE *file_;
+		unsigned char buffer_[64 * 1024];
+		size_t position_;
+		size_t size_;
+		bool corrupt_;
+
+		unsigned short start_pc_;
+		unsigned short start_i_;
+		unsigned char start_v_[16];
+
+		// Running state, like in TraceWriter
+		unsigned long long cycle_;
+		unsigned short pc_;
+		unsigned short i_;
+		unsigned char v_[16];
+		unsigned short opcodes_[4096];
+
+		TraceReader(const TraceReader &other);
+		TraceReader &operator=(const TraceReader &other);
+
+		bool GetByte(unsigned char &byte);
+		bool GetVarint(unsigned int &value);
+	public:
+		TraceReader();
+		~TraceReader();
+
+		// Returns false if the file can't be read or isn't a trace of this version
+		bool Open(const std::string &file_name);
+		void Close();
+		// Returns false at the end of the trace
+		bool Next(TraceRecord &record);
+		// Whether Next() stopped at something that isn't a whole record, like when the
+		// program writing the trace crashed
+		bool IsCorrupt();
+
+		// State the trace started from, the pc is where the first step starts
+		unsigned short GetStartPc();
+		unsigned short GetStartI();
+		const unsigned char *GetStartV();
+	};
+}
+
+#endif //TRACE_H
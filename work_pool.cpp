@@ -0,0 +1,158 @@
+#include "work_pool.h"
+
+namespace chip8
+{
+	WorkPool::WorkPool(unsigned int threads)
+	{
+		if (threads == 0)
+		{
+			threads = std::thread::hardware_concurrency();
+		}
+		if (threads == 0)
+		{
+			threads = 1;
+		}
+
+		generation_ = 0;
+		stopping_ = false;
+		job_ = nullptr;
+		remaining_ = 0;
+
+		for (unsigned int i = 0; i < threads; i++)
+		{
+			queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+		}
+
+		// Worker 0 is whoever calls Run()
+		for (unsigned int i = 1; i < threads; i++)
+		{
+			threads_.push_back(std::thread(&WorkPool::Worker, this, i));
+		}
+	}
+
+	WorkPool::~WorkPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		start_.notify_all();
+
+		for (size_t i = 0; i < threads_.size(); i++)
+		{
+			threads_[i].join();
+		}
+	}
+
+	unsigned int WorkPool::GetThreadCount()
+	{
+		return (unsigned int)queues_.size();
+	}
+
+	void WorkPool::Run(unsigned int count, const std::function<void(unsigned int)> &job)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		job_ = &job;
+		remaining_ = count;
+
+		// Contiguous slices so neighbouring jobs stay on one thread unless they get stolen
+		unsigned int workers = GetThreadCount();
+		for (unsigned int w = 0; w < workers; w++)
+		{
+			unsigned int begin = (unsigned int)((unsigned long long)count * w / workers);
+			unsigned int end = (unsigned int)((unsigned long long)count * (w + 1) / workers);
+
+			std::lock_guard<std::mutex> lock(queues_[w]->mutex);
+			for (unsigned int i = begin; i < end; i++)
+			{
+				queues_[w]->jobs.push_back(i);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			generation_++;
+		}
+		start_.notify_all();
+
+		Drain(0);
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (remaining_ != 0)
+		{
+			done_.wait(lock);
+		}
+	}
+
+	void WorkPool::Worker(unsigned int index)
+	{
+		unsigned int seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (!stopping_ && generation_ == seen)
+				{
+					start_.wait(lock);
+				}
+				if (stopping_)
+				{
+					return;
+				}
+				seen = generation_;
+			}
+
+			Drain(index);
+		}
+	}
+
+	void WorkPool::Drain(unsigned int index)
+	{
+		unsigned int job;
+		while (Pop(index, job))
+		{
+			(*job_)(job);
+
+			if (--remaining_ == 0)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				done_.notify_all();
+			}
+		}
+	}
+
+	bool WorkPool::Pop(unsigned int index, unsigned int &job)
+	{
+		// Own work first, in order from the front of our slice
+		{
+			Queue &own = *queues_[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				job = own.jobs.front();
+				own.jobs.pop_front();
+				return true;
+			}
+		}
+
+		// Then steal from the far end of everyone else's
+		unsigned int workers = GetThreadCount();
+		for (unsigned int i = 1; i < workers; i++)
+		{
+			Queue &victim = *queues_[(index + i) % workers];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				job = victim.jobs.back();
+				victim.jobs.pop_back();
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
\ No newline at end of file
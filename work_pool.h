@@ -0,0 +1,57 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+	// Fixed set of worker threads that run a parallel for over job indices.
+	// Each worker starts on its own slice of the indices and steals from the
+	// others once it runs dry, so uneven jobs still keep every core busy.
+	class WorkPool
+	{
+	private:
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<unsigned int> jobs;
+		};
+
+		std::vector<std::thread> threads_;
+		std::vector<std::unique_ptr<Queue> > queues_;
+
+		std::mutex mutex_;
+		std::condition_variable start_;
+		std::condition_variable done_;
+		unsigned int generation_;
+		bool stopping_;
+
+		const std::function<void(unsigned int)> *job_;
+		std::atomic<unsigned int> remaining_;
+
+		WorkPool(const WorkPool &other);
+		WorkPool &operator=(const WorkPool &other);
+
+		void Worker(unsigned int index);
+		void Drain(unsigned int index);
+		bool Pop(unsigned int index, unsigned int &job);
+	public:
+		// 0 threads uses one per hardware thread. The calling thread counts as one of them.
+		explicit WorkPool(unsigned int threads);
+		~WorkPool();
+
+		unsigned int GetThreadCount();
+
+		// Call job(i) for every i in [0, count) and wait for all of them to finish
+		void Run(unsigned int count, const std::function<void(unsigned int)> &job);
+	};
+}
+
+#endif //WORK_POOL_H
\ No newline at end of file